@@ -21,6 +21,7 @@ SOURCES += \
     mainapplication.cpp \
     mail.cpp \
     mailbox.cpp \
+    mailboxindex.cpp \
     mailmessenger.cpp \
     messagereceiver.cpp \
     messagethreaddatamodel.cpp \
@@ -43,6 +44,7 @@ HEADERS += \
     contactrequest.h \
     mail.h \
     mailbox.h \
+    mailboxindex.h \
     mailmessenger.h \
     mainapplication.h \
     messagereceiver.h \
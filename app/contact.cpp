@@ -40,9 +40,14 @@ WP::err Contact::createUserIdentityContact(KeyStore *keyStore, const QString &ke
 
 WP::err Contact::open(KeyStoreFinder *keyStoreFinder)
 {
-    QString type;
-    WP::err error = read("keystore_type", type);
-    if (error == WP::kOk && type == "private") {
+    QStringList paths;
+    paths << "keystore_type" << "uid" << "address";
+    QMap<QString, QByteArray> data;
+    WP::err error = readMany(paths, data);
+    if (error != WP::kOk)
+        return error;
+
+    if (data.value("keystore_type") == "private") {
         privateKeyStore = true;
         keys = new ContactKeysKeyStore(database, getKeysDirectory(), database->getKeyStore());
     } else
@@ -52,16 +57,10 @@ WP::err Contact::open(KeyStoreFinder *keyStoreFinder)
     if (error != WP::kOk)
         return error;
 
-    error = read("uid", uid);
-    if (error != WP::kOk)
-        return error;
-
-    QString address;
-    error = read("address", address);
-    if (error != WP::kOk)
-        return error;
-
-    setAddress(address);
+    if (!data.contains("uid") || !data.contains("address"))
+        return WP::kEntryNotFound;
+    uid = data["uid"];
+    setAddress(data["address"]);
 
     return error;
 }
@@ -298,20 +297,25 @@ WP::err ContactKeysBuddies::writeConfig()
 
 WP::err ContactKeysBuddies::open()
 {
-    WP::err error = ContactKeys::open();
+    // read all keys in one pass
+    QMap<QString, QByteArray> data;
+    WP::err error = readTree("", data);
     if (error != WP::kOk)
         return error;
+    if (!data.contains("main_key_id"))
+        return WP::kEntryNotFound;
+    mainKeyId = data["main_key_id"];
 
     QStringList keyIds = listDirectories("");
     foreach (const QString &keyId, keyIds) {
         PublicKeySet keySet;
-        error = read(keyId + "/certificate", keySet.certificate);
-        if (error != WP::kOk)
-            return error;
+        QMap<QString, QByteArray>::const_iterator certificate = data.find(keyId + "/certificate");
         // the public key is needed by the server to verify incoming data so it can't be stored encrypted
-        error = read(keyId + "/public_key", keySet.publicKey);
-        if (error != WP::kOk)
-            return error;
+        QMap<QString, QByteArray>::const_iterator publicKey = data.find(keyId + "/public_key");
+        if (certificate == data.end() || publicKey == data.end())
+            return WP::kEntryNotFound;
+        keySet.certificate = certificate.value();
+        keySet.publicKey = publicKey.value();
         keyMap[keyId] = keySet;
     }
 
@@ -351,3 +355,37 @@ WP::err ContactKeysBuddies::addKeySet(const QString &keyId, const QString &certi
     keyMap[keyId] = keySet;
     return WP::kOk;
 }
+
+
+const QList<Contact *> &ContactRegistry::getContacts() const
+{
+    return contacts;
+}
+
+bool ContactRegistry::add(Contact *contact)
+{
+    QString uid = contact->getUid();
+    if (uidIndex.contains(uid))
+        return false;
+    contacts.append(contact);
+    uidIndex[uid] = contact;
+    addressIndex[contact->getAddress()] = contact;
+    return true;
+}
+
+void ContactRegistry::clear()
+{
+    contacts.clear();
+    uidIndex.clear();
+    addressIndex.clear();
+}
+
+Contact *ContactRegistry::findByUid(const QString &uid) const
+{
+    return uidIndex.value(uid, NULL);
+}
+
+Contact *ContactRegistry::findByAddress(const QString &address) const
+{
+    return addressIndex.value(address, NULL);
+}
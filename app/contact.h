@@ -3,6 +3,7 @@
 
 #include "databaseutil.h"
 
+#include <QHash>
 #include <QMap>
 #include <QStringList>
 
@@ -135,4 +136,23 @@ public:
     virtual Contact *find(const QString &uid) = 0;
 };
 
+
+//! List of contacts that is indexed by uid and address. The registry doesn't own the contacts.
+class ContactRegistry {
+public:
+    const QList<Contact *> &getContacts() const;
+
+    //! returns false if a contact with the same uid is already registered
+    bool add(Contact *contact);
+    void clear();
+
+    Contact *findByUid(const QString &uid) const;
+    Contact *findByAddress(const QString &address) const;
+
+private:
+    QList<Contact *> contacts;
+    QHash<QString, Contact *> uidIndex;
+    QHash<QString, Contact *> addressIndex;
+};
+
 #endif // CONTACT_H
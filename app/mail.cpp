@@ -2,7 +2,17 @@
 
 #include <QBuffer>
 #include <QString>
+#include <QtEndian>
 
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+
+DataParcel::DataParcel() :
+    sender(NULL)
+{
+}
 
 const QByteArray DataParcel::getSignature() const
 {
@@ -24,8 +34,20 @@ QString DataParcel::getUid() const
     return uid;
 }
 
+void DataParcel::invalidateRawData()
+{
+    cachedRawData.clear();
+}
+
 WP::err DataParcel::toRawData(Contact *_sender, const QString &_signatureKey, QIODevice &rawData)
 {
+    // nothing changed since the last time, don't sign again
+    if (!cachedRawData.isEmpty() && sender == _sender && signatureKey == _signatureKey) {
+        if (rawData.write(cachedRawData) != cachedRawData.length())
+            return WP::kError;
+        return WP::kOk;
+    }
+
     sender = _sender;
     signatureKey = _signatureKey;
 
@@ -58,18 +80,33 @@ WP::err DataParcel::toRawData(Contact *_sender, const QString &_signatureKey, QI
         return error;
 
     // write signature header
-    QDataStream rawDataStream(&rawData);
-    rawDataStream << signature.length();
-    if (rawData.write(signature) != signature.length())
-        return WP::kError;
-    if (rawData.write(containerData) != containerData.length())
+    QByteArray signedData;
+    QDataStream signedDataStream(&signedData, QIODevice::WriteOnly);
+    signedDataStream << signature.length();
+    signedData.append(signature);
+    signedData.append(containerData);
+    if (rawData.write(signedData) != signedData.length())
         return WP::kError;
 
+    cachedRawData = signedData;
     return WP::kOk;
 }
 
 QString DataParcel::readString(QIODevice &data) const
 {
+    // parcels are mostly read from a buffer, find the terminator without reading char by char
+    QBuffer *buffer = qobject_cast<QBuffer*>(&data);
+    if (buffer != NULL) {
+        const QByteArray &bufferData = buffer->data();
+        int start = buffer->pos();
+        int end = bufferData.indexOf('\0', start);
+        if (end < 0)
+            end = bufferData.size();
+        QString string = QString::fromLatin1(bufferData.constData() + start, end - start);
+        buffer->seek(qMin(end + 1, bufferData.size()));
+        return string;
+    }
+
     QString string;
     char c;
     while (data.getChar(&c)) {
@@ -80,40 +117,72 @@ QString DataParcel::readString(QIODevice &data) const
     return string;
 }
 
+bool DataParcel::readData(QDataStream &stream, QByteArray &data) const
+{
+    qint32 length;
+    stream >> length;
+    if (stream.status() != QDataStream::Ok || length < 0
+            || length > stream.device()->bytesAvailable())
+        return false;
+    data = stream.device()->read(length);
+    return data.length() == length;
+}
+
+//! reads a big endian value like QDataStream
+static bool readUInt32(const QByteArray &data, int &position, quint32 &value)
+{
+    if (data.size() - position < 4)
+        return false;
+    value = qFromBigEndian<quint32>((const uchar*)data.constData() + position);
+    position += 4;
+    return true;
+}
+
+static bool readCString(const QByteArray &data, int &position, QString &string)
+{
+    int end = data.indexOf('\0', position);
+    if (end < 0)
+        return false;
+    string = QString::fromLatin1(data.constData() + position, end - position);
+    position = end + 1;
+    return true;
+}
+
 WP::err DataParcel::fromRawData(ContactFinder *contactFinder, QByteArray &rawData)
 {
-    QDataStream stream(&rawData, QIODevice::ReadOnly);
+    invalidateRawData();
+
+    // the signed data and the main data are slices of rawData, only the signature is copied
+    int position = 0;
     quint32 signatureLength;
-    stream >> signatureLength;
-    if (signatureLength <= 0 || signatureLength >= (quint32)rawData.size())
+    if (!readUInt32(rawData, position, signatureLength))
         return WP::kBadValue;
+    if (signatureLength <= 0 || signatureLength >= (quint32)(rawData.size() - position))
+        return WP::kBadValue;
+    signature = rawData.mid(position, signatureLength);
+    position += signatureLength;
 
-    char *buffer = new char[signatureLength];
-    stream.device()->read(buffer, signatureLength);
-    signature.clear();
-    signature.append(buffer, signatureLength);
-    delete[] buffer;
-
-    int position = stream.device()->pos();
-    QByteArray signedData;
-    signedData.setRawData(rawData.data() + position, rawData.length() - position);
+    QByteArray signedData = QByteArray::fromRawData(rawData.constData() + position,
+                                                    rawData.size() - position);
     CryptoInterface *crypto = CryptoInterfaceSingleton::getCryptoInterface();
     QByteArray signatureHash = crypto->toHex(crypto->sha2Hash(signedData)).toLatin1();
 
-    QString senderUid = readString(*stream.device());
-    signatureKey = readString(*stream.device());
+    QString senderUid;
+    if (!readCString(rawData, position, senderUid))
+        return WP::kBadValue;
+    if (!readCString(rawData, position, signatureKey))
+        return WP::kBadValue;
 
     sender = contactFinder->find(senderUid);
     if (sender == NULL)
         return WP::kContactNotFound;
 
-    int mainDataLength;
-    stream >> mainDataLength;
-
-    // TODO do proper QIODevice reading
-    QByteArray mainData = stream.device()->read(mainDataLength);
-    if (mainData.length() != mainDataLength)
+    quint32 mainDataLength;
+    if (!readUInt32(rawData, position, mainDataLength))
+        return WP::kBadValue;
+    if (mainDataLength > (quint32)(rawData.size() - position))
         return WP::kError;
+    QByteArray mainData = QByteArray::fromRawData(rawData.constData() + position, mainDataLength);
     uid = crypto->toHex(crypto->sha1Hash(mainData));
 
     QBuffer mainDataBuffer(&mainData);
@@ -126,9 +195,17 @@ WP::err DataParcel::fromRawData(ContactFinder *contactFinder, QByteArray &rawDat
     if (!sender->verify(signatureKey, signatureHash, signature))
         return WP::kBadValue;
 
+    cachedRawData = rawData;
     return WP::kOk;
 }
 
+ParcelCrypto::~ParcelCrypto()
+{
+    // only the last owner of the shared data wipes it, data() would detach otherwise
+    if (symmetricKey.isDetached())
+        ChannelKeyCache::wipe(symmetricKey.data(), symmetricKey.size());
+}
+
 void ParcelCrypto::initNew()
 {
     CryptoInterface *crypto = CryptoInterfaceSingleton::getCryptoInterface();
@@ -140,16 +217,25 @@ WP::err ParcelCrypto::initFromPublic(Contact *receiver, const QString &keyId, co
 {
     this->iv = iv;
 
+    CryptoInterface *crypto = CryptoInterfaceSingleton::getCryptoInterface();
+    // the channel uid is the hash of the iv, see SecureChannel::getUid()
+    QString channelUid = crypto->toHex(crypto->sha1Hash(iv));
+    ChannelKeyCache *cache = ChannelKeyCache::get();
+    if (cache->find(channelUid, keyId, encryptedSymmetricKey, symmetricKey))
+        return WP::kOk;
+
     QString certificate;
     QString publicKey;
     QString privateKey;
     WP::err error = receiver->getKeys()->getKeySet(keyId, certificate, publicKey, privateKey);
     if (error != WP::kOk)
         return error;
-    CryptoInterface *crypto = CryptoInterfaceSingleton::getCryptoInterface();
     error = crypto->decryptAsymmetric(encryptedSymmetricKey, symmetricKey, privateKey, "", certificate);
+    if (privateKey.isDetached())
+        ChannelKeyCache::wipe(privateKey.data(), privateKey.size() * sizeof(QChar));
     if (error != WP::kOk)
         return error;
+    cache->insert(channelUid, keyId, encryptedSymmetricKey, symmetricKey);
     return error;
 }
 
@@ -202,6 +288,129 @@ WP::err ParcelCrypto::getEncryptedSymmetricKey(Contact *receiver, const QString
 }
 
 
+ChannelKeyCache *ChannelKeyCache::sCache = NULL;
+
+ChannelKeyCache *ChannelKeyCache::get()
+{
+    if (sCache == NULL)
+        sCache = new ChannelKeyCache();
+    return sCache;
+}
+
+void ChannelKeyCache::destroy()
+{
+    delete sCache;
+    sCache = NULL;
+}
+
+void ChannelKeyCache::wipe(void *data, int size)
+{
+    volatile char *bytes = (volatile char*)data;
+    for (int i = 0; i < size; i++)
+        bytes[i] = 0;
+}
+
+ChannelKeyCache::ChannelKeyCache() :
+    keyBuffer(NULL),
+    keyBufferSize(kSlotCount * kSlotSize),
+    locked(false)
+{
+#ifdef Q_OS_UNIX
+    // own pages, so that locking and unlocking doesn't affect other allocations
+    void *buffer = mmap(NULL, keyBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+    if (buffer != MAP_FAILED) {
+        keyBuffer = (char*)buffer;
+        // keep the keys out of swap; not fatal if the lock limit is reached
+        locked = (mlock(keyBuffer, keyBufferSize) == 0);
+    }
+#else
+    keyBuffer = new char[keyBufferSize];
+#endif
+    if (keyBuffer == NULL)
+        return;
+    for (int i = 0; i < kSlotCount; i++)
+        freeSlots.append(i);
+}
+
+ChannelKeyCache::~ChannelKeyCache()
+{
+    clear();
+    if (keyBuffer == NULL)
+        return;
+    wipe(keyBuffer, keyBufferSize);
+#ifdef Q_OS_UNIX
+    if (locked)
+        munlock(keyBuffer, keyBufferSize);
+    munmap(keyBuffer, keyBufferSize);
+#else
+    delete[] keyBuffer;
+#endif
+}
+
+char *ChannelKeyCache::slotData(int slot) const
+{
+    return keyBuffer + slot * kSlotSize;
+}
+
+bool ChannelKeyCache::find(const QString &channelUid, const QString &keyId,
+                           const QByteArray &encryptedKey, QByteArray &symmetricKey)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, Entry>::const_iterator it = entries.find(channelUid + ":" + keyId);
+    if (it == entries.end())
+        return false;
+    const Entry &entry = it.value();
+    if (entry.encryptedKey != encryptedKey)
+        return false;
+    symmetricKey = QByteArray(slotData(entry.slot), entry.keySize);
+    return true;
+}
+
+void ChannelKeyCache::insert(const QString &channelUid, const QString &keyId,
+                             const QByteArray &encryptedKey, const QByteArray &symmetricKey)
+{
+    if (symmetricKey.size() > kSlotSize)
+        return;
+    QMutexLocker locker(&mutex);
+    QString id = channelUid + ":" + keyId;
+    removeEntry(id);
+    if (freeSlots.isEmpty()) {
+        if (entries.isEmpty())
+            return;
+        // full, drop an arbitrary entry
+        QString evicted = entries.begin().key();
+        removeEntry(evicted);
+    }
+
+    Entry entry;
+    entry.encryptedKey = encryptedKey;
+    entry.slot = freeSlots.takeLast();
+    entry.keySize = symmetricKey.size();
+    memcpy(slotData(entry.slot), symmetricKey.constData(), entry.keySize);
+    entries.insert(id, entry);
+}
+
+void ChannelKeyCache::removeEntry(const QString &id)
+{
+    QHash<QString, Entry>::iterator it = entries.find(id);
+    if (it == entries.end())
+        return;
+    wipe(slotData(it.value().slot), kSlotSize);
+    freeSlots.append(it.value().slot);
+    entries.erase(it);
+}
+
+void ChannelKeyCache::clear()
+{
+    QMutexLocker locker(&mutex);
+    while (!entries.isEmpty()) {
+        QString id = entries.begin().key();
+        removeEntry(id);
+    }
+}
+
+
 SecureChannel::SecureChannel(SecureChannelRef channel, Contact *_receiver, const QString &asymKeyId) :
     AbstractSecureDataParcel(channel->getType()),
     receiver(_receiver),
@@ -244,9 +453,9 @@ WP::err SecureChannel::writeDataSecure(QDataStream &stream, const QByteArray &da
 
 WP::err SecureChannel::readDataSecure(QDataStream &stream, QByteArray &data)
 {
-    int length;
-    stream >> length;
-    QByteArray encryptedData = stream.device()->read(length);
+    QByteArray encryptedData;
+    if (!readData(stream, encryptedData))
+        return WP::kBadValue;
 
     return parcelCrypto.uncloakData(encryptedData, data);
 }
@@ -271,34 +480,31 @@ WP::err SecureChannel::readMainData(QBuffer &mainData)
 {
     QDataStream inStream(&mainData);
 
-    char *buffer;
-
     asymmetricKeyId = readString(mainData);
 
-    int length;
-    inStream >> length;
-    buffer = new char[length];
-    inStream.device()->read(buffer, length);
     QByteArray encryptedSymmetricKey;
-    encryptedSymmetricKey.append(buffer, length);
-    delete[] buffer;
-
-    inStream >> length;
-    buffer = new char[length];
-    inStream.device()->read(buffer, length);
+    if (!readData(inStream, encryptedSymmetricKey))
+        return WP::kBadValue;
     QByteArray iv;
-    iv.append(buffer, length);
-    delete[] buffer;
+    if (!readData(inStream, iv))
+        return WP::kBadValue;
 
+    channelUid.clear();
     return parcelCrypto.initFromPublic(receiver, asymmetricKeyId, iv, encryptedSymmetricKey);
 }
 
 QString SecureChannel::getUid() const
 {
+    if (!channelUid.isEmpty())
+        return channelUid;
     QByteArray data;
     data += parcelCrypto.getIV();
     CryptoInterface *crypto = CryptoInterfaceSingleton::getCryptoInterface();
-    return crypto->toHex(crypto->sha1Hash(data));
+    QString uid = crypto->toHex(crypto->sha1Hash(data));
+    // the iv is not known before the channel has been read
+    if (!data.isEmpty())
+        channelUid = uid;
+    return uid;
 }
 
 
@@ -312,6 +518,7 @@ SecureChannelParcel::SecureChannelParcel(qint8 type, SecureChannelRef _channel)
 void SecureChannelParcel::setChannel(SecureChannelRef channel)
 {
     this->channel = channel;
+    invalidateRawData();
 }
 
 SecureChannelRef SecureChannelParcel::getChannel() const
@@ -386,17 +593,23 @@ WP::err XMLSecureParcel::write(ProtocolOutStream *outStream, Contact *sender,
     if (error != WP::kOk)
         return error;
 
+    write(outStream, parcel, data.buffer(), stanzaName);
+    return WP::kOk;
+}
+
+void XMLSecureParcel::write(ProtocolOutStream *outStream, const DataParcel *parcel,
+                            const QByteArray &rawData, const QString &stanzaName)
+{
     OutStanza *parcelStanza = new OutStanza(stanzaName);
     parcelStanza->addAttribute("uid", parcel->getUid());
     parcelStanza->addAttribute("sender", parcel->getSender()->getUid());
     parcelStanza->addAttribute("signatureKey", parcel->getSignatureKey());
     parcelStanza->addAttribute("signature", parcel->getSignature().toBase64());
 
-    parcelStanza->setText(data.buffer().toBase64());
+    parcelStanza->setText(rawData.toBase64());
 
     outStream->pushChildStanza(parcelStanza);
     outStream->cdDotDot();
-    return WP::kOk;
 }
 
 
@@ -507,6 +720,7 @@ MessageChannelInfo::MessageChannelInfo(MessageChannelRef channel) :
 void MessageChannelInfo::setSubject(const QString &subject)
 {
     this->subject = subject;
+    invalidateRawData();
 }
 
 const QString &MessageChannelInfo::getSubject() const
@@ -520,6 +734,7 @@ void MessageChannelInfo::addParticipant(const QString &address, const QString &u
     participant.address = address;
     participant.uid = uid;
     participants.append(participant);
+    invalidateRawData();
 }
 
 bool MessageChannelInfo::setParticipantUid(const QString &address, const QString &uid)
@@ -528,6 +743,7 @@ bool MessageChannelInfo::setParticipantUid(const QString &address, const QString
         Participant &participant = participants[i];
         if (participant.address == address) {
             participant.uid = uid;
+            invalidateRawData();
             return true;
         }
     }
@@ -539,7 +755,7 @@ bool MessageChannelInfo::isNewLocale() const
     return newLocaleInfo;
 }
 
-QVector<MessageChannelInfo::Participant> &MessageChannelInfo::getParticipants()
+const QVector<MessageChannelInfo::Participant> &MessageChannelInfo::getParticipants() const
 {
     return participants;
 }
@@ -648,6 +864,7 @@ const QByteArray &Message::getBody() const
 void Message::setBody(const QByteArray &_body)
 {
     body = _body;
+    invalidateRawData();
 }
 
 WP::err Message::writeConfidentData(QDataStream &stream)
@@ -2,6 +2,9 @@
 #define MAIL_H
 
 #include <QBuffer>
+#include <QHash>
+#include <QList>
+#include <QMutex>
 #include <QSharedPointer>
 
 #include "contact.h"
@@ -11,6 +14,8 @@
 
 class ParcelCrypto {
 public:
+    ~ParcelCrypto();
+
     void initNew();
     WP::err initFromPublic(Contact *receiver, const QString &keyId, const QByteArray &iv, const QByteArray &encryptedSymmetricKey);
     void initFromPrivate(const QByteArray &iv, const QByteArray &symmetricKey);
@@ -30,8 +35,57 @@ protected:
 };
 
 
+/*! Process wide cache of unwrapped channel keys. Unwrapping a channel key is an expensive
+asymmetric decryption; with the cache it is only done once per channel and key id. The cached keys
+are held in one block of locked memory (where supported) that is only unlocked on destroy(); a slot
+is zeroed when its entry is removed. The keys handed out by find() are ordinary copies. */
+class ChannelKeyCache {
+public:
+    static ChannelKeyCache *get();
+    static void destroy();
+
+    //! encryptedKey must match the key the entry has been inserted with
+    bool find(const QString &channelUid, const QString &keyId, const QByteArray &encryptedKey,
+              QByteArray &symmetricKey);
+    //! keys larger than kSlotSize are not cached
+    void insert(const QString &channelUid, const QString &keyId, const QByteArray &encryptedKey,
+                const QByteArray &symmetricKey);
+    void clear();
+
+    //! zeroes data in a way the compiler doesn't optimize away
+    static void wipe(void *data, int size);
+
+    const static int kSlotSize = 256;
+    const static int kSlotCount = 128;
+
+private:
+    class Entry {
+    public:
+        QByteArray encryptedKey;
+        int slot;
+        int keySize;
+    };
+
+    ChannelKeyCache();
+    ~ChannelKeyCache();
+
+    void removeEntry(const QString &id);
+    char *slotData(int slot) const;
+
+    static ChannelKeyCache *sCache;
+
+    QMutex mutex;
+    QHash<QString, Entry> entries;
+    QList<int> freeSlots;
+    char *keyBuffer;
+    int keyBufferSize;
+    bool locked;
+};
+
+
 class DataParcel {
 public:
+    DataParcel();
     virtual ~DataParcel() {}
 
     const QByteArray getSignature() const;
@@ -48,6 +102,10 @@ protected:
     virtual WP::err readMainData(QBuffer &mainData) = 0;
 
     QString readString(QIODevice &data) const;
+    //! reads a length prefixed byte array, fails if the length exceeds the available data
+    bool readData(QDataStream &stream, QByteArray &data) const;
+    //! has to be called when the parcel content changes
+    void invalidateRawData();
 
 protected:
     QByteArray signature;
@@ -55,6 +113,10 @@ protected:
     Contact *sender;
 
     QString uid;
+
+private:
+    //! signed raw data, toRawData reuses it as long as the parcel and the signer are unchanged
+    QByteArray cachedRawData;
 };
 
 
@@ -131,6 +193,8 @@ private:
 
     QString asymmetricKeyId;
     ParcelCrypto parcelCrypto;
+    //! derived from the iv; the uid is used for every channel lookup so only hash once
+    mutable QString channelUid;
 };
 
 
@@ -179,7 +243,7 @@ public:
         QString uid;
     };
 
-    QVector<Participant> &getParticipants();
+    const QVector<Participant> &getParticipants() const;
 
 protected:
     virtual WP::err writeConfidentData(QDataStream &stream);
@@ -259,6 +323,9 @@ public:
     static WP::err write(ProtocolOutStream *outStream, Contact *sender,
                          const QString &signatureKeyId, DataParcel *parcel,
                          const QString &stanzaName);
+    //! writes a parcel that has already been signed, rawData is the output of toRawData
+    static void write(ProtocolOutStream *outStream, const DataParcel *parcel,
+                      const QByteArray &rawData, const QString &stanzaName);
 };
 
 
@@ -20,8 +20,10 @@ class GitIOException : public std::exception
 } git_io_exception;
 
 
-MessageListModel::MessageListModel(QObject *parent) :
-    QAbstractListModel(parent)
+MessageListModel::MessageListModel(MessageLoader *loader, QObject *parent) :
+    QAbstractListModel(parent),
+    loader(loader),
+    decodedMessages(kDefaultCacheSize)
 {
 }
 
@@ -31,7 +33,9 @@ MessageListModel::data(const QModelIndex &index, int role) const
     if (role != Qt::DisplayRole)
         return QVariant();
 
-    MessageRef message = messages.at(index.row());
+    MessageRef message = messageAt(index.row());
+    if (message == NULL)
+        return QVariant();
     QDateTime time;
     time.setTime_t(message->getTimestamp());
 
@@ -55,53 +59,141 @@ int MessageListModel::getMessageCount() const
     return messages.count();
 }
 
-void MessageListModel::addMessage(MessageRef messageRef)
+void MessageListModel::addMessage(const QString &path, MessageRef messageRef)
 {
-    int index = 0;
-    for (; index < messages.count(); index++) {
-        MessageRef current = messages.at(index);
-        if (current->getTimestamp() > messageRef->getTimestamp())
-            break;
-    }
+    MessageEntry entry;
+    entry.path = path;
+    entry.timestamp = messageRef->getTimestamp();
+
+    // insert after messages with the same timestamp
+    int index = qUpperBound(messages.begin(), messages.end(), entry, timestampLessThan)
+        - messages.begin();
 
     beginInsertRows(QModelIndex(), index, index);
-    messages.insert(index, messageRef);
+    messages.insert(index, entry);
     endInsertRows();
+
+    decodedMessages.insert(path, new MessageRef(messageRef));
 }
 
-bool MessageListModel::removeMessage(MessageRef message)
+void MessageListModel::addMessages(const QStringList &paths, const QList<MessageRef> &messageList)
 {
-    int index = messages.indexOf(message);
-    if (index < 0)
-        return false;
-    removeMessageAt(index);
-    return true;
+    if (!messages.isEmpty()) {
+        for (int i = 0; i < paths.count(); i++)
+            addMessage(paths.at(i), messageList.at(i));
+        return;
+    }
+    if (paths.isEmpty())
+        return;
+
+    QVector<MessageEntry> entries;
+    entries.reserve(paths.count());
+    for (int i = 0; i < paths.count(); i++) {
+        MessageEntry entry;
+        entry.path = paths.at(i);
+        entry.timestamp = messageList.at(i)->getTimestamp();
+        entries.append(entry);
+        decodedMessages.insert(entry.path, new MessageRef(messageList.at(i)));
+    }
+    qStableSort(entries.begin(), entries.end(), timestampLessThan);
+
+    beginInsertRows(QModelIndex(), 0, entries.count() - 1);
+    messages = entries;
+    endInsertRows();
 }
 
-MessageRef MessageListModel::removeMessageAt(int index)
+void MessageListModel::addMessageStubs(const QStringList &paths, const QList<time_t> &timestamps)
 {
-    MessageRef entry = messages.at(index);
+    if (paths.isEmpty())
+        return;
+
+    QVector<MessageEntry> entries;
+    entries.reserve(paths.count());
+    for (int i = 0; i < paths.count(); i++) {
+        MessageEntry entry;
+        entry.path = paths.at(i);
+        entry.timestamp = timestamps.at(i);
+        entries.append(entry);
+    }
+    if (!messages.isEmpty()) {
+        beginResetModel();
+        messages += entries;
+        qStableSort(messages.begin(), messages.end(), timestampLessThan);
+        endResetModel();
+        return;
+    }
+    qStableSort(entries.begin(), entries.end(), timestampLessThan);
+
+    beginInsertRows(QModelIndex(), 0, entries.count() - 1);
+    messages = entries;
+    endInsertRows();
+}
+
+bool MessageListModel::removeMessage(const QString &path)
+{
+    for (int i = 0; i < messages.count(); i++) {
+        if (messages.at(i).path != path)
+            continue;
+        removeMessageAt(i);
+        return true;
+    }
+    return false;
+}
+
+void MessageListModel::removeMessageAt(int index)
+{
+    decodedMessages.remove(messages.at(index).path);
     beginRemoveRows(QModelIndex(), index, index);
     messages.remove(index);
     endRemoveRows();
-    return entry;
 }
 
-MessageRef MessageListModel::messageAt(int index)
+MessageRef MessageListModel::messageAt(int index) const
+{
+    const QString &path = messages.at(index).path;
+    MessageRef *cached = decodedMessages.object(path);
+    if (cached != NULL)
+        return *cached;
+
+    MessageRef message;
+    if (loader == NULL || loader->loadMessage(path, message) != WP::kOk)
+        return MessageRef();
+    decodedMessages.insert(path, new MessageRef(message));
+    return message;
+}
+
+time_t MessageListModel::getTimestampAt(int index) const
+{
+    return messages.at(index).timestamp;
+}
+
+const QString &MessageListModel::getPathAt(int index) const
+{
+    return messages.at(index).path;
+}
+
+bool MessageListModel::timestampLessThan(const MessageEntry &entry1, const MessageEntry &entry2)
 {
-    return messages[index];
+    return entry1.timestamp < entry2.timestamp;
+}
+
+void MessageListModel::setCacheSize(int maxMessages)
+{
+    decodedMessages.setMaxCost(maxMessages);
 }
 
 void MessageListModel::clear()
 {
     beginRemoveRows(QModelIndex(), 0, messages.count() - 1);
     messages.clear();
+    decodedMessages.clear();
     endRemoveRows();
 }
 
 
 Mailbox::Mailbox(DatabaseBranch *branch, const QString &baseDir) :
     owner(NULL),
+    readingDatabase(false),
     channelFinder(&threadList)
 {
     setToDatabase(branch, baseDir);
@@ -201,21 +293,6 @@ WP::err Mailbox::storeMessage(MessageRef message, MessageChannelRef channel)
 }
 
 
-QStringList Mailbox::getChannelInfoPaths(const QString &channelPath)
-{
-    return getUidFilePaths(channelPath + "/i");
-}
-
-QStringList Mailbox::getMessageBodyPaths(const QString &channelPath)
-{
-    QStringList paths = getUidDirPaths(channelPath);
-    for (int i = 0; i < paths.count(); i++) {
-        QString &path = paths[i];
-        path += "/m";
-    }
-    return paths;
-}
-
 QString Mailbox::getChannelInfoPath(MessageChannelRef &channel, MessageChannelInfoRef &info)
 {
     return getChannelPath(channel) + "/i/" + makeUidPath(info->getUid());
@@ -329,12 +406,12 @@ QStringList Mailbox::getChannelUids()
 
 MessageThread *Mailbox::findMessageThread(const QString &channelId)
 {
-    for (int i = 0; i < threadList.getChannelCount(); i++) {
-        MessageThread *thread = threadList.channelAt(i);
-        if (thread->getMessageChannel()->getUid() == channelId)
-            return thread;
-    }
-    return NULL;
+    return threadList.findChannel(channelId);
+}
+
+QStringList Mailbox::search(const QString &query, int maxResults) const
+{
+    return searchIndex.search(query, maxResults);
 }
 
 QStringList listMessagePaths(const DatabaseDir *dir) {
@@ -381,7 +458,8 @@ void Mailbox::onNewDiffs(const DatabaseDiff &diff)
 
                 MessageThread *thread = findMessageThread(threadId);
                 if (thread == NULL) {
-                    readThread(threadPath);
+                    if (readThread(threadPath) == WP::kOk)
+                        updateIndex(findMessageThread(threadId));
                 } else {
                     // new infos
                     const DatabaseDir *infoDir = threadDir->getChildDirectory("i");
@@ -398,6 +476,7 @@ void Mailbox::onNewDiffs(const DatabaseDiff &diff)
                         if (message != NULL)
                             onNewMessageArrived(thread, message);
                     }
+                    updateIndex(thread);
                 }
             }
         }
@@ -408,31 +487,151 @@ void Mailbox::onNewDiffs(const DatabaseDiff &diff)
 
     // removed or modified entries
     // TODO: handle cases individually
-    if (!diff.removed.isEmpty() || !diff.modified.isEmpty())
-        readMailDatabase();
+    if (touchesMailbox(diff.removed) || touchesMailbox(diff.modified)) {
+        rebuildMailDatabase();
+        return;
+    }
 
-    threadList.sort();
+    if (index.isDirty() || searchIndex.isDirty())
+        saveIndex();
+}
+
+bool Mailbox::touchesMailbox(const DatabaseDir &dir)
+{
+    return dir.findDirectory(getUid()) != NULL;
 }
 
 WP::err Mailbox::readMailDatabase()
+{
+    // with usable indices no parcel has to be decoded
+    if (index.load(getIndexFileName(), this) == WP::kOk
+        && searchIndex.load(getSearchIndexFileName(), this) == WP::kOk
+        && searchIndex.getCommit() == index.getCommit() && readFromIndex() == WP::kOk)
+        return WP::kOk;
+    return rebuildMailDatabase();
+}
+
+WP::err Mailbox::rebuildMailDatabase()
 {
     threadList.clear();
+    index.clear();
+    searchIndex.clear();
 
+    readingDatabase = true;
     QStringList messageChannels = getChannelUids();
     foreach (const QString & channelPath, messageChannels)
         readThread(channelPath);
+    readingDatabase = false;
+
+    threadList.sort();
+
+    for (int i = 0; i < threadList.getChannelCount(); i++)
+        updateIndex(threadList.channelAt(i));
+    return saveIndex();
+}
+
+WP::err Mailbox::readFromIndex()
+{
+    QString tip = database->getTip();
+    DatabaseDiff diff;
+    if (index.getCommit() != tip) {
+        if (database->getDiff(index.getCommit(), tip, diff) != WP::kOk)
+            return WP::kError;
+        if (touchesMailbox(diff.removed) || touchesMailbox(diff.modified))
+            return WP::kError;
+    }
 
+    threadList.clear();
+    readingDatabase = true;
+    foreach (const MailboxIndex::ThreadEntry &entry, index.getThreads()) {
+        MessageThread *thread = new MessageThread(entry.channelUid, this);
+        thread->setSummary(entry.subject, entry.participants);
+        thread->setLastMessageTimestamp(entry.lastMessageTimestamp);
+        QStringList paths;
+        QList<time_t> timestamps;
+        foreach (const MailboxIndex::MessageEntry &message, entry.messages) {
+            paths.append(message.path);
+            timestamps.append(message.timestamp);
+        }
+        thread->getMessages().addMessageStubs(paths, timestamps);
+        threadList.addChannel(thread);
+    }
+    readingDatabase = false;
     threadList.sort();
+
+    // catch up with the commits that are not in the index yet
+    if (index.getCommit() != tip) {
+        onNewDiffs(diff);
+        saveIndex();
+    }
+    emit databaseRead();
     return WP::kOk;
 }
 
+QString Mailbox::getIndexFileName()
+{
+    return database->path() + "/fejoa_mailbox_index_" + getUid();
+}
+
+QString Mailbox::getSearchIndexFileName()
+{
+    return database->path() + "/fejoa_search_index_" + getUid();
+}
+
+void Mailbox::updateIndex(MessageThread *thread)
+{
+    MailboxIndex::ThreadEntry entry;
+    entry.channelUid = thread->getChannelUid();
+    entry.subject = thread->getSubject();
+    entry.participants = thread->getParticipants();
+    entry.lastMessageTimestamp = thread->getLastMessageTimestamp();
+    const MessageListModel &messages = thread->getMessages();
+    entry.messages.reserve(messages.getMessageCount());
+    for (int i = 0; i < messages.getMessageCount(); i++) {
+        MailboxIndex::MessageEntry message;
+        message.path = messages.getPathAt(i);
+        message.timestamp = messages.getTimestampAt(i);
+        entry.messages.append(message);
+    }
+    index.setThread(entry);
+}
+
+void Mailbox::indexMessage(MessageThread *thread, const QString &messagePath, MessageRef &message)
+{
+    QString text = thread->getSubject();
+    text += " ";
+    text += thread->getParticipants().join(" ");
+    text += " ";
+    text += message->getSender()->getAddress();
+    text += " ";
+    text += QString::fromUtf8(message->getBody());
+    searchIndex.addDocument(messagePath, message->getTimestamp(), text);
+}
+
+WP::err Mailbox::saveIndex()
+{
+    QString tip = database->getTip();
+    index.setCommit(tip);
+    searchIndex.setCommit(tip);
+    // the search index goes first; on a crash in between the commits don't match and the next
+    // start rebuilds both
+    if (searchIndex.isDirty()) {
+        WP::err error = searchIndex.save(getSearchIndexFileName(), this);
+        if (error != WP::kOk)
+            return error;
+    }
+    if (!index.isDirty())
+        return WP::kOk;
+    return index.save(getIndexFileName(), this);
+}
+
 WP::err Mailbox::readThread(const QString &channelPath) {
     MessageChannel* channel = readChannel(channelPath);
     if (channel == NULL) {
         delete channel;
         return WP::kEntryNotFound;
     }
-    MessageThread *thread = new MessageThread(channel);
+    MessageThread *thread = new MessageThread(channel, this);
     threadList.addChannel(thread);
     WP::err error = readThreadContent(channelPath, thread);
     if (error != WP::kOk) {
@@ -444,20 +643,41 @@ WP::err Mailbox::readThread(const QString &channelPath) {
 
 WP::err Mailbox::readThreadContent(const QString &channelPath, MessageThread *thread)
 {
-    QStringList infoUidPaths = getChannelInfoPaths(channelPath);
-    for (int i = 0; i < infoUidPaths.count(); i++) {
-        QString path = infoUidPaths.at(i);
-        readThreadInfo(path, thread);
-    }
+    // read the whole channel in one pass; infos are at i/xx/rest and messages at xx/rest/m
+    QMap<QString, QByteArray> channelData;
+    WP::err error = readTree(channelPath, channelData);
+    if (error != WP::kOk)
+        return error;
 
-    QStringList messageBodyPaths = getMessageBodyPaths(channelPath);
-    for (int i = 0; i < messageBodyPaths.count(); i++) {
-        QString path = messageBodyPaths.at(i);
+    QStringList messagePaths;
+    QMap<QString, QByteArray>::const_iterator it;
+    for (it = channelData.begin(); it != channelData.end(); it++) {
+        QStringList parts = it.key().split("/");
+        if (parts.count() != 3)
+            continue;
+        if (parts.at(0) == "i")
+            addThreadInfo(it.value(), thread);
+        else if (parts.at(2) == "m")
+            messagePaths.append(it.key());
+    }
 
+    // infos have to be known before the messages are parsed
+    QStringList fullPaths;
+    QList<MessageRef> messageList;
+    MessageRef newestMessage;
+    foreach (const QString &path, messagePaths) {
         MessageRef message;
-        if (readThreadMessage(path, thread, message) == WP::kOk)
-            onNewMessageArrived(thread, message);
+        if (parseMessage(channelData[path], message) != WP::kOk)
+            continue;
+        fullPaths.append(channelPath + "/" + path);
+        messageList.append(message);
+        indexMessage(thread, fullPaths.last(), message);
+        if (newestMessage == NULL || newestMessage->getTimestamp() < message->getTimestamp())
+            newestMessage = message;
     }
+    thread->getMessages().addMessages(fullPaths, messageList);
+    if (newestMessage != NULL)
+        onNewMessageArrived(thread, newestMessage);
 
     emit databaseRead();
     return WP::kOk;
@@ -465,50 +685,91 @@ WP::err Mailbox::readThreadContent(const QString &channelPath, MessageThread *th
 
 WP::err Mailbox::readThreadInfo(const QString &infoPath, MessageThread *thread)
 {
-    QVector<MessageChannelInfoRef> &infos = thread->getChannelInfos();
-
     QByteArray data;
     WP::err error = read(infoPath, data);
     if (error != WP::kOk)
         return error;
+    return addThreadInfo(data, thread);
+}
+
+WP::err Mailbox::readThreadMessage(const QString &messagePath, MessageThread *thread, MessageRef &message)
+{
+    QByteArray data;
+    WP::err error = read(messagePath, data);
+    if (error != WP::kOk)
+        return error;
+    return addThreadMessage(messagePath, data, thread, message);
+}
 
+WP::err Mailbox::addThreadInfo(const QByteArray &data, MessageThread *thread)
+{
     // read channel info
     MessageChannelInfoRef info(new MessageChannelInfo(&channelFinder));
-    error = info->fromRawData(owner->getContactFinder(), data);
+    QByteArray rawData = data;
+    WP::err error = info->fromRawData(owner->getContactFinder(), rawData);
     if (error != WP::kOk)
         return error;
 
-    infos.append(info);
+    thread->addChannelInfo(info);
 
     return WP::kOk;
 }
 
-WP::err Mailbox::readThreadMessage(const QString &messagePath, MessageThread *thread, MessageRef &message)
+WP::err Mailbox::addThreadMessage(const QString &messagePath, const QByteArray &data,
+                                  MessageThread *thread, MessageRef &message)
 {
-    MessageListModel &messages = thread->getMessages();
-
-    QByteArray data;
-    WP::err error = read(messagePath, data);
+    WP::err error = parseMessage(data, message);
     if (error != WP::kOk)
         return error;
 
-    // read message
+    thread->getMessages().addMessage(messagePath, message);
+    indexMessage(thread, messagePath, message);
+    return WP::kOk;
+}
+
+WP::err Mailbox::parseMessage(const QByteArray &data, MessageRef &message)
+{
     message = MessageRef(new Message(&channelFinder));
-    error = message->fromRawData(owner->getContactFinder(), data);
-    if (error != WP::kOk) {
+    QByteArray rawData = data;
+    WP::err error = message->fromRawData(owner->getContactFinder(), rawData);
+    if (error != WP::kOk)
         message.clear();
+    return error;
+}
+
+WP::err Mailbox::loadMessage(const QString &path, MessageRef &message)
+{
+    QByteArray data;
+    WP::err error = read(path, data);
+    if (error != WP::kOk)
         return error;
-    }
+    return parseMessage(data, message);
+}
 
-    messages.addMessage(message);
+WP::err Mailbox::loadThread(MessageThread *thread)
+{
+    QString channelPath = makeUidPath(thread->getChannelUid());
+    MessageChannel *channel = readChannel(channelPath);
+    if (channel == NULL)
+        return WP::kEntryNotFound;
+    thread->setMessageChannel(channel);
+
+    // a channel without infos has no i directory
+    QMap<QString, QByteArray> infos;
+    if (readTree(channelPath + "/i", infos) != WP::kOk)
+        return WP::kOk;
+    foreach (const QByteArray &data, infos)
+        addThreadInfo(data, thread);
     return WP::kOk;
 }
 
 void Mailbox::onNewMessageArrived(MessageThread *thread, MessageRef &message)
 {
-    MessageRef lastMessage = thread->getLastMessage();
-    if (lastMessage == NULL || lastMessage->getTimestamp() < message->getTimestamp())
-        thread->setLastMessage(message);
+    if (thread->getLastMessageTimestamp() >= message->getTimestamp())
+        return;
+    thread->setLastMessageTimestamp(message->getTimestamp());
+    if (!readingDatabase)
+        threadList.updateChannelPosition(thread);
 }
 
 MessageChannel* Mailbox::readChannel(const QString &channelPath) {
@@ -547,21 +808,8 @@ MessageChannelRef Mailbox::MailboxMessageChannelFinder::findChannel(const QStrin
 MessageChannelInfoRef Mailbox::MailboxMessageChannelFinder::findChannelInfo(const QString &channelUid,
                                                                           const QString &channelInfoUid)
 {
-    MessageThread *messageThread = NULL;
-    for (int i = 0; i < threads->getChannelCount(); i++) {
-        MessageThread *thread = threads->channelAt(i);
-        if (thread->getMessageChannel()->getUid() == channelUid) {
-            messageThread = thread;
-            break;
-        }
-    }
+    MessageThread *messageThread = threads->findChannel(channelUid);
     if (messageThread == NULL)
         return MessageChannelInfoRef();
-
-    QVector<MessageChannelInfoRef> &channelInfos = messageThread->getChannelInfos();
-    foreach (MessageChannelInfoRef channelInfo, channelInfos) {
-        if (channelInfo->getUid() == channelInfoUid)
-            return channelInfo;
-    }
-    return MessageChannelInfoRef();
+    return messageThread->findChannelInfo(channelInfoUid);
 }
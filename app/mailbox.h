@@ -2,33 +2,71 @@
 #define MAILBOX_H
 
 #include <QAbstractListModel>
+#include <QCache>
 
 #include "databaseutil.h"
 #include "mail.h"
+#include "mailboxindex.h"
 #include "messagethreaddatamodel.h"
+#include "searchindex.h"
 
 
 class UserIdentity;
 
+//! decodes stored messages and threads on demand
+class MessageLoader {
+public:
+    virtual ~MessageLoader() {}
+    virtual WP::err loadMessage(const QString &path, MessageRef &message) = 0;
+    //! reads the channel and the channel infos of a thread that has been created from the index
+    virtual WP::err loadThread(MessageThread *thread) = 0;
+};
+
+/*! Only keeps the path and the timestamp of each message resident. Messages are decoded through
+the loader when a view asks for them; the most recently used decoded messages are cached.
+*/
 class MessageListModel : public QAbstractListModel {
 public:
-    MessageListModel(QObject * parent = 0);
+    MessageListModel(MessageLoader *loader = NULL, QObject * parent = 0);
 
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
     int rowCount(const QModelIndex & parent = QModelIndex()) const;
 
     int getMessageCount() const;
-    void addMessage(MessageRef message);
-    bool removeMessage(MessageRef message);
-    MessageRef removeMessageAt(int index);
-    MessageRef messageAt(int index);
+    //! path is the location of the message in the database
+    void addMessage(const QString &path, MessageRef message);
+    //! adds many messages at once, sorts them only once
+    void addMessages(const QStringList &paths, const QList<MessageRef> &messageList);
+    //! adds messages that are decoded on first use, e.g., from the mailbox index
+    void addMessageStubs(const QStringList &paths, const QList<time_t> &timestamps);
+    bool removeMessage(const QString &path);
+    void removeMessageAt(int index);
+    //! returns a null ref if the message can't be loaded
+    MessageRef messageAt(int index) const;
+    time_t getTimestampAt(int index) const;
+    const QString &getPathAt(int index) const;
+
+    //! maximal number of decoded messages that are kept in memory
+    void setCacheSize(int maxMessages);
 
     void clear();
 private:
-    QVector<MessageRef> messages;
+    class MessageEntry {
+    public:
+        QString path;
+        time_t timestamp;
+    };
+
+    static bool timestampLessThan(const MessageEntry &entry1, const MessageEntry &entry2);
+
+    static const int kDefaultCacheSize = 100;
+
+    QVector<MessageEntry> messages;
+    MessageLoader *loader;
+    mutable QCache<QString, MessageRef> decodedMessages;
 };
 
-class Mailbox : public EncryptedUserData, public DiffMonitorWatcher
+class Mailbox : public EncryptedUserData, public DiffMonitorWatcher, public MessageLoader
 {
 Q_OBJECT
 public:
@@ -48,8 +86,13 @@ public:
     MessageThreadDataModel &getThreads();
 
     MessageThread *findMessageThread(const QString &channelId);
+    /*! Paths of the messages whose body, subject, participants or sender contain all words of
+    query, newest first. maxResults < 0 returns all matches. */
+    QStringList search(const QString &query, int maxResults = -1) const;
 
     virtual void onNewDiffs(const DatabaseDiff &diff);
+    virtual WP::err loadMessage(const QString &path, MessageRef &message);
+    virtual WP::err loadThread(MessageThread *thread);
 
 signals:
     void databaseReadProgress(float progress);
@@ -73,20 +116,33 @@ private:
     MessageChannel* readChannel(const QString &channelPath);
 
     WP::err readMailDatabase();
+    //! reads all parcels and rebuilds the index
+    WP::err rebuildMailDatabase();
+    //! creates the threads from the index and applies the commits that are not indexed yet
+    WP::err readFromIndex();
+    bool touchesMailbox(const DatabaseDir &dir);
     WP::err readThread(const QString &channelPath);
     WP::err readThreadContent(const QString &channelPath, MessageThread *thread);
     WP::err readThreadInfo(const QString &infoPath, MessageThread *thread);
     WP::err readThreadMessage(const QString &messagePath, MessageThread *thread, MessageRef& message);
+    WP::err addThreadInfo(const QByteArray &data, MessageThread *thread);
+    WP::err addThreadMessage(const QString &messagePath, const QByteArray &data, MessageThread *thread,
+                             MessageRef& message);
+    WP::err parseMessage(const QByteArray &data, MessageRef &message);
     void onNewMessageArrived(MessageThread *thread, MessageRef& message);
 
+    QString getIndexFileName();
+    QString getSearchIndexFileName();
+    void updateIndex(MessageThread *thread);
+    void indexMessage(MessageThread *thread, const QString &messagePath, MessageRef &message);
+    WP::err saveIndex();
+
     WP::err storeMessage(MessageRef message, MessageChannelRef channel);
     WP::err storeChannel(MessageChannelRef channel);
     WP::err storeChannelInfo(MessageChannelRef channel, MessageChannelInfoRef info);
 
     QStringList getUidFilePaths(QString path);
     QStringList getUidDirPaths(QString path);
-    QStringList getChannelInfoPaths(const QString &channelPath);
-    QStringList getMessageBodyPaths(const QString &channelPath);
     QString getChannelInfoPath(MessageChannelRef &channel, MessageChannelInfoRef &info);
     QString getMessageBodyPath(MessageChannelRef &channel, MessageRef &message);
     QString getMessagePath(MessageChannelRef &channel, MessageRef &message);
@@ -98,6 +154,10 @@ private:
     UserIdentity *owner;
 
     MessageThreadDataModel threadList;
+    MailboxIndex index;
+    SearchIndex searchIndex;
+    //! while the whole database is read the thread list is sorted once at the end
+    bool readingDatabase;
     MailboxMessageChannelFinder channelFinder;
 };
 
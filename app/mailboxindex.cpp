@@ -0,0 +1,112 @@
+#include "mailboxindex.h"
+
+#include <QDataStream>
+
+#include "databaseutil.h"
+
+
+const char *kMailboxIndexMagic = "FMI1";
+
+
+MailboxIndex::ThreadEntry::ThreadEntry() :
+    lastMessageTimestamp(0)
+{
+}
+
+MailboxIndex::MailboxIndex() :
+    dirty(false)
+{
+}
+
+void MailboxIndex::clear()
+{
+    commit = "";
+    threads.clear();
+    dirty = false;
+}
+
+const QString &MailboxIndex::getCommit() const
+{
+    return commit;
+}
+
+void MailboxIndex::setCommit(const QString &_commit)
+{
+    if (commit == _commit)
+        return;
+    commit = _commit;
+    dirty = true;
+}
+
+const QMap<QString, MailboxIndex::ThreadEntry> &MailboxIndex::getThreads() const
+{
+    return threads;
+}
+
+void MailboxIndex::setThread(const ThreadEntry &thread)
+{
+    threads.insert(thread.channelUid, thread);
+    dirty = true;
+}
+
+/* File format (encrypted): magic, commit, number of threads and the threads, each as channel uid,
+ * subject, participants, last message timestamp, number of messages and the messages as path and
+ * timestamp.
+ */
+WP::err MailboxIndex::load(const QString &fileName, const EncryptedUserData *cipher)
+{
+    clear();
+    QByteArray data;
+    WP::err error = cipher->readSafeFile(fileName, data);
+    if (error != WP::kOk)
+        return error;
+
+    QDataStream stream(data);
+    QByteArray magic;
+    quint32 count = 0;
+    stream >> magic >> commit >> count;
+    if (magic != kMailboxIndexMagic) {
+        commit = "";
+        return WP::kBadValue;
+    }
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        ThreadEntry thread;
+        quint32 messageCount = 0;
+        stream >> thread.channelUid >> thread.subject >> thread.participants
+            >> thread.lastMessageTimestamp >> messageCount;
+        for (quint32 a = 0; a < messageCount && stream.status() == QDataStream::Ok; a++) {
+            MessageEntry message;
+            stream >> message.path >> message.timestamp;
+            thread.messages.append(message);
+        }
+        threads.insert(thread.channelUid, thread);
+    }
+    if (stream.status() != QDataStream::Ok || (quint32)threads.count() != count) {
+        clear();
+        return WP::kBadValue;
+    }
+    return WP::kOk;
+}
+
+WP::err MailboxIndex::save(const QString &fileName, const EncryptedUserData *cipher)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << QByteArray(kMailboxIndexMagic) << commit << (quint32)threads.count();
+    foreach (const ThreadEntry &thread, threads) {
+        stream << thread.channelUid << thread.subject << thread.participants
+            << thread.lastMessageTimestamp << (quint32)thread.messages.count();
+        foreach (const MessageEntry &message, thread.messages)
+            stream << message.path << message.timestamp;
+    }
+    WP::err error = cipher->writeSafeFile(fileName, data);
+    if (error != WP::kOk)
+        return error;
+    dirty = false;
+    return WP::kOk;
+}
+
+bool MailboxIndex::isDirty() const
+{
+    return dirty;
+}
@@ -0,0 +1,63 @@
+#ifndef MAILBOXINDEX_H
+#define MAILBOXINDEX_H
+
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "error_codes.h"
+
+
+class EncryptedUserData;
+
+/*! Metadata of all threads of a mailbox. With the index the thread list can be shown without
+decoding any stored parcel. The index is stored encrypted next to the database and belongs to the
+commit it has been built for; when the branch moved on it is brought up to date from the diff.
+*/
+class MailboxIndex {
+public:
+    class MessageEntry {
+    public:
+        //! location of the message in the database
+        QString path;
+        qint64 timestamp;
+    };
+
+    class ThreadEntry {
+    public:
+        ThreadEntry();
+
+        QString channelUid;
+        QString subject;
+        //! participant addresses
+        QStringList participants;
+        qint64 lastMessageTimestamp;
+        QVector<MessageEntry> messages;
+    };
+
+    MailboxIndex();
+
+    void clear();
+    //! the commit the index is for
+    const QString &getCommit() const;
+    void setCommit(const QString &commit);
+
+    const QMap<QString, ThreadEntry> &getThreads() const;
+    //! adds or replaces the entry with the same channel uid
+    void setThread(const ThreadEntry &thread);
+
+    //! the index is encrypted with the default key of cipher
+    WP::err load(const QString &fileName, const EncryptedUserData *cipher);
+    WP::err save(const QString &fileName, const EncryptedUserData *cipher);
+    //! true if the index changed since it was loaded or saved
+    bool isDirty() const;
+
+private:
+    QString commit;
+    //! channel uid to thread
+    QMap<QString, ThreadEntry> threads;
+    bool dirty;
+};
+
+#endif // MAILBOXINDEX_H
@@ -1,5 +1,7 @@
 #include "mailmessenger.h"
 
+#include <QTimer>
+
 #include "profile.h"
 #include "protocolparser.h"
 #include "remoteauthentication.h"
@@ -7,17 +9,30 @@
 #include "useridentity.h"
 
 
-MailMessenger::MailMessenger(Mailbox *mailbox, const MessageChannelInfo::Participant *receiver, Profile *profile, MessageRef message) :
+MailMessenger::MailMessenger(Mailbox *mailbox,
+                             const QList<const MessageChannelInfo::Participant*> &receivers,
+                             Profile *profile, MessageRef message, const QByteArray &signedMessage,
+                             const QByteArray &signedChannelInfo) :
     mailbox(mailbox),
-    receiver(receiver),
+    receivers(receivers),
     profile(profile),
     message(message),
+    signedMessage(signedMessage),
+    signedChannelInfo(signedChannelInfo),
     userIdentity(mailbox->getOwner()),
-    targetContact(NULL),
+    currentReceiver(-1),
     contactRequest(NULL),
-    remoteConnection(NULL)
+    jobQueue(NULL),
+    remoteConnection(NULL),
+    serverReply(NULL)
 {
-    parseAddress(receiver->address);
+    foreach (const MessageChannelInfo::Participant *receiver, receivers) {
+        QString targetUser;
+        parseAddress(receiver->address, targetUser, targetServer);
+        targetUsers.append(targetUser);
+        targetContacts.append(NULL);
+        receiverStatus.append(WP::kNotInit);
+    }
 }
 
 MailMessenger::~MailMessenger()
@@ -26,22 +41,11 @@ MailMessenger::~MailMessenger()
 
 void MailMessenger::run(RemoteConnectionJobQueue *jobQueue)
 {
+    this->jobQueue = jobQueue;
     remoteConnection = jobQueue->getRemoteConnection();
-    RemoteAuthenticationInfo authenticationInfo(userIdentity->getMyself()->getUid(), targetUser,
-                                  userIdentity->getKeyStore()->getUid(),
-                                  userIdentity->getMyself()->getKeys()->getMainKeyId());
-    authentication = jobQueue->getRemoteAuthentication(authenticationInfo, profile->getKeyStoreFinder());
-
 
-    Contact *contact = userIdentity->findContact(receiver->address);
-    if (contact != NULL)
-        onContactFound(WP::kOk);
-    else if (receiver->uid != "") {
-        contact = userIdentity->findContactByUid(receiver->uid);
-        if (contact != NULL)
-            onContactFound(WP::kOk);
-    } else
-        startContactRequest();
+    currentReceiver = -1;
+    prepareNextReceiver();
 }
 
 void MailMessenger::abort()
@@ -56,23 +60,99 @@ QString MailMessenger::getTargetServer()
     return targetServer;
 }
 
+const QList<WP::err> &MailMessenger::getReceiverStatus() const
+{
+    return receiverStatus;
+}
+
+void MailMessenger::prepareNextReceiver()
+{
+    currentReceiver++;
+    if (currentReceiver == receivers.count()) {
+        sendMessage();
+        return;
+    }
+
+    RemoteAuthenticationInfo authenticationInfo(userIdentity->getMyself()->getUid(),
+                                                targetUsers.at(currentReceiver),
+                                                userIdentity->getKeyStore()->getUid(),
+                                                userIdentity->getMyself()->getKeys()->getMainKeyId());
+    authentication = jobQueue->getRemoteAuthentication(authenticationInfo,
+                                                       profile->getKeyStoreFinder());
+
+    const MessageChannelInfo::Participant *receiver = receivers.at(currentReceiver);
+    Contact *contact = userIdentity->findContact(receiver->address);
+    if (contact == NULL && receiver->uid != "")
+        contact = userIdentity->findContactByUid(receiver->uid);
+    if (contact != NULL)
+        onContactFound(WP::kOk);
+    else
+        startContactRequest();
+}
+
+void MailMessenger::receiverFailed(WP::err error)
+{
+    receiverStatus[currentReceiver] = error;
+    prepareNextReceiver();
+}
+
 void MailMessenger::authConnected(WP::err error)
 {
+    authentication->disconnect(this);
     if (error == WP::kContactNeeded) {
         startContactRequest();
         return;
     } else if (error != WP::kOk) {
-        emit jobDone(error);
+        receiverFailed(error);
         return;
     }
 
-    MessageChannelRef targetMessageChannel = MessageChannelRef();
-    if (message->getChannel().staticCast<MessageChannel>()->isNewLocale()) {
-        targetMessageChannel = MessageChannelRef(
-            new MessageChannel(message->getChannel().staticCast<MessageChannel>(), targetContact,
-                                              targetContact->getKeys()->getMainKeyId()));
+    // ready to receive the message
+    receiverStatus[currentReceiver] = WP::kOk;
+    prepareNextReceiver();
+}
+
+void MailMessenger::onContactFound(WP::err error)
+{
+    delete contactRequest;
+    contactRequest = NULL;
+
+    if (error != WP::kOk) {
+        receiverFailed(error);
+        return;
     }
 
+    Contact *targetContact = userIdentity->findContact(receivers.at(currentReceiver)->address);
+    if (targetContact == NULL) {
+        receiverFailed(WP::kContactNotFound);
+        return;
+    }
+    targetContacts[currentReceiver] = targetContact;
+
+    if (authentication->isVerified())
+        authConnected(WP::kOk);
+    else {
+        authentication->disconnect(this);
+        connect(authentication.data(), SIGNAL(authenticationAttemptFinished(WP::err)),
+                this, SLOT(authConnected(WP::err)));
+        authentication->login();
+    }
+}
+
+void MailMessenger::sendMessage()
+{
+    QList<int> readyReceivers;
+    for (int i = 0; i < receiverStatus.count(); i++) {
+        if (receiverStatus.at(i) == WP::kOk)
+            readyReceivers.append(i);
+    }
+    if (readyReceivers.isEmpty()) {
+        emit jobDone(WP::kError);
+        return;
+    }
+
+    MessageChannelRef channel = message->getChannel().staticCast<MessageChannel>();
+
     QByteArray data;
     ProtocolOutStream outStream(&data);
     IqOutStanza *iqStanza = new IqOutStanza(kSet);
@@ -80,39 +160,38 @@ void MailMessenger::authConnected(WP::err error)
 
     Contact *myself = userIdentity->getMyself();
     OutStanza *messageStanza =  new OutStanza("put_message");
-    messageStanza->addAttribute("server_user", targetUser);
-    messageStanza->addAttribute("channel", message->getChannel()->getUid());
+    messageStanza->addAttribute("channel", channel->getUid());
     outStream.pushChildStanza(messageStanza);
 
     QString signatureKeyId = myself->getKeys()->getMainKeyId();
 
-    // write new channel
-    if (targetMessageChannel != NULL) {
-        error = XMLSecureParcel::write(&outStream, myself, signatureKeyId,
-                                       targetMessageChannel.data(), "channel");
-        if (error != WP::kOk) {
-            emit jobDone(error);
-            return;
+    // only the channel is different for each receiver
+    foreach (int i, readyReceivers) {
+        OutStanza *recipientStanza = new OutStanza("recipient");
+        recipientStanza->addAttribute("server_user", targetUsers.at(i));
+        outStream.pushChildStanza(recipientStanza);
+
+        if (channel->isNewLocale()) {
+            Contact *targetContact = targetContacts.at(i);
+            MessageChannelRef targetMessageChannel(
+                new MessageChannel(channel, targetContact, targetContact->getKeys()->getMainKeyId()));
+            WP::err error = XMLSecureParcel::write(&outStream, myself, signatureKeyId,
+                                                   targetMessageChannel.data(), "channel");
+            if (error != WP::kOk) {
+                emit jobDone(error);
+                return;
+            }
         }
+        outStream.cdDotDot();
     }
 
     // write new channel info
     MessageChannelInfoRef info = message->getChannelInfo();
-    if (info->isNewLocale()) {
-        error = XMLSecureParcel::write(&outStream, myself, signatureKeyId, info.data(),
-                                       "channel_info");
-        if (error != WP::kOk) {
-            emit jobDone(error);
-            return;
-        }
-    }
+    if (info->isNewLocale())
+        XMLSecureParcel::write(&outStream, info.data(), signedChannelInfo, "channel_info");
 
     // write message
-    error = XMLSecureParcel::write(&outStream, myself, signatureKeyId, message.data(), "message");
-    if (error != WP::kOk) {
-        emit jobDone(error);
-        return;
-    }
+    XMLSecureParcel::write(&outStream, message.data(), signedMessage, "message");
 
     outStream.flush();
 
@@ -122,77 +201,115 @@ void MailMessenger::authConnected(WP::err error)
     connect(serverReply, SIGNAL(finished(WP::err)), this, SLOT(handleReply(WP::err)));
 }
 
-void MailMessenger::onContactFound(WP::err error)
-{
-    delete contactRequest;
-    contactRequest = NULL;
 
-    if (error != WP::kOk) {
-        emit jobDone(error);
-        return;
+class PutMessageStatusHandler : public InStanzaHandler {
+public:
+    PutMessageStatusHandler() :
+        InStanzaHandler("message", true)
+    {
     }
 
-    targetContact = userIdentity->findContact(receiver->address);
-    if (targetContact == NULL)
-        return;
+    bool handleStanza(const QXmlStreamAttributes &attributes)
+    {
+        if (!attributes.hasAttribute("server_user"))
+            return false;
+        if (attributes.value("status").toString() == "message_received")
+            receivedUsers.append(attributes.value("server_user").toString());
+        return true;
+    }
 
-    if (authentication->isVerified())
-        authConnected(WP::kOk);
-    else {
-        authentication->disconnect(this);
-        connect(authentication.data(), SIGNAL(authenticationAttemptFinished(WP::err)),
-                this, SLOT(authConnected(WP::err)));
-        authentication->login();
+public:
+    QStringList receivedUsers;
+};
+
+
+class PutMessageHandler : public InStanzaHandler {
+public:
+    PutMessageHandler() :
+        InStanzaHandler("put_message")
+    {
     }
-}
+
+    bool handleStanza(const QXmlStreamAttributes &attributes)
+    {
+        return true;
+    }
+};
+
 
 void MailMessenger::handleReply(WP::err error)
 {
     QByteArray data = serverReply->readAll();
-    emit jobDone(error);
+    serverReply = NULL;
+
+    QStringList receivedUsers;
+    if (error == WP::kOk) {
+        IqInStanzaHandler iqHandler(kResult);
+        PutMessageHandler *putMessageHandler = new PutMessageHandler();
+        PutMessageStatusHandler *statusHandler = new PutMessageStatusHandler();
+        putMessageHandler->addChildHandler(statusHandler);
+        iqHandler.addChildHandler(putMessageHandler);
+
+        ProtocolInStream inStream(data);
+        inStream.addHandler(&iqHandler);
+        inStream.parse();
+        receivedUsers = statusHandler->receivedUsers;
+    }
+
+    WP::err result = WP::kOk;
+    for (int i = 0; i < receiverStatus.count(); i++) {
+        if (receiverStatus.at(i) != WP::kOk)
+            continue;
+        // the server answered but didn't take the message, e.g. it declined it
+        if (!receivedUsers.contains(targetUsers.at(i)))
+            receiverStatus[i] = (error != WP::kOk) ? error : WP::kContactRefused;
+    }
+    foreach (WP::err status, receiverStatus) {
+        if (status != WP::kOk)
+            result = status;
+    }
+    emit jobDone(result);
 }
 
-void MailMessenger::parseAddress(const QString &targetAddress)
+bool MailMessenger::parseAddress(const QString &targetAddress, QString &targetUser,
+                                 QString &targetServer)
 {
     QString address = targetAddress.trimmed();
     QStringList parts = address.split("@");
     if (parts.count() != 2)
-        return;
+        return false;
     targetUser = parts[0];
     targetServer = "http://";
     targetServer += parts[1];
     targetServer += "/php_server/portal.php";
+    return true;
 }
 
 WP::err MailMessenger::startContactRequest()
 {
-    contactRequest = new ContactRequest(remoteConnection, targetUser, userIdentity, this);
+    contactRequest = new ContactRequest(remoteConnection, targetUsers.at(currentReceiver),
+                                        userIdentity, this);
     connect(contactRequest, SIGNAL(contactRequestFinished(WP::err)), this, SLOT(onContactFound(WP::err)));
     return contactRequest->postRequest();
 }
 
 
 MultiMailMessenger::MultiMailMessenger(Mailbox *_mailbox, Profile *_profile) :
-    mailMessenger(NULL),
     message(NULL),
     mailbox(_mailbox),
     messageChannelInfo(NULL),
     profile(_profile),
-    lastParticipantIndex(-1)
+    pendingRecipients(0)
 {
 
 }
 
 MultiMailMessenger::~MultiMailMessenger()
 {
-    delete mailMessenger;
 }
 
 WP::err MultiMailMessenger::postMessage(MessageRef message)
 {
-    lastParticipantIndex = -1;
-
-
     this->message = message;
 
 //TODO set the uid at some point...
@@ -208,42 +325,151 @@ WP::err MultiMailMessenger::postMessage(MessageRef message)
 
     messageChannelInfo = message->getChannelInfo();
 
+    // sign the message and the channel info once for all recipients
+    Contact *myself = mailbox->getOwner()->getMyself();
+    QString signatureKeyId = myself->getKeys()->getMainKeyId();
+    QBuffer messageBuffer;
+    messageBuffer.open(QBuffer::WriteOnly);
+    error = message->toRawData(myself, signatureKeyId, messageBuffer);
+    if (error != WP::kOk)
+        return error;
+    signedMessage = messageBuffer.buffer();
+    signedChannelInfo.clear();
+    if (messageChannelInfo->isNewLocale()) {
+        QBuffer infoBuffer;
+        infoBuffer.open(QBuffer::WriteOnly);
+        error = messageChannelInfo->toRawData(myself, signatureKeyId, infoBuffer);
+        if (error != WP::kOk)
+            return error;
+        signedChannelInfo = infoBuffer.buffer();
+    }
+
     // TODO: try to get all participant uids first (if missing)
 
-    onSendResult(WP::kOk);
+    recipients.clear();
+    const QVector<MessageChannelInfo::Participant> &participants
+        = messageChannelInfo->getParticipants();
+    for (int i = 0; i < participants.size(); i++) {
+        const MessageChannelInfo::Participant *participant = &participants.at(i);
+        if (participant->uid == myself->getUid())
+            continue;
+        Recipient recipient;
+        recipient.participant = participant;
+        QString targetUser;
+        MailMessenger::parseAddress(participant->address, targetUser, recipient.server);
+        recipient.status = WP::kNotInit;
+        recipient.attempts = 0;
+        recipient.finished = false;
+        recipients.append(recipient);
+    }
+
+    pendingRecipients = recipients.size();
+    if (pendingRecipients == 0) {
+        emit messagesSent();
+        return WP::kOk;
+    }
+
+    // one request per server, the queues of the servers work in parallel
+    QMap<QString, QList<int> > serverGroups;
+    for (int i = 0; i < recipients.size(); i++)
+        serverGroups[recipients.at(i).server].append(i);
+    foreach (const QList<int> &group, serverGroups)
+        sendTo(group);
 
     return WP::kOk;
 }
 
-void MultiMailMessenger::onSendResult(WP::err error)
+const QList<MultiMailMessenger::Recipient> &MultiMailMessenger::getRecipients() const
 {
-    if (error != WP::kOk) {
-        // todo
-    }
+    return recipients;
+}
 
-    lastParticipantIndex++;
-    if (lastParticipantIndex == messageChannelInfo->getParticipants().size()) {
-        emit messagesSent();
-        return;
-    }
-    const MessageChannelInfo::Participant *participant = &messageChannelInfo->getParticipants().at(lastParticipantIndex);
-    Contact *myself = mailbox->getOwner()->getMyself();
-    if (participant->uid == myself->getUid()) {
-        onSendResult(WP::kOk);
-        return;
+void MultiMailMessenger::sendTo(const QList<int> &recipientIndices)
+{
+    QList<const MessageChannelInfo::Participant*> receivers;
+    foreach (int index, recipientIndices) {
+        Recipient &recipient = recipients[index];
+        recipient.attempts++;
+        receivers.append(recipient.participant);
     }
 
-    MailMessengerRef mailMessenger(new MailMessenger(mailbox, participant, profile, message));
-    QString targetServer = mailMessenger->getTargetServer();
+    QString targetServer = recipients.at(recipientIndices.first()).server;
     if (targetServer == "") {
-        onSendResult(WP::kBadValue);
+        foreach (int index, recipientIndices)
+            finishRecipient(index, WP::kBadValue);
         return;
     }
+
+    MailMessengerRef mailMessenger(new MailMessenger(mailbox, receivers, profile, message,
+                                                     signedMessage, signedChannelInfo));
     QUrl url(targetServer);
     RemoteConnectionJobQueue *queue = ConnectionManager::get()->getConnectionJobQueue(
                 ConnectionManager::getDefaultConnectionFor(url));
+
+    // connect before queuing, the job may finish right away
+    runningMessengers[mailMessenger.data()] = recipientIndices;
+    connect(mailMessenger.data(), SIGNAL(jobDone(WP::err)), this, SLOT(onSendResult(WP::err)));
     queue->queue(mailMessenger);
+}
 
+void MultiMailMessenger::onSendResult(WP::err error)
+{
+    MailMessenger *mailMessenger = qobject_cast<MailMessenger*>(sender());
+    QMap<MailMessenger*, QList<int> >::iterator it = runningMessengers.find(mailMessenger);
+    if (it == runningMessengers.end())
+        return;
+    QList<int> recipientIndices = it.value();
+    runningMessengers.erase(it);
+    mailMessenger->disconnect(this);
+
+    const QList<WP::err> &receiverStatus = mailMessenger->getReceiverStatus();
+    QList<int> retryList;
+    for (int i = 0; i < recipientIndices.count(); i++) {
+        int recipientIndex = recipientIndices.at(i);
+        WP::err status = receiverStatus.at(i);
+        if (isRetryable(status) && recipients.at(recipientIndex).attempts < kMaxSendAttempts)
+            retryList.append(recipientIndex);
+        else
+            finishRecipient(recipientIndex, status);
+    }
+    if (retryList.isEmpty())
+        return;
 
-    connect(mailMessenger.data(), SIGNAL(jobDone(WP::err)), this, SLOT(onSendResult(WP::err)));
+    // give the connection some time to recover
+    int attempts = recipients.at(retryList.first()).attempts;
+    QTimer *timer = new QTimer(this);
+    timer->setSingleShot(true);
+    connect(timer, SIGNAL(timeout()), this, SLOT(onRetryTimeout()));
+    retryTimers[timer] = retryList;
+    timer->start(kRetryDelay << (attempts - 1));
+}
+
+void MultiMailMessenger::onRetryTimeout()
+{
+    QTimer *timer = qobject_cast<QTimer*>(sender());
+    QMap<QTimer*, QList<int> >::iterator it = retryTimers.find(timer);
+    if (it == retryTimers.end())
+        return;
+    QList<int> recipientIndices = it.value();
+    retryTimers.erase(it);
+    timer->deleteLater();
+
+    sendTo(recipientIndices);
+}
+
+bool MultiMailMessenger::isRetryable(WP::err error)
+{
+    // connection and transport errors are reported as kError
+    return error == WP::kError;
+}
+
+void MultiMailMessenger::finishRecipient(int recipientIndex, WP::err error)
+{
+    Recipient &recipient = recipients[recipientIndex];
+    recipient.status = error;
+    recipient.finished = true;
+
+    pendingRecipients--;
+    if (pendingRecipients == 0)
+        emit messagesSent();
 }
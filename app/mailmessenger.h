@@ -8,19 +8,31 @@
 #include "remoteconnectionmanager.h"
 
 class Profile;
+class QTimer;
 class UserIdentity;
 
+/*! Delivers a message to one or more receivers on the same server with a single put_message. The
+message and the channel info are signed by the caller; only the channel is wrapped for each
+receiver.
+*/
 class MailMessenger : public RemoteConnectionJob {
 Q_OBJECT
 public:
-    MailMessenger(Mailbox *mailbox, const MessageChannelInfo::Participant *receiver,
-                  Profile *profile, MessageRef message);
+    MailMessenger(Mailbox *mailbox, const QList<const MessageChannelInfo::Participant*> &receivers,
+                  Profile *profile, MessageRef message, const QByteArray &signedMessage,
+                  const QByteArray &signedChannelInfo);
     ~MailMessenger();
 
     virtual void run(RemoteConnectionJobQueue *jobQueue);
     virtual void abort();
 
     QString getTargetServer();
+    //! status of each receiver, same order as the receivers
+    const QList<WP::err> &getReceiverStatus() const;
+
+    //! returns false if the address is invalid
+    static bool parseAddress(const QString &targetAddress, QString &targetUser,
+                             QString &targetServer);
 
 private slots:
     void handleReply(WP::err error);
@@ -28,22 +40,29 @@ private slots:
     void onContactFound(WP::err error);
 
 private:
-    void parseAddress(const QString &targetAddress);
+    //! finds the contact of the next receiver and authenticates at its server user
+    void prepareNextReceiver();
+    void receiverFailed(WP::err error);
+    void sendMessage();
     WP::err startContactRequest();
 
     Mailbox *mailbox;
-    const MessageChannelInfo::Participant *receiver;
+    QList<const MessageChannelInfo::Participant*> receivers;
     Profile *profile;
     MessageRef message;
+    QByteArray signedMessage;
+    QByteArray signedChannelInfo;
 
     UserIdentity *userIdentity;
 
     QString targetServer;
-    QString targetUser;
-
-    Contact *targetContact;
+    QStringList targetUsers;
+    QList<Contact*> targetContacts;
+    QList<WP::err> receiverStatus;
+    int currentReceiver;
 
     ContactRequest* contactRequest;
+    RemoteConnectionJobQueue *jobQueue;
     RemoteConnection *remoteConnection;
     RemoteConnectionReply *serverReply;
     RemoteAuthenticationRef authentication;
@@ -52,6 +71,12 @@ private:
 typedef QSharedPointer<MailMessenger> MailMessengerRef;
 
 
+/*! Sends a message to all participants of its channel. The recipients are grouped by their server
+and each server gets one request. Each server has its own job queue, so the servers are served
+in parallel. A delivery that failed because of the connection is retried a few times with a growing
+delay; other failures finish the recipient right away. messagesSent is emitted once all recipients
+are finished.
+*/
 class MultiMailMessenger : public QObject {
 Q_OBJECT
 public:
@@ -60,21 +85,50 @@ public:
 
     WP::err postMessage(MessageRef message);
 
+    class Recipient {
+    public:
+        const MessageChannelInfo::Participant *participant;
+        QString server;
+        //! WP::kOk if the message has been delivered, otherwise the last error
+        WP::err status;
+        int attempts;
+        bool finished;
+    };
+
+    const QList<Recipient> &getRecipients() const;
+
 signals:
     void messagesSent();
 
 private slots:
     void onSendResult(WP::err error);
+    void onRetryTimeout();
 
 private:
-    MailMessenger *mailMessenger;
+    //! all recipients have to be on the same server
+    void sendTo(const QList<int> &recipientIndices);
+    void finishRecipient(int recipientIndex, WP::err error);
+    //! true for connection errors, e.g. refused contacts or bad addresses are not retried
+    static bool isRetryable(WP::err error);
+
+    static const int kMaxSendAttempts = 3;
+    //! delay before the first retry in ms, doubled for each further attempt
+    static const int kRetryDelay = 2000;
+
     MessageRef message;
+    QByteArray signedMessage;
+    QByteArray signedChannelInfo;
 
     Mailbox *mailbox;
     MessageChannelInfoRef messageChannelInfo;
     Profile *profile;
 
-    int lastParticipantIndex;
+    QList<Recipient> recipients;
+    int pendingRecipients;
+    //! running messenger to the indices of its recipients
+    QMap<MailMessenger*, QList<int> > runningMessengers;
+    //! pending retry to the indices of its recipients
+    QMap<QTimer*, QList<int> > retryTimers;
 };
 
 #endif // MAILMESSENGER_H
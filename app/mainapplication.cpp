@@ -1,6 +1,7 @@
 #include "mainapplication.h"
 
 #include "createprofiledialog.h"
+#include "mail.h"
 #include "passworddialog.h"
 #include "useridentity.h"
 
@@ -66,5 +67,6 @@ MainApplication::~MainApplication()
 {
     delete mainWindow;
     delete profile;
+    ChannelKeyCache::destroy();
     CryptoInterfaceSingleton::destroy();
 }
@@ -137,6 +137,7 @@ void MessageReceiver::commitPackReceived(const QByteArray& data, const QString&
     }
 
     // update tip
+    gitInterface->syncObjects();
     gitInterface->updateTip(last);
 }
 
@@ -3,10 +3,23 @@
 #include "mailbox.h"
 
 
-MessageThread::MessageThread(MessageChannel *channel) :
-    channel(channel)
+MessageThread::MessageThread(MessageChannel *channel, MessageLoader *loader) :
+    channelUid(channel->getUid()),
+    channel(channel),
+    loader(loader),
+    loaded(true),
+    lastMessageTimestamp(0)
 {
-    messages = new MessageListModel();
+    messages = new MessageListModel(loader);
+}
+
+MessageThread::MessageThread(const QString &channelUid, MessageLoader *loader) :
+    channelUid(channelUid),
+    loader(loader),
+    loaded(false),
+    lastMessageTimestamp(0)
+{
+    messages = new MessageListModel(loader);
 }
 
 MessageThread::~MessageThread()
@@ -14,29 +27,96 @@ MessageThread::~MessageThread()
     delete messages;
 }
 
+const QString &MessageThread::getChannelUid() const
+{
+    return channelUid;
+}
+
 MessageChannelRef MessageThread::getMessageChannel() const
 {
+    if (channel == NULL)
+        loadThread();
     return channel;
 }
 
+void MessageThread::setMessageChannel(MessageChannel *messageChannel)
+{
+    channel = MessageChannelRef(messageChannel);
+}
+
 MessageListModel &MessageThread::getMessages() const
 {
     return *messages;
 }
 
-QVector<MessageChannelInfoRef> &MessageThread::getChannelInfos()
+const QVector<MessageChannelInfoRef> &MessageThread::getChannelInfos() const
 {
+    loadThread();
     return channelInfoList;
 }
 
-MessageRef MessageThread::getLastMessage() const
+void MessageThread::addChannelInfo(MessageChannelInfoRef info)
+{
+    if (channelInfoIndex.contains(info->getUid()))
+        return;
+    if (channelInfoList.isEmpty()) {
+        QStringList addresses;
+        foreach (const MessageChannelInfo::Participant &participant, info->getParticipants())
+            addresses.append(participant.address);
+        setSummary(info->getSubject(), addresses);
+    }
+    channelInfoList.append(info);
+    channelInfoIndex[info->getUid()] = info;
+}
+
+MessageChannelInfoRef MessageThread::findChannelInfo(const QString &channelInfoUid) const
+{
+    loadThread();
+    return channelInfoIndex.value(channelInfoUid);
+}
+
+const QString &MessageThread::getSubject() const
+{
+    return subject;
+}
+
+const QStringList &MessageThread::getParticipants() const
+{
+    return participants;
+}
+
+void MessageThread::setSummary(const QString &_subject, const QStringList &_participants)
 {
-    return lastMessage;
+    subject = _subject;
+    participants = _participants;
 }
 
-void MessageThread::setLastMessage(MessageRef message)
+time_t MessageThread::getLastMessageTimestamp() const
 {
-    lastMessage = message;
+    return lastMessageTimestamp;
+}
+
+void MessageThread::setLastMessageTimestamp(time_t timestamp)
+{
+    lastMessageTimestamp = timestamp;
+}
+
+void MessageThread::loadThread() const
+{
+    if (loaded || loader == NULL)
+        return;
+    // set before loading; decoding the infos looks the channel up again
+    loaded = true;
+    loader->loadThread(const_cast<MessageThread*>(this));
+}
+
+bool messageThreadComparator(const MessageThread *a, const MessageThread *b)
+{
+    if (a->getLastMessageTimestamp() == 0)
+        return false;
+    if (b->getLastMessageTimestamp() == 0)
+        return true;
+    return a->getLastMessageTimestamp() > b->getLastMessageTimestamp();
 }
 
 MessageThreadDataModel::MessageThreadDataModel(QObject *parent) :
@@ -50,29 +130,19 @@ QVariant MessageThreadDataModel::data(const QModelIndex &index, int role) const
     if (role != Qt::DisplayRole)
         return QVariant();
 
-    QString text;
-
     MessageThread* thread = channels.at(index.row());
-    if (thread->getChannelInfos().size() > 0) {
-        MessageChannelInfoRef info = thread->getChannelInfos().at(0);
-        text += info->getSubject();
+    QString text = thread->getSubject();
+    const QStringList &participants = thread->getParticipants();
+    if (participants.count() > 0) {
         if (text == "")
             text += " ";
-        if (info->getParticipants().size() > 0) {
-            text += "(";
-            QVector<MessageChannelInfo::Participant> &participants = info->getParticipants();
-            for (int i = 0; i < participants.size(); i++) {
-                text += participants.at(i).address;
-                if (i < participants.size() - 1)
-                    text += ",";
-            }
-            text += ")";
-        }
-
+        text += "(";
+        text += participants.join(",");
+        text += ")";
     }
 
     if (text == "")
-        text += thread->getMessageChannel()->getUid();
+        text += thread->getChannelUid();
 
     return text;
 }
@@ -89,9 +159,11 @@ int MessageThreadDataModel::getChannelCount() const
 
 void MessageThreadDataModel::addChannel(MessageThread *channel)
 {
-    int index = channels.size();
+    int index = qUpperBound(channels.begin(), channels.end(), channel, messageThreadComparator)
+        - channels.begin();
     beginInsertRows(QModelIndex(), index, index);
-    channels.append(channel);
+    channels.insert(index, channel);
+    channelIndex[channel->getChannelUid()] = channel;
     endInsertRows();
 }
 
@@ -100,6 +172,7 @@ MessageThread *MessageThreadDataModel::removeChannelAt(int index)
     MessageThread *channel = channels.at(index);
     beginRemoveRows(QModelIndex(), index, index);
     channels.removeAt(index);
+    channelIndex.remove(channel->getChannelUid());
     endRemoveRows();
     return channel;
 }
@@ -120,11 +193,7 @@ MessageThread *MessageThreadDataModel::channelAt(int index) const
 
 MessageThread *MessageThreadDataModel::findChannel(const QString &channelId) const
 {
-    foreach (MessageThread *thread, channels) {
-        if (thread->getMessageChannel()->getUid() == channelId)
-            return thread;
-    }
-    return NULL;
+    return channelIndex.value(channelId, NULL);
 }
 
 void MessageThreadDataModel::clear()
@@ -133,18 +202,10 @@ void MessageThreadDataModel::clear()
     foreach (MessageThread *ref, channels)
         delete ref;
     channels.clear();
+    channelIndex.clear();
     endRemoveRows();
 }
 
-bool messageThreadComparator(const MessageThread *a, const MessageThread *b)
-{
-    if (a->getLastMessage() == NULL)
-        return false;
-    if (b->getLastMessage() == NULL)
-        return true;
-    return a->getLastMessage()->getTimestamp() > b->getLastMessage()->getTimestamp();
-}
-
 void MessageThreadDataModel::sort()
 {
     beginResetModel();
@@ -152,6 +213,24 @@ void MessageThreadDataModel::sort()
     endResetModel();
 }
 
+void MessageThreadDataModel::updateChannelPosition(MessageThread *channel)
+{
+    int from = channels.indexOf(channel);
+    if (from < 0)
+        return;
+    channels.removeAt(from);
+    int to = qUpperBound(channels.begin(), channels.end(), channel, messageThreadComparator)
+        - channels.begin();
+    channels.insert(from, channel);
+    if (to == from)
+        return;
+
+    // the destination row is counted before the row is moved
+    beginMoveRows(QModelIndex(), from, from, QModelIndex(), to > from ? to + 1 : to);
+    channels.move(from, to);
+    endMoveRows();
+}
+
 MessageThreadDataModel::~MessageThreadDataModel()
 {
     clear();
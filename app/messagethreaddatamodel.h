@@ -2,30 +2,56 @@
 #define MESSAGETHREADDATAMODEL_H
 
 #include <QAbstractListModel>
+#include <QHash>
 #include <QList>
+#include <QStringList>
 
 #include "mail.h"
 
 class MessageListModel;
+class MessageLoader;
 
 
+/*! A thread either holds its decoded channel and channel infos or, when created from the mailbox
+index, only the channel uid and a summary. In the latter case the channel and the infos are read
+through the loader on first use. */
 class MessageThread {
 public:
-    MessageThread(MessageChannel *channel);
+    MessageThread(MessageChannel *channel, MessageLoader *loader = NULL);
+    MessageThread(const QString &channelUid, MessageLoader *loader);
     ~MessageThread();
 
+    const QString &getChannelUid() const;
     MessageChannelRef getMessageChannel() const;
+    void setMessageChannel(MessageChannel *channel);
     MessageListModel &getMessages() const;
-    QVector<MessageChannelInfoRef> &getChannelInfos();
+    const QVector<MessageChannelInfoRef> &getChannelInfos() const;
+    //! infos that are already known are ignored
+    void addChannelInfo(MessageChannelInfoRef info);
+    MessageChannelInfoRef findChannelInfo(const QString &channelInfoUid) const;
 
-    MessageRef getLastMessage() const;
-    void setLastMessage(MessageRef message);
+    //! subject and participant addresses of the first channel info
+    const QString &getSubject() const;
+    const QStringList &getParticipants() const;
+    void setSummary(const QString &subject, const QStringList &participants);
+
+    //! 0 if the thread has no messages
+    time_t getLastMessageTimestamp() const;
+    void setLastMessageTimestamp(time_t timestamp);
 
 private:
+    void loadThread() const;
+
+    QString channelUid;
     MessageChannelRef channel;
+    MessageLoader *loader;
+    mutable bool loaded;
     MessageListModel *messages;
     QVector<MessageChannelInfoRef> channelInfoList;
-    MessageRef lastMessage;
+    QHash<QString, MessageChannelInfoRef> channelInfoIndex;
+    QString subject;
+    QStringList participants;
+    time_t lastMessageTimestamp;
 };
 
 class MessageThreadDataModel : public QAbstractListModel {
@@ -45,10 +71,15 @@ public:
 
     void clear();
 
+    //! sorts all threads, newest thread first
     void sort();
+    //! moves a thread to its sorted position, e.g., after a new message arrived
+    void updateChannelPosition(MessageThread *channel);
 
 private:
     QList<MessageThread*> channels;
+    //! channel uid to thread
+    QHash<QString, MessageThread*> channelIndex;
 };
 
 #endif // MESSAGETHREADDATAMODEL_H
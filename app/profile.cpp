@@ -448,6 +448,21 @@ void Profile::clear()
     branchList.clear();
 }
 
+//! how concurrent changes from different devices are merged
+static MergePolicy mergePolicyFor(const QString &branch)
+{
+    if (branch == "key_stores")
+        return MergePolicy(MergePolicy::kKeepAll);
+    if (branch == "mailboxes") {
+        // the mailbox config is in the mailbox dir, messages and channels are content addressed
+        // sub dirs: mailbox/xx/xxxx/...
+        MergePolicy policy(MergePolicy::kLastWriterWins);
+        policy.addRule("*/*/*", MergePolicy::kUnion);
+        return policy;
+    }
+    return MergePolicy(MergePolicy::kLastWriterWins);
+}
+
 DatabaseBranch *Profile::databaseBranchFor(const QString &database, const QString &branch)
 {
     for (int i = 0; i < branchList.count(); i++) {
@@ -459,6 +474,8 @@ DatabaseBranch *Profile::databaseBranchFor(const QString &database, const QStrin
     DatabaseBranch *databaseBranch = new DatabaseBranch(database, branch);
     if (databaseBranch == NULL)
         return NULL;
+    if (databaseBranch->getDatabase() != NULL)
+        databaseBranch->getDatabase()->setMergePolicy(mergePolicyFor(branch));
     branchList.append(databaseBranch);
     return databaseBranch;
 }
@@ -12,7 +12,7 @@ const char* kPathIdentityKeyId = "identity_key_id";
 UserIdentity::UserIdentity(DatabaseBranch *branch, const QString &baseDir) :
     mailbox(NULL),
     myselfContact(NULL),
-    contactFinder(contactList),
+    contactFinder(contacts),
     keyStoreFinder(NULL),
     mailboxFinder(NULL)
 {
@@ -24,7 +24,7 @@ UserIdentity::UserIdentity(DatabaseBranch *branch, const QString &baseDir) :
 UserIdentity::~UserIdentity()
 {
     // myself is in the contact list so don't delete
-    foreach (Contact *contact, contactList)
+    foreach (Contact *contact, contacts.getContacts())
         delete contact;
 }
 
@@ -57,7 +57,7 @@ WP::err UserIdentity::createNewIdentity(KeyStore *keyStore, const QString &defau
     error = myselfContact->createUserIdentityContact(keyStore, keyId);
     if (error != WP::kOk)
         return error;
-    contactList.append(myselfContact);
+    contacts.add(myselfContact);
 
     error = write(kPathMailboxId, mailbox->getUid());
     if (error != WP::kOk)
@@ -87,7 +87,7 @@ WP::err UserIdentity::open(KeyStoreFinder *keyStoreFinder, MailboxFinder *mailbo
     error = myselfContact->open(keyStoreFinder);
     if (error != WP::kOk)
         return error;
-    contactList.append(myselfContact);
+    contacts.add(myselfContact);
 
     QStringList contactNames = listDirectories("contacts");
     openContacts(contactNames);
@@ -111,28 +111,26 @@ Contact *UserIdentity::getMyself() const
 
 const QList<Contact *> &UserIdentity::getContacts()
 {
-    return contactList;
+    return contacts.getContacts();
 }
 
 WP::err UserIdentity::addContact(Contact *contact)
 {
     QString contactUid = contact->getUid();
+    if (contacts.findByUid(contactUid) != NULL)
+        return WP::kError;
     QString path = "contacts/" + contactUid;
     contact->setTo(this, path);
     WP::err error = contact->writeConfig();
     if (error != WP::kOk)
         return error;
-    contactList.append(contact);
+    contacts.add(contact);
     return WP::kOk;
 }
 
 Contact *UserIdentity::findContact(const QString &address)
 {
-    foreach (Contact *contact, contactList) {
-        if (contact->getAddress() == address)
-            return contact;
-    }
-    return NULL;
+    return contacts.findByAddress(address);
 }
 
 Contact *UserIdentity::findContactByUid(const QString &uid)
@@ -157,14 +155,14 @@ void UserIdentity::onNewDiffs(const DatabaseDiff &diff)
 
 void UserIdentity::openContacts(QStringList contactNames) {
     foreach (const QString &contactName, contactNames) {
+        // contact directories are named by the contact uid, skip contacts that are already open
+        if (contacts.findByUid(contactName) != NULL)
+            continue;
         QString path = "contacts/" + contactName;
         Contact *contact = new Contact(this, path);
         WP::err error = contact->open(keyStoreFinder);
-        if (error != WP::kOk) {
+        if (error != WP::kOk || !contacts.add(contact))
             delete contact;
-            continue;
-        }
-        contactList.append(contact);
     }
 }
 
@@ -180,17 +178,13 @@ WP::err UserIdentity::writePublicSignature(const QString &filename, const QStrin
 }
 
 
-UserIdentity::UserIdContactFinder::UserIdContactFinder(QList<Contact *> &contactList) :
-    contacts(contactList)
+UserIdentity::UserIdContactFinder::UserIdContactFinder(const ContactRegistry &contacts) :
+    contacts(contacts)
 {
 
 }
 
 Contact *UserIdentity::UserIdContactFinder::find(const QString &uid)
 {
-    foreach (Contact *contact, contacts) {
-        if (contact->getUid() == uid)
-            return contact;
-    }
-    return NULL;
+    return contacts.findByUid(uid);
 }
@@ -59,10 +59,10 @@ private:
 
     class UserIdContactFinder : public ContactFinder {
     public:
-        UserIdContactFinder(QList<Contact *> &contactList);
+        UserIdContactFinder(const ContactRegistry &contacts);
         virtual Contact *find(const QString &uid);
     private:
-        QList<Contact *> &contacts;
+        const ContactRegistry &contacts;
     };
 
     WP::err writePublicSignature(const QString &filename, const QString &publicKey);
@@ -70,7 +70,7 @@ private:
     Mailbox *mailbox;
 
     Contact *myselfContact;
-    QList<Contact *> contactList;
+    ContactRegistry contacts;
 
     UserIdContactFinder contactFinder;
 
@@ -7,6 +7,87 @@ include_once 'XMLProtocol.php';
 class AuthConst {
 	static public $kAuthStanza = "auth";
 	static public $kAuthSignedStanza = "auth_signed"; 
+	static public $kAuthTicketStanza = "auth_ticket";
+	// lifetime of a session ticket in seconds
+	static public $kTicketLifeTime = 604800;
+}
+
+
+/*
+ * Session tickets let a client resume a signature login without signing again. Only a hash of the
+ * ticket is stored on the server: $serverUser/tickets/sha1(ticket).
+ */
+class SessionTicketStore {
+	static private function ticketFile($serverUser, $ticket) {
+		if (!preg_match('/^[0-9a-f]{40}$/', $ticket))
+			return null;
+		return $serverUser."/tickets/".sha1($ticket);
+	}
+
+	//! returns the ticket and its expiry date
+	static public function issue($serverUser, $loginUser, $role) {
+		$dir = $serverUser."/tickets";
+		if (!file_exists($dir) && !mkdir($dir, 0700, true))
+			return null;
+		$ticket = bin2hex(openssl_random_pseudo_bytes(20));
+		$expires = time() + AuthConst::$kTicketLifeTime;
+		$data = serialize(array("loginUser" => $loginUser, "role" => $role, "expires" => $expires));
+		if (file_put_contents(SessionTicketStore::ticketFile($serverUser, $ticket), $data, LOCK_EX) === false)
+			return null;
+		return array("ticket" => $ticket, "expires" => $expires);
+	}
+
+	//! returns the role the ticket grants or null if the ticket is invalid
+	static public function redeem($serverUser, $loginUser, $ticket) {
+		$fileName = SessionTicketStore::ticketFile($serverUser, $ticket);
+		if ($fileName === null || !file_exists($fileName))
+			return null;
+		$data = unserialize(file_get_contents($fileName));
+		if ($data === false || $data["expires"] < time()) {
+			unlink($fileName);
+			return null;
+		}
+		if ($data["loginUser"] != $loginUser)
+			return null;
+		return $data["role"];
+	}
+
+	static public function revoke($serverUser, $ticket) {
+		$fileName = SessionTicketStore::ticketFile($serverUser, $ticket);
+		if ($fileName !== null && file_exists($fileName))
+			unlink($fileName);
+	}
+}
+
+
+function pushAuthResult($outStream, $stanzaName, $status, $message, $ticket = null) {
+	$stanza = new OutStanza($stanzaName);
+	$stanza->addAttribute("status", $status);
+	$stanza->addAttribute("message", $message);
+	if ($ticket !== null) {
+		$stanza->addAttribute("ticket", $ticket["ticket"]);
+		$stanza->addAttribute("ticket_expires", $ticket["expires"]);
+	}
+	$outStream->pushChildStanza($stanza);
+	$roles = Session::get()->getUserRoles();
+	$firstRole = true;
+	foreach ($roles as $role) {
+		$stanza = new OutStanza("role");
+		$stanza->setText($role);
+		if ($firstRole) {
+			$outStream->pushChildStanza($stanza);
+			$firstRole = false;
+		} else
+			$outStream->pushStanza($stanza);
+	}
+	$outStream->cdDotDot();
+}
+
+function removeDuplicateRoles($array){
+	$cleanedArray = array();
+	foreach($array as $key=>$value)
+		$cleanedArray[$value] = 1;
+	return array_keys($cleanedArray);
 }
 
 
@@ -76,6 +157,8 @@ class AccountAuthSignedStanzaHandler extends InStanzaHandler {
 	private $serverUser = "";
 	private $loginUser = "";
 	private $signature;
+	// role granted by this login, also granted when the issued ticket is redeemed
+	private $grantedRole = null;
 
 	private function getPurpose() {
 		return $this->serverUser.":".$this->loginUser;
@@ -102,13 +185,6 @@ class AccountAuthSignedStanzaHandler extends InStanzaHandler {
 		return true;
 	}
 
-	private function removeDuplicates($array){
-		$cleanedArray = array();
-		foreach($array as $key=>$value)
-			$cleanedArray[$value] = 1;
-		return array_keys($cleanedArray);
-	}
-
 	public function finished() {
 		$userIdentity = Session::get()->getMainUserIdentity($this->serverUser);
 
@@ -131,33 +207,23 @@ class AccountAuthSignedStanzaHandler extends InStanzaHandler {
 		}
 		// cleanup from double logins.
 		//TODO: check earlier if verification was neccessary? so that we don't need to cleanup here
-		$roles = $this->removeDuplicates($roles);
+		$roles = removeDuplicateRoles($roles);
 		Session::get()->setUserRoles($roles);
 
+		$ticket = null;
+		if ($status && $this->grantedRole !== null)
+			$ticket = SessionTicketStore::issue($this->serverUser, $this->loginUser, $this->grantedRole);
+
 		// produce output
 		$outStream = new ProtocolOutStream();
 		$outStream->pushStanza(new IqOutStanza(IqType::$kResult));
-		$stanza = new OutStanza(AuthConst::$kAuthSignedStanza);
 		$statusMessage;
 		if ($status)
 			$statusMessage = "ok";
 		else
 			$statusMessage = "denied";
-		$stanza->addAttribute("status", $statusMessage);
-		$stanza->addAttribute("message", $this->errorMessage);
-		$outStream->pushChildStanza($stanza);
-		$roles = Session::get()->getUserRoles();
-		$firstRole = true;
-		foreach ($roles as $role) {
-			$stanza = new OutStanza("role");
-			$stanza->setText($role);
-			if ($firstRole) {
-				$outStream->pushChildStanza($stanza);
-				$firstRole = false;
-			} else
-				$outStream->pushStanza($stanza);
-		}
-		$outStream->cdDotDot();
+		pushAuthResult($outStream, AuthConst::$kAuthSignedStanza, $statusMessage, $this->errorMessage,
+			$ticket);
 		$this->inStreamReader->appendResponse($outStream->flush());
 	}
 
@@ -175,6 +241,7 @@ class AccountAuthSignedStanzaHandler extends InStanzaHandler {
 		}
 		Session::get()->setAccountUser($this->serverUser);
 		$roles[] =  "account";
+		// no ticket, the setup login is only needed once
 		return true;
 	}
 
@@ -186,6 +253,7 @@ class AccountAuthSignedStanzaHandler extends InStanzaHandler {
 		}
 		Session::get()->setAccountUser($this->serverUser);
 		$roles[] =  "account";
+		$this->grantedRole = "account";
 		return true;
 	}
 
@@ -197,12 +265,71 @@ class AccountAuthSignedStanzaHandler extends InStanzaHandler {
 		}
 		$loginServerUser = $this->serverUser;
 		$roles[] = $loginServerUser.":contact_user";
+		$this->grantedRole = "contact_user";
 		
 		return true;
 	}
 }
 
 
+/*
+ * Resumes a signature login with a session ticket, i.e., the client doesn't have to sign a token.
+ * If the ticket is denied the client falls back to the signature login.
+ */
+class AccountAuthTicketStanzaHandler extends InStanzaHandler {
+	private $inStreamReader;
+	private $ticket;
+	private $serverUser;
+	private $loginUser;
+
+	public function __construct($inStreamReader) {
+		InStanzaHandler::__construct(AuthConst::$kAuthTicketStanza);
+		$this->inStreamReader = $inStreamReader;
+	}
+
+	public function handleStanza($xml) {
+		$this->ticket = $xml->getAttribute("ticket");
+		$this->serverUser = $xml->getAttribute("serverUser");
+		$this->loginUser = $xml->getAttribute("loginUser");
+		if ($this->ticket == "" || $this->serverUser == "" || $this->loginUser == "")
+			return false;
+		return true;
+	}
+
+	public function finished() {
+		$status = false;
+		$role = SessionTicketStore::redeem($this->serverUser, $this->loginUser, $this->ticket);
+		// the ticket is only valid as long as the login user is still known
+		$userIdentity = Session::get()->getMainUserIdentity($this->serverUser);
+		if ($role !== null && $userIdentity != null) {
+			$roles = Session::get()->getUserRoles();
+			if ($role == "account" && $userIdentity->getMyself()->getUid() == $this->loginUser) {
+				Session::get()->setAccountUser($this->serverUser);
+				$roles[] = "account";
+				$status = true;
+			} else if ($role == "contact_user" && $userIdentity->findContact($this->loginUser) !== null) {
+				$roles[] = $this->serverUser.":contact_user";
+				$status = true;
+			}
+			Session::get()->setUserRoles(removeDuplicateRoles($roles));
+		}
+		if (!$status)
+			SessionTicketStore::revoke($this->serverUser, $this->ticket);
+
+		$outStream = new ProtocolOutStream();
+		$outStream->pushStanza(new IqOutStanza(IqType::$kResult));
+		if ($status)
+			pushAuthResult($outStream, AuthConst::$kAuthTicketStanza, "ok", "");
+		else {
+			$stanza = new OutStanza(AuthConst::$kAuthTicketStanza);
+			$stanza->addAttribute("status", "denied");
+			$outStream->pushChildStanza($stanza);
+		}
+		$this->inStreamReader->appendResponse($outStream->flush());
+	}
+}
+
+
 class LogoutStanzaHandler extends InStanzaHandler {
 	private $inStreamReader;
 
@@ -212,6 +339,10 @@ class LogoutStanzaHandler extends InStanzaHandler {
 	}
 
 	public function handleStanza($xml) {
+		$serverUser = $xml->getAttribute("serverUser");
+		$ticket = $xml->getAttribute("ticket");
+		if ($serverUser != "" && $ticket != "")
+			SessionTicketStore::revoke($serverUser, $ticket);
 		Session::get()->clear();
 
 		// produce output
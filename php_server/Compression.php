@@ -0,0 +1,61 @@
+<?php
+
+/*
+ * Compression of whole protocol messages, see support/protocolcompression.cpp. zlib is primed with
+ * a dictionary of the stanza vocabulary that must match the one of the client.
+ */
+class ProtocolCompression {
+	static public $kName = "zlib_dict1";
+
+	static public function dictionary() {
+		return
+		'<?xml version="1.0" encoding="UTF-8"?>' .
+		'<iq type="error" details="' .
+		'<auth type="signature" loginUser="' .
+		'" serverUser="' .
+		'"/><auth_signed signature="' .
+		'"/><auth_signed status="ok"><role>account</role></auth_signed>' .
+		'<logout/>' .
+		'<contact_request>' .
+		'<put_message server_user="' .
+		'" channel="' .
+		'"><channel uid="' .
+		'"/><channel_info uid="' .
+		'"/><message uid="' .
+		'"/></put_message>' .
+		'<watch_branches status="server_timeout"/>' .
+		'<watch_branches status="update">' .
+		'<sync_push branch="' .
+		'" start_commit="' .
+		'" last_commit="' .
+		'"><pack>' .
+		'<sync_push_batch><branch branch="' .
+		'" status="ok" tip="' .
+		'<sync_pull_batch><branch branch="' .
+		'<sync_pull branch="' .
+		'" base="' .
+		'" tip="' .
+		'"><pack></pack></sync_pull>' .
+		'</pack></branch>' .
+		'<iq type="get">' .
+		'<iq type="set">' .
+		'<iq type="result">' .
+		'</iq>';
+	}
+
+	static public function isSupported() {
+		return function_exists('deflate_init') && function_exists('inflate_init');
+	}
+
+	static public function compress($data) {
+		$context = deflate_init(ZLIB_ENCODING_DEFLATE, array('dictionary' => ProtocolCompression::dictionary()));
+		return deflate_add($context, $data, ZLIB_FINISH);
+	}
+
+	static public function decompress($data) {
+		$context = inflate_init(ZLIB_ENCODING_DEFLATE, array('dictionary' => ProtocolCompression::dictionary()));
+		return inflate_add($context, $data, ZLIB_FINISH);
+	}
+}
+
+?>
@@ -24,6 +24,15 @@ function initSyncHandlers($XMLHandler) {
 	$pushHandler = new SyncPushStanzaHandler($XMLHandler->getInStream(), $database);
 	$pushIqGetHandler->addChild($pushHandler);
 	$XMLHandler->addHandler($pushIqGetHandler);
+
+	// batched pull and push of many branches
+	$pullBatchIqHandler = new InIqStanzaHandler(IqType::$kGet);
+	$pullBatchIqHandler->addChild(new SyncPullBatchStanzaHandler($XMLHandler->getInStream(), $database));
+	$XMLHandler->addHandler($pullBatchIqHandler);
+
+	$pushBatchIqHandler = new InIqStanzaHandler(IqType::$kSet);
+	$pushBatchIqHandler->addChild(new SyncPushBatchStanzaHandler($XMLHandler->getInStream(), $database));
+	$XMLHandler->addHandler($pushBatchIqHandler);
 }
 
 // handle the initial sign in request and send out a sign request
@@ -42,6 +51,14 @@ function initAccountAuthSignedHandler($XMLHandler) {
 	$XMLHandler->addHandler($iqHandler);
 }
 
+// resume a previous signature login with a session ticket
+function initAccountAuthTicketHandler($XMLHandler) {
+	$iqHandler = new InIqStanzaHandler(IqType::$kSet);
+	$handler = new AccountAuthTicketStanzaHandler($XMLHandler->getInStream());
+	$iqHandler->addChild($handler);
+	$XMLHandler->addHandler($iqHandler);
+}
+
 
 function initWatchBranchesStanzaHandler($XMLHandler) {
 	$iqHandler = new InIqStanzaHandler(IqType::$kGet);
@@ -63,6 +80,7 @@ function initAuthHandlers($XMLHandler) {
 	// auth
 	initAccountAuthHandler($XMLHandler);
 	initAccountAuthSignedHandler($XMLHandler);	
+	initAccountAuthTicketHandler($XMLHandler);
 
 	$logoutIqSetHandler = new InIqStanzaHandler(IqType::$kSet);
 	$logoutHandler = new LogoutStanzaHandler($XMLHandler->getInStream());
@@ -9,6 +9,7 @@ class MessageConst {
 	static public $kMessageStanza = "message";
 	static public $kChannelStanza = "channel";
 	static public $kChannelInfoStanza = "channel_info";
+	static public $kRecipientStanza = "recipient";
 };
 
 
@@ -19,6 +20,10 @@ class SignedPackageStanzaHandler extends InStanzaHandler {
 		InStanzaHandler::__construct($stanzaName);
 		$this->signedPackage = $signedPackage;
 	}
+
+	public function setPackage($signedPackage) {
+		$this->signedPackage = $signedPackage;
+	}
 	
 	public function handleStanza($xml) {
 		$this->signedPackage->uid = $xml->getAttribute("uid");
@@ -31,6 +36,44 @@ class SignedPackageStanzaHandler extends InStanzaHandler {
 };
 
 
+/* A put_message can deliver the message to many users of this server. Each recipient carries the
+channel wrapped for the recipient, the channel info and the message are only sent once:
+<put_message channel="">
+	<recipient server_user=""><channel/></recipient>
+	<recipient server_user=""><channel/></recipient>
+	<channel_info/>
+	<message/>
+</put_message>
+*/
+class RecipientStanzaHandler extends InStanzaHandler {
+	private $recipients = array();
+	private $channelStanzaHandler;
+
+	public function __construct() {
+		InStanzaHandler::__construct(MessageConst::$kRecipientStanza);
+		$this->channelStanzaHandler = new SignedPackageStanzaHandler(new SignedPackage(),
+			MessageConst::$kChannelStanza);
+		// optional, the recipient may already know the channel
+		$this->addChild($this->channelStanzaHandler, true);
+	}
+
+	public function handleStanza($xml) {
+		$serverUser = $xml->getAttribute("server_user");
+		if ($serverUser == "")
+			return false;
+		// the channel of this recipient is read into a new package
+		$channel = new SignedPackage();
+		$this->channelStanzaHandler->setPackage($channel);
+		$this->recipients[] = array("serverUser" => $serverUser, "channel" => $channel);
+		return true;
+	}
+
+	public function getRecipients() {
+		return $this->recipients;
+	}
+}
+
+
 class MessageStanzaHandler extends InStanzaHandler {
 	private $inStreamReader;
 	private $lastErrorMessage = "";
@@ -43,6 +86,7 @@ class MessageStanzaHandler extends InStanzaHandler {
 	private $messageStanzaHandler;
 	private $channelStanzaHandler;
 	private $channelInfoStanzaHandler;
+	private $recipientStanzaHandler;
 	
 	public function __construct($inStreamReader) {
 		InStanzaHandler::__construct(MessageConst::$kPutMessageStanza);
@@ -55,31 +99,32 @@ class MessageStanzaHandler extends InStanzaHandler {
 		$this->messageStanzaHandler = new SignedPackageStanzaHandler($this->message, MessageConst::$kMessageStanza);
 		$this->channelStanzaHandler = new SignedPackageStanzaHandler($this->messageChannel, MessageConst::$kChannelStanza);
 		$this->channelInfoStanzaHandler = new SignedPackageStanzaHandler($this->channelInfo, MessageConst::$kChannelInfoStanza);
+		$this->recipientStanzaHandler = new RecipientStanzaHandler();
 
 		$this->addChild($this->messageStanzaHandler, false);
 		// optional
 		$this->addChild($this->channelStanzaHandler, true);
 		$this->addChild($this->channelInfoStanzaHandler, true);
+		$this->addChild($this->recipientStanzaHandler, true);
 	}
 
 	public function handleStanza($xml) {
+		// a single receiver can be set directly, otherwise recipient stanzas follow
 		$this->receiver = $xml->getAttribute("server_user");
-		if ($this->receiver == "")
-			return false;
 		
 		$this->channelUid = $xml->getAttribute("channel");
 		return true;
 	}
 
-	private function putMessage() {
+	private function putMessage($receiver, $messageChannel) {
 		// login check, if not authenticated already return here
 		$roles = Session::Get()->getUserRoles();
-		if (!in_array($this->receiver.":contact_user", $roles)) {
+		if (!in_array($receiver.":contact_user", $roles)) {
 			$this->lastErrorMessage = "not authenticated";
 			return false;
 		}
 
-		$profile = Session::get()->getProfile($this->receiver);
+		$profile = Session::get()->getProfile($receiver);
 		if ($profile === null) {
 			$this->lastErrorMessage = "unable to get profile";
 			return false;
@@ -90,8 +135,8 @@ class MessageStanzaHandler extends InStanzaHandler {
 			return false;
 		}
 
-		if ($this->channelStanzaHandler->hasBeenHandled()) {
-			if (!$mailbox->addChannel($this->channelUid, $this->messageChannel)) {
+		if ($messageChannel !== null) {
+			if (!$mailbox->addChannel($this->channelUid, $messageChannel)) {
 				$this->lastErrorMessage = $mailbox->getLastErrorMessage();
 				return false;
 			}
@@ -111,13 +156,7 @@ class MessageStanzaHandler extends InStanzaHandler {
 		return $ok;
 	}
 
-	public function finished() {
-		$ok = $this->putMessage();
-
-		// produce output
-		$outStream = new ProtocolOutStream();
-		$outStream->pushStanza(new IqOutStanza(IqType::$kResult));
-
+	private function makeStatusStanza($ok) {
 		$stanza = new OutStanza(MessageConst::$kMessageStanza);
 		if ($ok)
 			$stanza->addAttribute("status", "message_received");
@@ -125,7 +164,35 @@ class MessageStanzaHandler extends InStanzaHandler {
 			$stanza->addAttribute("status", "declined");
 			$stanza->addAttribute("error", $this->lastErrorMessage);
 		}
-		$outStream->pushChildStanza($stanza);
+		return $stanza;
+	}
+
+	public function finished() {
+		// produce output
+		$outStream = new ProtocolOutStream();
+		$outStream->pushStanza(new IqOutStanza(IqType::$kResult));
+
+		if ($this->receiver != "") {
+			$messageChannel = null;
+			if ($this->channelStanzaHandler->hasBeenHandled())
+				$messageChannel = $this->messageChannel;
+			$ok = $this->putMessage($this->receiver, $messageChannel);
+			$outStream->pushChildStanza($this->makeStatusStanza($ok));
+		} else {
+			// one status per recipient
+			$outStream->pushChildStanza(new OutStanza(MessageConst::$kPutMessageStanza));
+			foreach ($this->recipientStanzaHandler->getRecipients() as $recipient) {
+				$messageChannel = null;
+				if ($recipient["channel"]->data !== null)
+					$messageChannel = $recipient["channel"];
+				$this->lastErrorMessage = "";
+				$ok = $this->putMessage($recipient["serverUser"], $messageChannel);
+				$stanza = $this->makeStatusStanza($ok);
+				$stanza->addAttribute("server_user", $recipient["serverUser"]);
+				$outStream->pushChildStanza($stanza);
+				$outStream->cdDotDot();
+			}
+		}
 
 		$this->inStreamReader->appendResponse($outStream->flush());
 	}
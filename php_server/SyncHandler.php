@@ -3,6 +3,56 @@
 include_once './XMLProtocol.php';
 
 
+// parses the space separated list of hex commits a client has
+function parseHaves($haveList) {
+	$haves = array();
+	if ($haveList === null)
+		return $haves;
+	foreach (explode(" ", $haveList) as $have) {
+		if (isSHA1Hex($have))
+			$haves[] = sha1_bin($have);
+	}
+	return $haves;
+}
+
+/*
+ * Returns the pack that brings a client from $remoteTip to the tip of the branch. Objects
+ * reachable from the $haves commits are not sent either. If $remoteTip is unknown, e.g., the
+ * client lost its sync ref, the first known have becomes the base.
+ */
+function exportBranchPack($database, $branch, $remoteTip, $haves, &$remoteTipHex, &$localTipHex) {
+	if (isSHA1Hex($remoteTip))
+		$remoteTip = sha1_bin($remoteTip);
+
+	$packManager = new PackManager($database);
+	if ($remoteTip != "" && !$packManager->hasObject($remoteTip))
+		$remoteTip = "";
+	if ($remoteTip == "") {
+		foreach ($haves as $have) {
+			if ($packManager->hasObject($have)) {
+				$remoteTip = $have;
+				break;
+			}
+		}
+	}
+	$pack = "";
+	try {
+		$localTip = $database->getTip($branch);
+		$pack = $packManager->exportPack($branch, $remoteTip, $localTip, -1, $haves);
+	} catch (Exception $e) {
+		$localTip = "";
+	}
+
+	$remoteTipHex = "";
+	if (strlen($remoteTip) == 20)
+		$remoteTipHex = sha1_hex($remoteTip);
+	$localTipHex = "";
+	if (strlen($localTip) == 20)
+		$localTipHex = sha1_hex($localTip);
+	return $pack;
+}
+
+
 class SyncPullStanzaHandler extends InStanzaHandler {
 	private $inStreamReader;
 	private $database;
@@ -21,17 +71,12 @@ class SyncPullStanzaHandler extends InStanzaHandler {
 		$remoteTip = $xml->getAttribute("base");
 		if ($branch === null || $remoteTip === null)
 			return;
-		if (isSHA1Hex($remoteTip))
-			$remoteTip = sha1_bin($remoteTip);
 
-		$packManager = new PackManager($this->database);
-		$pack = "";
-		try {
-			$localTip = $this->database->getTip($branch);
-			$pack = $packManager->exportPack($branch, $remoteTip, $localTip, -1);
-		} catch (Exception $e) {
-			$localTip = "";
-		}
+		$remoteTipHex = "";
+		$localTipHex = "";
+		$haves = parseHaves($xml->getAttribute("have"));
+		$pack = exportBranchPack($this->database, $branch, $remoteTip, $haves, $remoteTipHex,
+			$localTipHex);
 
 		// produce output
 		$outStream = new ProtocolOutStream();
@@ -39,13 +84,7 @@ class SyncPullStanzaHandler extends InStanzaHandler {
 
 		$stanza = new OutStanza("sync_pull");
 		$stanza->addAttribute("branch", $branch);
-		$localTipHex = "";
-		$remoteTipHex = "";
-		if (strlen($remoteTip) == 20)
-			$remoteTipHex = sha1_hex($remoteTip);
 		$stanza->addAttribute("base", $remoteTipHex);
-		if (strlen($localTip) == 20)
-			$localTipHex = sha1_hex($localTip);
 		$stanza->addAttribute("tip", $localTipHex);
 		$outStream->pushChildStanza($stanza);
 		
@@ -122,4 +161,150 @@ class SyncPushStanzaHandler extends InStanzaHandler {
 	}
 }
 
+
+class SyncPullBatchBranchHandler extends InStanzaHandler {
+	private $branches = array();
+
+	public function __construct() {
+		InStanzaHandler::__construct("branch");
+	}
+
+	public function handleStanza($xml) {
+		$branch = $xml->getAttribute("branch");
+		$base = $xml->getAttribute("base");
+		if ($branch === null || $base === null)
+			return false;
+		$this->branches[$branch] = array("base" => $base,
+			"haves" => parseHaves($xml->getAttribute("have")));
+		return true;
+	}
+
+	public function getBranches() {
+		return $this->branches;
+	}
+}
+
+// pull many branches in one request, the packs of all branches are sent back in one response
+class SyncPullBatchStanzaHandler extends InStanzaHandler {
+	private $inStreamReader;
+	private $database;
+	private $branchHandler;
+
+	public function __construct($inStreamReader, $database) {
+		InStanzaHandler::__construct("sync_pull_batch");
+		$this->inStreamReader = $inStreamReader;
+		$this->database = $database;
+		$this->branchHandler = new SyncPullBatchBranchHandler();
+		$this->addChild($this->branchHandler, true);
+	}
+
+	public function handleStanza($xml) {
+		return true;
+	}
+
+	public function finished() {
+		$outStream = new ProtocolOutStream();
+		$outStream->pushStanza(new IqOutStanza(IqType::$kResult));
+		$outStream->pushChildStanza(new OutStanza("sync_pull_batch"));
+
+		foreach ($this->branchHandler->getBranches() as $branch => $request) {
+			$remoteTipHex = "";
+			$localTipHex = "";
+			$pack = exportBranchPack($this->database, $branch, $request["base"], $request["haves"],
+				$remoteTipHex, $localTipHex);
+
+			$stanza = new OutStanza("branch");
+			$stanza->addAttribute("branch", $branch);
+			$stanza->addAttribute("base", $remoteTipHex);
+			$stanza->addAttribute("tip", $localTipHex);
+			$outStream->pushChildStanza($stanza);
+
+			$packStanza = new OutStanza("pack");
+			$packStanza->setText(base64_encode($pack));
+			$outStream->pushChildStanza($packStanza);
+			$outStream->cdDotDot();
+			$outStream->cdDotDot();
+		}
+
+		$this->inStreamReader->appendResponse($outStream->flush());
+	}
+}
+
+class SyncPushBatchBranchHandler extends InStanzaHandler {
+	private $database;
+	private $packHandler;
+	private $branch;
+	private $startCommit;
+	private $lastCommit;
+	private $results = array();
+
+	public function __construct($database) {
+		InStanzaHandler::__construct("branch");
+		$this->database = $database;
+		$this->packHandler = new SyncPushPackHandler();
+		$this->addChild($this->packHandler);
+	}
+
+	public function handleStanza($xml) {
+		$this->branch = $xml->getAttribute("branch");
+		$this->startCommit = $xml->getAttribute("start_commit");
+		$this->lastCommit = $xml->getAttribute("last_commit");
+		if ($this->branch === null || $this->startCommit === null || $this->lastCommit === null)
+			return false;
+		$this->packHandler->setHandled(false);
+		return true;
+	}
+
+	// called for each branch element, import the pack of this branch
+	public function finished() {
+		$packManager = new PackManager($this->database);
+		$ok = $packManager->importPack($this->branch, $this->packHandler->getPack(), $this->startCommit,
+			$this->lastCommit);
+		$tip = "";
+		if ($ok)
+			$tip = sha1_hex($this->database->getTip($this->branch));
+		$this->results[$this->branch] = array("ok" => $ok, "tip" => $tip);
+	}
+
+	public function getResults() {
+		return $this->results;
+	}
+}
+
+class SyncPushBatchStanzaHandler extends InStanzaHandler {
+	private $inStreamReader;
+	private $branchHandler;
+
+	public function __construct($inStreamReader, $database) {
+		InStanzaHandler::__construct("sync_push_batch");
+		$this->inStreamReader = $inStreamReader;
+		$this->branchHandler = new SyncPushBatchBranchHandler($database);
+		$this->addChild($this->branchHandler, true);
+	}
+
+	public function handleStanza($xml) {
+		return true;
+	}
+
+	public function finished() {
+		$outStream = new ProtocolOutStream();
+		$outStream->pushStanza(new IqOutStanza(IqType::$kResult));
+		$outStream->pushChildStanza(new OutStanza("sync_push_batch"));
+
+		foreach ($this->branchHandler->getResults() as $branch => $result) {
+			$stanza = new OutStanza("branch");
+			$stanza->addAttribute("branch", $branch);
+			if ($result["ok"]) {
+				$stanza->addAttribute("status", "ok");
+				$stanza->addAttribute("tip", $result["tip"]);
+			} else
+				$stanza->addAttribute("status", "error");
+			$outStream->pushChildStanza($stanza);
+			$outStream->cdDotDot();
+		}
+
+		$this->inStreamReader->appendResponse($outStream->flush());
+	}
+}
+
 ?>
@@ -370,12 +370,20 @@ class PackManager {
      * @param $branch (string) branch name
      * @param $commitOldest (string) start commit binary sha1
      * @param $commitLatest (string) end commit binary sha1
+     * @param $haves (array) further binary sha1 commits the receiver has
      */
-	public function exportPack($branch, $commitOldest, &$commitLatest, $type) {
+	public function exportPack($branch, $commitOldest, &$commitLatest, $type, $haves = array()) {
 		if ($commitLatest == NULL)
 			$commitLatest = $this->repository->getTip($branch);
 
-		$blobs = $this->collectMissingBlobs($commitOldest, $commitLatest, $type);
+		$commitStops = array();
+		if ($commitOldest != "")
+			$commitStops[] = $commitOldest;
+		foreach ($haves as $have) {
+			if ($have != $commitOldest && $this->hasObject($have))
+				$commitStops[] = $have;
+		}
+		$blobs = $this->collectMissingBlobs($commitStops, $commitLatest, $type);
 		return $this->packObjects($blobs);
 	}
 
@@ -465,9 +473,14 @@ class PackManager {
 		return $pack;
 	}
 
+	/*
+	 * Adds the tree and all objects below it to the set $objects (object name => true). Sub trees
+	 * that are already in the set are not visited again.
+	 */
 	private function listTreeObjects($treeName, &$objects) {
-		if (!in_array($treeName, $objects))
-			$objects[] = $treeName;
+		if (isset($objects[$treeName]))
+			return true;
+		$objects[$treeName] = true;
 		$treesQueue = array();
 		$treesQueue[] = $treeName;
 		while (true) {
@@ -477,74 +490,54 @@ class PackManager {
 			$treeObject = $this->repository->getObject($currentTree);
 			foreach ($treeObject->nodes as $node)
 			{
-				if (!in_array($node->object, $objects))
-					$objects[] = $node->object;
+				if (isset($objects[$node->object]))
+					continue;
+				$objects[$node->object] = true;
 				if ($node->is_dir)
 					$treesQueue[] = $node->object;
 			}
 		}
-		#debug
-		/*echo "List:<br>";
-		foreach ($objects as $object)
-			$this->printObject($object);*/
 		return true;
-    }
-
-	private function findMissingObjects($listOld, $listNew) {
-		$missing = array();
-
-		sort($listOld);
-		sort($listNew);
+	}
 
-		$a = $b = 0;
-		while ($a < count($listOld) || $b < count($listNew))
-		{
-			if ($a < count($listOld) && $b < count($listNew))
-				$cmp = strcmp($listOld[$a], $listNew[$b]);
-			else
-				$cmp = 0;
-			if ($b >= count($listNew) || $cmp < 0)
-			{
-				$a++;
-			}
-			else if ($a >= count($listOld) || $cmp > 0)
-			{
-				$missing[] = $listNew[$b];
-				$b++;
-			}
-			else
-			{
-				$a++;
-				$b++;
-			}
+	//! returns true if the object (binary SHA1) is in the repository
+	public function hasObject($name) {
+		try {
+			$this->repository->getRawObject($name);
+		} catch (Exception $e) {
+			return false;
 		}
+		return true;
+	}
 
-		return $missing;
-    }
-
-    /*! Collect all ancestors including the start $commit (binary SHA1).
-    */
-    private function collectAncestorCommits($commit) {
-        $handledCommits = array();
-        // list of unhandled commits
-        $commits[] = $commit;
-        while (true) {
-            $currentCommit = array_pop($commits);
-            if ($currentCommit == NULL)
-                break;
-            if (in_array($currentCommit, $handledCommits))
-                continue;
-            $handledCommits[] = $currentCommit;
+	/*! Collect all ancestors including the start $commits (binary SHA1) as set (commit => true).
+	*/
+	private function collectAncestorCommits($commits) {
+		$handledCommits = array();
+		while (true) {
+			$currentCommit = array_pop($commits);
+			if ($currentCommit == NULL)
+				break;
+			if (isset($handledCommits[$currentCommit]))
+				continue;
+			$handledCommits[$currentCommit] = true;
 
-            $commitObject = $this->repository->getObject($currentCommit);
-            $commits[] = $commitObject->parents;
-        }
+			$commitObject = $this->repository->getObject($currentCommit);
+			foreach ($commitObject->parents as $parent)
+				$commits[] = $parent;
+		}
 
-        return $handledCommits;
-    }
+		return $handledCommits;
+	}
 
-    // takes (binary SHA1)
-	private function collectMissingBlobs($commitStop, $commitLast, $type = -1) {
+	/*
+	 * Returns the objects that are reachable from $commitLast but not from the $commitStops, i.e.,
+	 * the commits the client told us it has (binary SHA1).
+	 */
+	private function collectMissingBlobs($commitStops, $commitLast, $type = -1) {
+		$stops = array();
+		foreach ($commitStops as $commitStop)
+			$stops[$commitStop] = true;
 		$commits = array();
 		$newObjects = array();
 		$commits[] = $commitLast;
@@ -552,39 +545,36 @@ class PackManager {
 		$stopAncestorsCalculated = false;
 		while (count($commits) > 0) {
 			$currentCommit = array_pop($commits);
-			if ($currentCommit == $commitStop)
+			if (isset($stops[$currentCommit]))
 				continue;
-			if (in_array($currentCommit, $newObjects))
+			if (isset($newObjects[$currentCommit]))
 				continue;
-			$newObjects[] = $currentCommit;
+			$newObjects[$currentCommit] = true;
 
 			// collect tree objects
 			$commitObject = $this->repository->getObject($currentCommit);
 			$this->listTreeObjects($commitObject->tree, $newObjects);
 
 			$parents = $commitObject->parents;
-            if (!$stopAncestorsCalculated && count($parents) > 1) {
-                $stopAncestorCommits = $this->collectAncestorCommits($commitStop);
-                $stopAncestorsCalculated = true;
-            }
+			if (!$stopAncestorsCalculated && count($parents) > 1) {
+				$stopAncestorCommits = $this->collectAncestorCommits($commitStops);
+				$stopAncestorsCalculated = true;
+			}
 			foreach ($parents as $parent) {
-				if (!in_array($parent, $stopAncestorCommits))
+				if (!isset($stopAncestorCommits[$parent]))
 					$commits[] = $parent;
 			}
 		}
 
-		// get stop commit object tree
+		// get the objects the client already has
 		$stopCommitObjects = array();
-		if ($commitStop != "") {
+		foreach ($commitStops as $commitStop) {
 			$stopCommitObject = $this->repository->getObject($commitStop);
-			if ($stopCommitObject === NULL)
-				return array();
-			
 			$this->listTreeObjects($stopCommitObject->tree, $stopCommitObjects);
 		}
 
 		// calculate the missing objects
-		return $this->findMissingObjects($stopCommitObjects, $newObjects);
+		return array_keys(array_diff_key($newObjects, $stopCommitObjects));
 	}
     /*
     // takes (binary SHA1)
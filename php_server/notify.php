@@ -0,0 +1,112 @@
+<?php
+
+/*
+ * Push channel for branch tip changes using server-sent events. After opening, the current tips of
+ * all branches are sent. Afterwards an event is sent as soon as a tip changes:
+ *
+ * event: tip
+ * data: branch tip
+ */
+
+session_start();
+
+include_once 'Session.php';
+include_once 'XMLProtocol.php';
+
+
+class NotifyConst {
+	static public $kKeepAliveInterval = 25;
+	static public $kMaxLifeTime = 1800;
+	// only used when inotify is not available
+	static public $kPollInterval = 200000;
+};
+
+
+function readBranchTips($database, $headsDir) {
+	clearstatcache();
+	$tips = array();
+	foreach (new DirectoryIterator($headsDir) as $file) {
+		if ($file->isDot() || $file->isDir())
+			continue;
+		$branch = $file->getFilename();
+		try {
+			$tips[$branch] = sha1_hex($database->getTip($branch));
+		} catch (Exception $e) {
+		}
+	}
+	return $tips;
+}
+
+function sendEvent($event, $data) {
+	echo "event: ".$event."\ndata: ".$data."\n\n";
+	flush();
+}
+
+function sendKeepAlive() {
+	echo ": keep alive\n\n";
+	flush();
+}
+
+
+$roles = Session::get()->getUserRoles();
+if (!in_array("account", $roles)) {
+	header("HTTP/1.0 403 Forbidden");
+	die();
+}
+$database = Session::get()->getDatabase(Session::get()->getAccountUser());
+if ($database === null) {
+	header("HTTP/1.0 404 Not Found");
+	die();
+}
+// don't block other requests of the same session
+session_write_close();
+
+set_time_limit(0);
+header("Content-Type: text/event-stream");
+header("Cache-Control: no-cache");
+// ask proxies not to buffer the stream
+header("X-Accel-Buffering: no");
+while (ob_get_level() > 0)
+	ob_end_flush();
+
+$headsDir = $database->dir."/refs/heads";
+
+$inotify = null;
+if (function_exists('inotify_init')) {
+	$inotify = inotify_init();
+	inotify_add_watch($inotify, $headsDir, IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_DELETE);
+}
+
+$tips = array();
+$startTime = time();
+$lastSend = time();
+while (!connection_aborted() && time() - $startTime < NotifyConst::$kMaxLifeTime) {
+	$currentTips = readBranchTips($database, $headsDir);
+	foreach ($currentTips as $branch => $tip) {
+		if (isset($tips[$branch]) && $tips[$branch] == $tip)
+			continue;
+		sendEvent("tip", $branch." ".$tip);
+		$lastSend = time();
+	}
+	$tips = $currentTips;
+
+	if (time() - $lastSend >= NotifyConst::$kKeepAliveInterval) {
+		sendKeepAlive();
+		$lastSend = time();
+	}
+
+	// wait for the next change
+	if ($inotify !== null) {
+		$read = array($inotify);
+		$write = null;
+		$except = null;
+		if (stream_select($read, $write, $except, NotifyConst::$kKeepAliveInterval) > 0)
+			inotify_read($inotify);
+	} else
+		usleep(NotifyConst::$kPollInterval);
+}
+
+if ($inotify !== null)
+	fclose($inotify);
+
+?>
@@ -5,6 +5,7 @@ session_start();
 include_once 'Crypt/DiffieHellman.php';
 include_once 'phpseclib0.3.5/Crypt/AES.php';
 
+include_once 'Compression.php';
 include_once 'InitHandlers.php';
 include_once 'Session.php';
 include_once 'XMLProtocol.php'; 
@@ -31,14 +32,16 @@ class PlainTextPortal implements IPortalInterface{
 class EncryptedPortal implements IPortalInterface{
 	private $fKey;
 	private $fIV;
+	private $fCompressed;
 
-	public function __construct($key, $iv) {
+	public function __construct($key, $iv, $compressed = false) {
 		$this->fAES = new Crypt_AES(CRYPT_AES_MODE_CBC);
 		$this->fAES->setKeyLength(128);
 		$this->fAES->setKey($key);
 		$this->fAES->setIV($iv);
 		$this->fKey = $key;
 		$this->fIV = $iv;
+		$this->fCompressed = $compressed;
 	}
 
 	public function receiveData($data)
@@ -46,10 +49,16 @@ class EncryptedPortal implements IPortalInterface{
 		$data = str_replace(" ", "+", $data);
 		$this->fAES->setKey($this->fKey);
 		$this->fAES->setIV($this->fIV);
-		return $this->fAES->decrypt(base64_decode($data));
+		$data = $this->fAES->decrypt(base64_decode($data));
+		// data is compressed before it is encrypted
+		if ($this->fCompressed)
+			$data = ProtocolCompression::decompress($data);
+		return $data;
 	}
 
     public function sendData($data) {
+		if ($this->fCompressed)
+			$data = ProtocolCompression::compress($data);
 		$this->fAES->setKey($this->fKey);
 		$this->fAES->setIV($this->fIV);
 		return $this->fAES->encrypt($data);
@@ -110,6 +119,12 @@ if ($request == "neqotiate_dh_key") {
 	$stanza->addAttribute("dh_prime", $_POST['dh_prime']);
 	$stanza->addAttribute("dh_base", $_POST['dh_base']);
 	$stanza->addAttribute("dh_public_key", $dh->getPublicKey());
+	unset($_SESSION['compression']);
+	if (!empty($_POST['compression']) && $_POST['compression'] == ProtocolCompression::$kName
+		&& ProtocolCompression::isSupported()) {
+		$_SESSION['compression'] = ProtocolCompression::$kName;
+		$stanza->addAttribute("compression", ProtocolCompression::$kName);
+	}
 	$outStream->pushStanza($stanza);
 	writeToOutput($outStream->flush());
 /* DEBUG
@@ -127,13 +142,18 @@ if ($request == "neqotiate_dh_key") {
 
 // check if we use an encrypted connection and set portal accordantly
 if (isset($_SESSION['dh_private_key']) && isset($_SESSION['encrypt_iv']))
-	$gPortal = new EncryptedPortal(base64_decode($_SESSION['dh_private_key']), base64_decode($_SESSION['encrypt_iv']));
+	$gPortal = new EncryptedPortal(base64_decode($_SESSION['dh_private_key']), base64_decode($_SESSION['encrypt_iv']),
+		isset($_SESSION['compression']));
 // TODO enable again
 /*else {
 	writeToOutput("php encryption required");
 	finished();
 }*/
 
+// plain connections use HTTP level compression, the client accepts gzip transparently
+if ($gPortal instanceof PlainTextPortal)
+	ini_set("zlib.output_compression", "On");
+
 // get data
 $request = $gPortal->receiveData($request);
 
@@ -7,6 +7,25 @@
 
 typedef QByteArray SecureArray;
 
+/*! Keyed symmetric cipher that processes a message in chunks. The key schedule is done once when
+the context is created, restart() begins a new message with the given IV. */
+class SymmetricCipherContext
+{
+public:
+    enum Direction {
+        kEncrypt,
+        kDecrypt
+    };
+
+    virtual ~SymmetricCipherContext() {}
+
+    virtual void restart(const QByteArray &iv) = 0;
+    //! Appends all output that can be produced so far to output.
+    virtual WP::err update(const QByteArray &input, QByteArray &output) = 0;
+    //! Ends the message, i.e. adds or checks and removes the padding.
+    virtual WP::err finish(QByteArray &output) = 0;
+};
+
 class CryptoInterface
 {
 public:
@@ -29,6 +48,10 @@ public:
     virtual WP::err decryptSymmetric(const QByteArray &input, SecureArray &decrypted,
                              const SecureArray &key, const QByteArray &iv,
                              const char *algo = "aes256") = 0;
+    //! The caller takes ownership, returns NULL if the key or the algorithm is not valid.
+    virtual SymmetricCipherContext *createSymmetricCipher(const SecureArray &key, const QByteArray &iv,
+                                                          SymmetricCipherContext::Direction direction,
+                                                          const char *algo = "aes256") = 0;
 
     virtual WP::err encyrptAsymmetric(const QByteArray &input, QByteArray &encrypted, const QString& certificate) = 0;
     virtual WP::err decryptAsymmetric(const QByteArray &input, QByteArray &plain, const QString &privateKey,
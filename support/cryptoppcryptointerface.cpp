@@ -14,6 +14,74 @@
 using namespace CryptoPP;
 
 
+class CryptoPPCipherContext : public SymmetricCipherContext
+{
+public:
+    CryptoPPCipherContext(SymmetricCipher *cipher) :
+        cipher(cipher),
+        filter(NULL)
+    {
+    }
+
+    ~CryptoPPCipherContext()
+    {
+        delete filter;
+        delete cipher;
+    }
+
+    void restart(const QByteArray &iv)
+    {
+        delete filter;
+        sink.clear();
+        cipher->Resynchronize((const byte*)iv.data(), iv.size());
+        filter = new StreamTransformationFilter(*cipher, new StringSink(sink));
+    }
+
+    WP::err update(const QByteArray &input, QByteArray &output)
+    {
+        if (filter == NULL)
+            return WP::kNotInit;
+        try {
+            filter->Put((const byte*)input.data(), input.size());
+        } catch (Exception& e) {
+            qDebug() << "CryptoPPCipherContext::update: CryptoPP::Exception caught: "<< e.what() << endl;
+            return WP::kError;
+        }
+        takeOutput(output);
+        return WP::kOk;
+    }
+
+    WP::err finish(QByteArray &output)
+    {
+        if (filter == NULL)
+            return WP::kNotInit;
+        WP::err error = WP::kOk;
+        try {
+            filter->MessageEnd();
+            takeOutput(output);
+        } catch (Exception& e) {
+            qDebug() << "CryptoPPCipherContext::finish: CryptoPP::Exception caught: "<< e.what() << endl;
+            error = WP::kBadKey;
+        }
+        delete filter;
+        filter = NULL;
+        sink.clear();
+        return error;
+    }
+
+private:
+    void takeOutput(QByteArray &output)
+    {
+        output.append(sink.data(), sink.size());
+        sink.clear();
+    }
+
+    SymmetricCipher *cipher;
+    StreamTransformationFilter *filter;
+    std::string sink;
+};
+
+
 CryptoPPCryptoInterface::~CryptoPPCryptoInterface()
 {
 }
@@ -131,6 +199,26 @@ WP::err CryptoPPCryptoInterface::decryptSymmetric(const QByteArray &input, Secur
     return WP::kOk;
 }
 
+SymmetricCipherContext *CryptoPPCryptoInterface::createSymmetricCipher(
+        const SecureArray &key, const QByteArray &iv, SymmetricCipherContext::Direction direction,
+        const char *algo)
+{
+    SymmetricCipher *cipher = NULL;
+    try {
+        if (direction == SymmetricCipherContext::kEncrypt)
+            cipher = new CBC_Mode<AES>::Encryption((byte*)key.data(), key.size(), (byte*)iv.data());
+        else
+            cipher = new CBC_Mode<AES>::Decryption((byte*)key.data(), key.size(), (byte*)iv.data());
+    } catch (Exception& e) {
+        qDebug() << "createSymmetricCipher: CryptoPP::Exception caught: "<< e.what() << endl;
+        return NULL;
+    }
+
+    CryptoPPCipherContext *context = new CryptoPPCipherContext(cipher);
+    context->restart(iv);
+    return context;
+}
+
 WP::err CryptoPPCryptoInterface::encyrptAsymmetric(const QByteArray &input, QByteArray &encrypted, const QString &certificate)
 {
     QByteArray derPublicKey = convertPEMToDER(certificate);
@@ -27,6 +27,9 @@ public:
     WP::err decryptSymmetric(const QByteArray &input, SecureArray &decrypted,
                              const SecureArray &key, const QByteArray &iv,
                              const char *algo = "aes256");
+    SymmetricCipherContext *createSymmetricCipher(const SecureArray &key, const QByteArray &iv,
+                                                  SymmetricCipherContext::Direction direction,
+                                                  const char *algo = "aes256");
 
     WP::err encyrptAsymmetric(const QByteArray &input, QByteArray &encrypted, const QString& certificate);
     WP::err decryptAsymmetric(const QByteArray &input, QByteArray &plain, const QString &privateKey,
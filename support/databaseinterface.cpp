@@ -27,6 +27,16 @@ DatabaseInterface::DatabaseInterface(QObject *parent) :
 
 }
 
+void DatabaseInterface::setMergePolicy(const MergePolicy &policy)
+{
+    mergePolicy = policy;
+}
+
+const MergePolicy &DatabaseInterface::getMergePolicy() const
+{
+    return mergePolicy;
+}
+
 WP::err DatabaseInterface::write(const QString &path, const QString &data)
 {
     return write(path, data.toLatin1());
@@ -40,6 +50,55 @@ WP::err DatabaseInterface::read(const QString &path, QString &data) const
     return status;
 }
 
+WP::err DatabaseInterface::readMany(const QStringList &paths, QMap<QString, QByteArray> &data) const
+{
+    foreach (const QString &path, paths) {
+        QByteArray fileData;
+        if (read(path, fileData) != WP::kOk)
+            continue;
+        data[path] = fileData;
+    }
+    return WP::kOk;
+}
+
+
+MergePolicy::MergePolicy(Strategy defaultStrategy) :
+    defaultStrategy(defaultStrategy)
+{
+}
+
+void MergePolicy::addRule(const QString &pattern, Strategy strategy)
+{
+    Rule rule;
+    rule.pattern = pattern.split("/", QString::SkipEmptyParts);
+    rule.strategy = strategy;
+    rules.append(rule);
+}
+
+MergePolicy::Strategy MergePolicy::strategyFor(const QString &path) const
+{
+    QStringList parts = path.split("/", QString::SkipEmptyParts);
+    Strategy strategy = defaultStrategy;
+    int bestMatch = -1;
+    foreach (const Rule &rule, rules) {
+        if (rule.pattern.count() > parts.count() || rule.pattern.count() <= bestMatch)
+            continue;
+        bool match = true;
+        for (int i = 0; i < rule.pattern.count(); i++) {
+            const QString &component = rule.pattern.at(i);
+            if (component != "*" && component != parts.at(i)) {
+                match = false;
+                break;
+            }
+        }
+        if (!match)
+            continue;
+        bestMatch = rule.pattern.count();
+        strategy = rule.strategy;
+    }
+    return strategy;
+}
+
 
 DatabaseDir::DatabaseDir(const QString &dirName) :
     directoryName(dirName)
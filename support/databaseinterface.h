@@ -3,6 +3,7 @@
 
 #include <QObject>
 #include <QByteArray>
+#include <QMap>
 #include <QString>
 #include <QStringList>
 #include <QVector>
@@ -34,6 +35,38 @@ public:
     DatabaseDir removed;
 };
 
+/*! Decides how a merge resolves a path that has been changed on both sides. Rules are path
+patterns in which a "*" component matches any single path component. A pattern also matches all
+paths below it; the most specific matching rule wins. Resolutions are symmetric, i.e., two devices
+merging the same commits get the same result.
+*/
+class MergePolicy {
+public:
+    enum Strategy {
+        //! keep entries of both sides, e.g., for content addressed data; the last change wins for files
+        kUnion,
+        //! take the entry from the side whose last change to it has the newer commit time
+        kLastWriterWins,
+        //! like kUnion but a merge never deletes an entry, e.g., keys
+        kKeepAll
+    };
+
+    MergePolicy(Strategy defaultStrategy = kLastWriterWins);
+
+    void addRule(const QString &pattern, Strategy strategy);
+    Strategy strategyFor(const QString &path) const;
+
+private:
+    class Rule {
+    public:
+        QStringList pattern;
+        Strategy strategy;
+    };
+
+    Strategy defaultStrategy;
+    QList<Rule> rules;
+};
+
 class DatabaseInterface : public QObject {
     Q_OBJECT
 public:
@@ -55,12 +88,19 @@ public:
 
     virtual WP::err read(const QString& path, QByteArray& data) const = 0;
     virtual WP::err read(const QString& path, QString& data) const;
+    /*! Reads all files in paths in one go. Missing files are not added to data, i.e., the caller
+    has to check for the files it needs. */
+    virtual WP::err readMany(const QStringList &paths, QMap<QString, QByteArray> &data) const;
+    //! reads all files below prefix; the keys in data are relative to prefix
+    virtual WP::err readTree(const QString &prefix, QMap<QString, QByteArray> &data) const = 0;
 
     virtual QStringList listFiles(const QString &path) const = 0;
     virtual QStringList listDirectories(const QString &path) const = 0;
 
     virtual QString getTip() const = 0;
     virtual WP::err updateTip(const QString &commit) = 0;
+    //! the newest commits of the branch, newest first
+    virtual QStringList getRecentCommits(int count) const = 0;
 
     // sync
     virtual QString getLastSyncCommit(const QString remoteName, const QString &remoteBranch) const = 0;
@@ -68,12 +108,18 @@ public:
     virtual WP::err exportPack(QByteArray &pack, const QString &startCommit, const QString &endCommit, const QString &ignoreCommit, int format = -1) const = 0;
     //! import pack, tries to merge and update the tip
     virtual WP::err importPack(const QByteArray &pack, const QString &baseCommit, const QString &endCommit, int format = -1) = 0;
+    //! policy used to resolve conflicts when importPack has to merge
+    void setMergePolicy(const MergePolicy &policy);
+    const MergePolicy &getMergePolicy() const;
 
     // diff
     virtual WP::err getDiff(const QString &baseCommit, const QString &endCommit, DatabaseDiff &diff) = 0;
 
 signals:
     void newCommits(const QString &startCommit, const QString &endCommit);
+
+private:
+    MergePolicy mergePolicy;
 };
 
 
@@ -1,5 +1,7 @@
 #include "databaseutil.h"
 
+#include <QFile>
+#include <QSaveFile>
 #include <QStringList>
 #include <QTextStream>
 #include <QUuid>
@@ -25,6 +27,22 @@ const char *kPathCertificate = "certificate";
 
 const char *kPathUniqueId = "uid";
 
+
+WP::err writeFileAtomically(const QString &fileName, const QByteArray &data)
+{
+    // QSaveFile writes to a temporary file and renames it over the target on commit
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return WP::kError;
+    if (file.write(data) != data.size()) {
+        file.cancelWriting();
+        return WP::kError;
+    }
+    if (!file.commit())
+        return WP::kError;
+    return WP::kOk;
+}
+
 UserData::UserData() :
     database(NULL)
 {
@@ -73,6 +91,28 @@ WP::err UserData::read(const QString &path, QString &data) const
     return database->read(prependBaseDir(path), data);
 }
 
+WP::err UserData::readMany(const QStringList &paths, QMap<QString, QByteArray> &data) const
+{
+    QStringList fullPaths;
+    foreach (const QString &path, paths)
+        fullPaths.append(prependBaseDir(path));
+    QMap<QString, QByteArray> fullData;
+    WP::err error = database->readMany(fullPaths, fullData);
+    if (error != WP::kOk)
+        return error;
+    for (int i = 0; i < paths.count(); i++) {
+        QMap<QString, QByteArray>::const_iterator it = fullData.find(fullPaths.at(i));
+        if (it != fullData.end())
+            data[paths.at(i)] = it.value();
+    }
+    return WP::kOk;
+}
+
+WP::err UserData::readTree(const QString &path, QMap<QString, QByteArray> &data) const
+{
+    return database->readTree(prependBaseDir(path), data);
+}
+
 WP::err UserData::remove(const QString &path)
 {
     return database->remove(prependBaseDir(path));
@@ -147,34 +187,26 @@ KeyStore::KeyStore(DatabaseBranch *branch, const QString &baseDir)
 
 WP::err KeyStore::open(const SecureArray &password)
 {
-    // write master password (master password is encrypted
-    QByteArray encryptedMasterKey;
-    WP::err error = read(kPathMasterKey, encryptedMasterKey);
-    if (error != WP::kOk)
-        return error;
-    error = read(kPathMasterKeyIV, masterKeyIV);
-    if (error != WP::kOk)
-        return error;
-    QByteArray kdfName;
-    error = read(kPathMasterPasswordKDF, kdfName);
-    if (error != WP::kOk)
-        return error;
-    QByteArray algoName;
-    error = read(kPathMasterPasswordAlgo, algoName);
-    if (error != WP::kOk)
-        return error;
-    QByteArray salt;
-    error = read(kPathMasterPasswordSalt, salt);
-    if (error != WP::kOk)
-        return error;
-    QByteArray masterPasswordSize;
-    error = read(kPathMasterPasswordSize, masterPasswordSize);
-    if (error != WP::kOk)
-        return error;
-    QByteArray masterPasswordIterations;
-    error = read(kPathMasterPasswordIterations, masterPasswordIterations);
+    QStringList paths;
+    paths << kPathMasterKey << kPathMasterKeyIV << kPathMasterPasswordKDF << kPathMasterPasswordAlgo
+          << kPathMasterPasswordSalt << kPathMasterPasswordSize << kPathMasterPasswordIterations;
+    QMap<QString, QByteArray> data;
+    WP::err error = readMany(paths, data);
     if (error != WP::kOk)
         return error;
+    foreach (const QString &path, paths) {
+        if (!data.contains(path))
+            return WP::kEntryNotFound;
+    }
+
+    // write master password (master password is encrypted
+    QByteArray encryptedMasterKey = data[kPathMasterKey];
+    masterKeyIV = data[kPathMasterKeyIV];
+    QByteArray kdfName = data[kPathMasterPasswordKDF];
+    QByteArray algoName = data[kPathMasterPasswordAlgo];
+    QByteArray salt = data[kPathMasterPasswordSalt];
+    QByteArray masterPasswordSize = data[kPathMasterPasswordSize];
+    QByteArray masterPasswordIterations = data[kPathMasterPasswordIterations];
 
     QTextStream sizeStream(masterPasswordSize);
     unsigned int keyLength;
@@ -480,6 +512,43 @@ WP::err EncryptedUserData::readSafe(const QString &path, QByteArray &data, const
     return crypto->decryptSymmetric(encrypted, data, key, iv);
 }
 
+WP::err EncryptedUserData::encrypt(const QByteArray &data, QByteArray &encrypted) const
+{
+    SecureArray key;
+    QByteArray iv;
+    WP::err error = keyStore->readSymmetricKey(defaultKeyId, key, iv);
+    if (error != WP::kOk)
+        return error;
+    return crypto->encryptSymmetric(data, encrypted, key, iv);
+}
+
+WP::err EncryptedUserData::decrypt(const QByteArray &encrypted, QByteArray &data) const
+{
+    SecureArray key;
+    QByteArray iv;
+    WP::err error = keyStore->readSymmetricKey(defaultKeyId, key, iv);
+    if (error != WP::kOk)
+        return error;
+    return crypto->decryptSymmetric(encrypted, data, key, iv);
+}
+
+WP::err EncryptedUserData::writeSafeFile(const QString &fileName, const QByteArray &data) const
+{
+    QByteArray encrypted;
+    WP::err error = encrypt(data, encrypted);
+    if (error != WP::kOk)
+        return error;
+    return writeFileAtomically(fileName, encrypted);
+}
+
+WP::err EncryptedUserData::readSafeFile(const QString &fileName, QByteArray &data) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return WP::kEntryNotFound;
+    return decrypt(file.readAll(), data);
+}
+
 WP::err EncryptedUserData::create(const QString &uid, KeyStore *keyStore, const QString defaultKeyId,
                                   bool addUidToBaseDir)
 {
@@ -550,6 +619,28 @@ WP::err StorageDirectory::read(const QString &path, QString &data) const
     return database->read(directory + "/" + path, data);
 }
 
+WP::err StorageDirectory::readMany(const QStringList &paths, QMap<QString, QByteArray> &data) const
+{
+    QStringList fullPaths;
+    foreach (const QString &path, paths)
+        fullPaths.append(directory + "/" + path);
+    QMap<QString, QByteArray> fullData;
+    WP::err error = database->readMany(fullPaths, fullData);
+    if (error != WP::kOk)
+        return error;
+    for (int i = 0; i < paths.count(); i++) {
+        QMap<QString, QByteArray>::const_iterator it = fullData.find(fullPaths.at(i));
+        if (it != fullData.end())
+            data[paths.at(i)] = it.value();
+    }
+    return WP::kOk;
+}
+
+WP::err StorageDirectory::readTree(const QString &path, QMap<QString, QByteArray> &data) const
+{
+    return database->readTree(directory + "/" + path, data);
+}
+
 WP::err StorageDirectory::writeSafe(const QString &path, const QString &data)
 {
     return database->writeSafe(directory + "/" + path, data);
@@ -13,6 +13,9 @@
 
 class EncryptedUserData;
 
+//! replaces fileName with data; after a crash the file is either the old or the new one
+WP::err writeFileAtomically(const QString &fileName, const QByteArray &data);
+
 class StorageDirectory {
 public:
     StorageDirectory(EncryptedUserData *database, const QString &directory);
@@ -24,6 +27,8 @@ public:
     WP::err write(const QString& path, const QString& data);
     WP::err read(const QString& path, QByteArray& data) const;
     WP::err read(const QString& path, QString& data) const;
+    WP::err readMany(const QStringList &paths, QMap<QString, QByteArray> &data) const;
+    WP::err readTree(const QString &path, QMap<QString, QByteArray> &data) const;
     WP::err writeSafe(const QString& path, const QString& data);
     WP::err writeSafe(const QString& path, const QByteArray& data);
     WP::err writeSafe(const QString& path, const QByteArray& data, const QString &keyId);
@@ -85,6 +90,9 @@ public:
     WP::err write(const QString& path, const QString& data);
     WP::err read(const QString& path, QByteArray& data) const;
     WP::err read(const QString& path, QString& data) const;
+    //! the keys in data are the paths as passed in
+    WP::err readMany(const QStringList &paths, QMap<QString, QByteArray> &data) const;
+    WP::err readTree(const QString &path, QMap<QString, QByteArray> &data) const;
     WP::err remove(const QString& path);
 
     QStringList listDirectories(const QString &path) const;
@@ -171,6 +179,12 @@ public:
     WP::err writeSafe(const QString& path, const QByteArray& data, const QString &keyId);
     WP::err readSafe(const QString& path, QString& data, const QString &keyId) const;
     WP::err readSafe(const QString& path, QByteArray& data, const QString &keyId) const;
+    //! encrypts with the default key, e.g., for data that is stored outside of the database
+    WP::err encrypt(const QByteArray &data, QByteArray &encrypted) const;
+    WP::err decrypt(const QByteArray &encrypted, QByteArray &data) const;
+    //! encrypted files outside of the database, e.g., local indices
+    WP::err writeSafeFile(const QString &fileName, const QByteArray &data) const;
+    WP::err readSafeFile(const QString &fileName, QByteArray &data) const;
 
 protected:
     virtual WP::err create(const QString &uid, KeyStore *keyStore, const QString defaultKeyId,
@@ -3,8 +3,33 @@
 #include <QCryptographicHash>
 #include <QDir>
 #include <QFile>
+#include <QMutex>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QSet>
 #include <QSharedPointer>
+#include <QtAlgorithms>
 #include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "logger.h"
+#include "repositorymaintenance.h"
+
+//! location of an object in a pack
+class PackEntry {
+public:
+    QString hash;
+    int start;
+    int size;
+};
 
 class PackManager {
 public:
@@ -15,21 +40,52 @@ public:
 
 private:
     int readTill(const QByteArray &in, QString &out, int start, char stopChar);
+    //! splits the pack into its objects, fails if the framing is broken
+    WP::err readPackEntries(const QByteArray &data, QList<PackEntry> &entries);
+    /*! Inflates and hashes all objects using the thread pool. On failure badObject is the oid of
+    a corrupt object. */
+    WP::err verifyObjects(const QByteArray &data, const QList<PackEntry> &entries,
+                          QString &badObject) const;
 
-    void findMissingObjects(QList<QString> &listOld, QList<QString> &listNew, QList<QString> &missing) const;
     //! Collect all ancestors including the start $commit.
-    WP::err collectAncestorCommits(const QString &commit, QList<QString> &ancestors) const;
+    WP::err collectAncestorCommits(const QString &commit, QSet<QString> &ancestors) const;
     WP::err collectMissingBlobs(const QString &commitStop, const QString &commitLast, const QString &ignoreCommit, QList<QString> &blobs, int type = -1) const;
     WP::err packObjects(const QList<QString> &objects, QByteArray &out) const;
-    WP::err listTreeObjects(const git_oid *treeId, QList<QString> &objects) const;
+    /*! Adds the tree and all objects below it to objects. Sub trees that are already in objects
+    are not visited again. */
+    WP::err listTreeObjects(const git_oid *treeId, QSet<QString> &objects) const;
 
     WP::err mergeBranches(const QString &baseCommit, const QString &ours, const QString &theirs, QString &merge);
-
-    WP::err mergeCommit(const git_oid *treeOid, git_commit *parent1, git_commit *parent2);
+    /*! Three-way merge of the trees ours and theirs. Only sub trees that differ are visited. base
+    can be NULL if there is no common ancestor. Conflicts are resolved using the merge policy of
+    the database; path is the directory of the trees. */
+    WP::err mergeTrees(const QString &path, const git_tree *base, const git_tree *ours,
+                       const git_tree *theirs, git_oid *out);
+    WP::err mergeTreeEntry(git_treebuilder *builder, const QString &path, const char *name,
+                           const git_tree_entry *baseEntry, const git_tree_entry *ourEntry,
+                           const git_tree_entry *theirEntry, bool &changed);
+    /*! Entry of the side that changed path last, see lastChangeTime(). If both changes have the
+    same time the bigger oid wins. */
+    const git_tree_entry *selectNewerEntry(const QString &path, const git_tree_entry *ourEntry,
+                                           const git_tree_entry *theirEntry) const;
+    /*! Time of the newest commit between the merge base and tip that changed path, i.e., the
+    entry differs from the entries in all parents. Returns the time of tip if there is none. */
+    git_time_t lastChangeTime(const git_oid *tip, git_time_t tipTime, const QString &path) const;
+
+    WP::err mergeCommit(const git_oid *treeOid, git_commit *parent1, git_commit *parent2,
+                        QString &merge);
 private:
     GitInterface *database;
     git_repository *repository;
     git_odb *objectDatabase;
+
+    // the branches being merged
+    git_oid oursOid;
+    git_oid theirsOid;
+    git_time_t oursTime;
+    git_time_t theirsTime;
+    bool hasMergeBase;
+    git_oid mergeBaseOid;
 };
 
 
@@ -49,29 +105,38 @@ void oidFromQString(git_oid *oid, const QString &string)
 PackManager::PackManager(GitInterface *gitInterface, git_repository *repository, git_odb *objectDatabase) :
     database(gitInterface),
     repository(repository),
-    objectDatabase(objectDatabase)
+    objectDatabase(objectDatabase),
+    oursTime(0),
+    theirsTime(0),
+    hasMergeBase(false)
 {
 }
 
 WP::err PackManager::importPack(const QByteArray& data, const QString &base, const QString &last)
 {
-    int objectStart = 0;
-    while (objectStart < data.length()) {
-        QString hash;
-        QString size;
-        int objectEnd = objectStart;
-        objectEnd = readTill(data, hash, objectEnd, ' ');
-        objectEnd = readTill(data, size, objectEnd, '\0');
-        int blobStart = objectEnd;
-        objectEnd += size.toInt();
+    QList<PackEntry> entries;
+    WP::err error = readPackEntries(data, entries);
+    if (error != WP::kOk) {
+        Log::error("importPack: malformed pack");
+        return error;
+    }
+    // don't let a corrupt object into the database
+    QString badObject;
+    error = verifyObjects(data, entries, badObject);
+    if (error != WP::kOk) {
+        Log::error("importPack: corrupt object " + badObject);
+        return error;
+    }
 
-        const char* dataPointer = data.data() + blobStart;
-        WP::err error = database->writeFile(hash, dataPointer, objectEnd - blobStart);
+    foreach (const PackEntry &entry, entries) {
+        error = database->writeFile(entry.hash, data.data() + entry.start, entry.size);
         if (error != WP::kOk)
             return error;
-
-        objectStart = objectEnd;
     }
+    // the objects have to be on disk before the tip points to them
+    error = database->syncObjects();
+    if (error != WP::kOk)
+        return error;
 
     QString currentTip = database->getTip();
     QString newTip = last;
@@ -84,6 +149,29 @@ WP::err PackManager::importPack(const QByteArray& data, const QString &base, con
     return database->updateTip(newTip);
 }
 
+WP::err PackManager::readPackEntries(const QByteArray &data, QList<PackEntry> &entries)
+{
+    int objectStart = 0;
+    while (objectStart < data.length()) {
+        PackEntry entry;
+        QString size;
+        int objectEnd = objectStart;
+        objectEnd = readTill(data, entry.hash, objectEnd, ' ');
+        objectEnd = readTill(data, size, objectEnd, '\0');
+        if (objectEnd > data.length() || entry.hash.length() != GIT_OID_HEXSZ)
+            return WP::kBadValue;
+        bool ok = false;
+        entry.size = size.toInt(&ok);
+        if (!ok || entry.size < 0 || entry.size > data.length() - objectEnd)
+            return WP::kBadValue;
+        entry.start = objectEnd;
+        entries.append(entry);
+
+        objectStart = objectEnd + entry.size;
+    }
+    return WP::kOk;
+}
+
 int PackManager::readTill(const QByteArray& in, QString &out, int start, char stopChar)
 {
     int pos = start;
@@ -95,39 +183,14 @@ int PackManager::readTill(const QByteArray& in, QString &out, int start, char st
     return pos;
 }
 
-void PackManager::findMissingObjects(QList<QString> &listOld, QList<QString>& listNew, QList<QString> &missing) const
-{
-    qSort(listOld.begin(), listOld.end());
-    qSort(listNew.begin(), listNew.end());
-
-    int a = 0;
-    int b = 0;
-    while (a < listOld.count() || b < listNew.count()) {
-        int cmp;
-        if (a < listOld.count() && b < listNew.count())
-            cmp = listOld[a].compare(listNew[b]);
-        else
-            cmp = 0;
-        if (b >= listNew.count() || cmp < 0)
-            a++;
-        else if (a >= listOld.count() || cmp > 0) {
-            missing.append(listNew[b]);
-            b++;
-        } else {
-            a++;
-            b++;
-        }
-    }
-}
-
-WP::err PackManager::collectAncestorCommits(const QString &commit, QList<QString> &ancestors) const {
+WP::err PackManager::collectAncestorCommits(const QString &commit, QSet<QString> &ancestors) const {
     QList<QString> commits;
     commits.append(commit);
     while (commits.count() > 0) {
         QString currentCommit = commits.takeFirst();
         if (ancestors.contains(currentCommit))
             continue;
-        ancestors.append(currentCommit);
+        ancestors.insert(currentCommit);
 
         // collect parents
         git_commit *commitObject;
@@ -148,11 +211,11 @@ WP::err PackManager::collectAncestorCommits(const QString &commit, QList<QString
 
 WP::err PackManager::collectMissingBlobs(const QString &commitStop, const QString &commitLast, const QString &ignoreCommit, QList<QString> &blobs, int type) const {
     QList<QString> commits;
-    QList<QString> newObjects;
+    QSet<QString> newObjects;
     commits.append(commitLast);
-    QList<QString> stopAncestorCommits;
+    QSet<QString> stopAncestorCommits;
     if (ignoreCommit != "")
-        stopAncestorCommits.append(ignoreCommit);
+        stopAncestorCommits.insert(ignoreCommit);
     bool stopAncestorsCalculated = false;
     while (commits.count() > 0) {
         QString currentCommit = commits.takeFirst();
@@ -160,7 +223,7 @@ WP::err PackManager::collectMissingBlobs(const QString &commitStop, const QStrin
             continue;
         if (newObjects.contains(currentCommit))
             continue;
-        newObjects.append(currentCommit);
+        newObjects.insert(currentCommit);
 
         // collect tree objects
         git_commit *commitObject;
@@ -176,7 +239,7 @@ WP::err PackManager::collectMissingBlobs(const QString &commitStop, const QStrin
 
         // collect parents
         unsigned int parentCount = git_commit_parentcount(commitObject);
-        if (parentCount > 1 && !stopAncestorsCalculated) {
+        if (parentCount > 1 && !stopAncestorsCalculated && commitStop != "") {
             collectAncestorCommits(commitStop, stopAncestorCommits);
             stopAncestorsCalculated = true;
         }
@@ -192,7 +255,7 @@ WP::err PackManager::collectMissingBlobs(const QString &commitStop, const QStrin
     }
 
     // get stop commit object tree
-    QList<QString> stopCommitObjects;
+    QSet<QString> stopCommitObjects;
     if (commitStop != "") {
         git_commit *stopCommitObject;
         git_oid stopCommitOid;
@@ -206,7 +269,7 @@ WP::err PackManager::collectMissingBlobs(const QString &commitStop, const QStrin
     }
 
     // calculate the missing objects
-    findMissingObjects(stopCommitObjects, newObjects, blobs);
+    blobs = newObjects.subtract(stopCommitObjects).toList();
     return WP::kOk;
 }
 
@@ -255,6 +318,143 @@ int gzcompress(QByteArray &source, QByteArray &outArray)
     return Z_OK;
 }
 
+/*! Inflates a loose object and checks that it is complete, has a valid header and matches its
+hash. */
+static bool verifyLooseObject(const char *data, int size, const QString &hash)
+{
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    stream.next_in = (unsigned char*)data;
+    stream.avail_in = size;
+    if (inflateInit(&stream) != Z_OK)
+        return false;
+
+    QCryptographicHash sha1(QCryptographicHash::Sha1);
+    QByteArray header;
+    bool headerComplete = false;
+    qint64 bodySize = 0;
+    unsigned char out[CHUNK];
+    int status = Z_OK;
+    while (status == Z_OK) {
+        stream.avail_out = CHUNK;
+        stream.next_out = out;
+        status = inflate(&stream, Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_STREAM_END)
+            break;
+        int have = CHUNK - stream.avail_out;
+        if (have == 0 && status == Z_OK && stream.avail_in == 0) {
+            // truncated stream
+            status = Z_DATA_ERROR;
+            break;
+        }
+        sha1.addData((const char*)out, have);
+
+        int bodyStart = 0;
+        if (!headerComplete) {
+            int end = 0;
+            while (end < have && out[end] != '\0')
+                end++;
+            header.append((const char*)out, end);
+            if (end == have) {
+                // "commit 4294967295" is the longest sane header
+                if (header.size() > 32)
+                    status = Z_DATA_ERROR;
+                continue;
+            }
+            headerComplete = true;
+            bodyStart = end + 1;
+        }
+        bodySize += have - bodyStart;
+    }
+    inflateEnd(&stream);
+    // the object must use the complete data
+    if (status != Z_STREAM_END || stream.avail_in != 0 || !headerComplete)
+        return false;
+
+    QList<QByteArray> headerParts = header.split(' ');
+    if (headerParts.count() != 2)
+        return false;
+    if (git_object_string2type(headerParts.at(0).constData()) == GIT_OBJ_BAD)
+        return false;
+    bool ok = false;
+    if (headerParts.at(1).toLongLong(&ok) != bodySize || !ok)
+        return false;
+
+    return QString(sha1.result().toHex()) == hash.toLower();
+}
+
+class ObjectVerifier : public QRunnable {
+public:
+    ObjectVerifier(const QByteArray &data, const QList<PackEntry> &entries, int first, int last,
+                   QMutex *mutex, QString *badObject, QSemaphore *done) :
+        data(data),
+        entries(entries),
+        first(first),
+        last(last),
+        mutex(mutex),
+        badObject(badObject),
+        done(done)
+    {
+    }
+
+    void run()
+    {
+        for (int i = first; i < last; i++) {
+            const PackEntry &entry = entries.at(i);
+            if (verifyLooseObject(data.constData() + entry.start, entry.size, entry.hash))
+                continue;
+            QMutexLocker locker(mutex);
+            if (badObject->isEmpty())
+                *badObject = entry.hash;
+            break;
+        }
+        if (done != NULL)
+            done->release();
+    }
+
+private:
+    const QByteArray &data;
+    const QList<PackEntry> &entries;
+    int first;
+    int last;
+    QMutex *mutex;
+    QString *badObject;
+    QSemaphore *done;
+};
+
+// don't bother other threads for small packs
+const int kMinObjectsPerVerifier = 64;
+
+WP::err PackManager::verifyObjects(const QByteArray &data, const QList<PackEntry> &entries,
+                                   QString &badObject) const
+{
+    QMutex mutex;
+    QSemaphore done;
+    int nVerifiers = qMin(QThread::idealThreadCount(), entries.count() / kMinObjectsPerVerifier);
+    if (nVerifiers < 1)
+        nVerifiers = 1;
+    int chunkSize = (entries.count() + nVerifiers - 1) / nVerifiers;
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    for (int i = 1; i < nVerifiers; i++) {
+        int first = i * chunkSize;
+        int last = qMin(first + chunkSize, entries.count());
+        pool->start(new ObjectVerifier(data, entries, first, last, &mutex, &badObject, &done));
+    }
+    // the first chunk is verified in this thread
+    ObjectVerifier verifier(data, entries, 0, qMin(chunkSize, entries.count()), &mutex, &badObject,
+                            NULL);
+    verifier.setAutoDelete(false);
+    verifier.run();
+    done.acquire(nVerifiers - 1);
+
+    if (!badObject.isEmpty())
+        return WP::kBadValue;
+    return WP::kOk;
+}
+
 WP::err PackManager::packObjects(const QList<QString> &objects, QByteArray &out) const
 {
     for (int i = 0; i < objects.count(); i++) {
@@ -304,15 +504,17 @@ WP::err PackManager::exportPack(QByteArray &pack, const QString &commitOldest, c
     return packObjects(blobs, pack);
 }
 
-WP::err PackManager::listTreeObjects(const git_oid *treeId, QList<QString> &objects) const
+WP::err PackManager::listTreeObjects(const git_oid *treeId, QSet<QString> &objects) const
 {
+    // a known tree has been listed completely before
+    QString treeOidString = oidToQString(treeId);
+    if (objects.contains(treeOidString))
+        return WP::kOk;
     git_tree *tree;
     int error = git_tree_lookup(&tree, repository, treeId);
     if (error != 0)
         return WP::kError;
-    QString treeOidString = oidToQString(treeId);
-    if (!objects.contains(treeOidString))
-        objects.append(treeOidString);
+    objects.insert(treeOidString);
     QList<git_tree*> treesQueue;
     treesQueue.append(tree);
 
@@ -324,8 +526,9 @@ WP::err PackManager::listTreeObjects(const git_oid *treeId, QList<QString> &obje
         for (unsigned int i = 0; i < git_tree_entrycount(currentTree); i++) {
             const git_tree_entry *entry = git_tree_entry_byindex(currentTree, i);
             QString objectOidString = oidToQString(git_tree_entry_id(entry));
-            if (!objects.contains(objectOidString))
-                objects.append(objectOidString);
+            if (objects.contains(objectOidString))
+                continue;
+            objects.insert(objectOidString);
             if (git_tree_entry_type(entry) == GIT_OBJ_TREE) {
                 git_tree *subTree;
                 error = git_tree_lookup(&subTree, repository, git_tree_entry_id(entry));
@@ -344,63 +547,216 @@ WP::err PackManager::listTreeObjects(const git_oid *treeId, QList<QString> &obje
     return WP::kOk;
 }
 
-// copied from libgit2:
-int git_merge_commits(
-    git_index **out,
-    git_repository *repo,
-    const git_commit *our_commit,
-    const git_commit *their_commit,
-    const git_merge_tree_opts *opts)
+static bool sameTreeEntry(const git_tree_entry *entry1, const git_tree_entry *entry2)
+{
+    if (entry1 == NULL || entry2 == NULL)
+        return entry1 == entry2;
+    return git_oid_equal(git_tree_entry_id(entry1), git_tree_entry_id(entry2))
+        && git_tree_entry_filemode(entry1) == git_tree_entry_filemode(entry2);
+}
+
+//! Sets or, if entry is NULL, removes the entry name in the builder.
+static WP::err setTreeEntry(git_treebuilder *builder, const char *name, const git_tree_entry *entry)
 {
-    git_oid ancestor_oid;
-    git_commit *ancestor_commit = NULL;
-    git_tree *our_tree = NULL, *their_tree = NULL, *ancestor_tree = NULL;
-    int error = 0;
+    int error;
+    if (entry == NULL)
+        error = git_treebuilder_remove(builder, name);
+    else
+        error = git_treebuilder_insert(NULL, builder, name, git_tree_entry_id(entry),
+                                       git_tree_entry_filemode(entry));
+    if (error != 0)
+        return WP::kError;
+    return WP::kOk;
+}
 
-    if ((error = git_merge_base(&ancestor_oid, repo, git_commit_id(our_commit), git_commit_id(their_commit))) < 0 &&
-        error == GIT_ENOTFOUND)
-        giterr_clear();
-    else if (error < 0 ||
-        (error = git_commit_lookup(&ancestor_commit, repo, &ancestor_oid)) < 0 ||
-        (error = git_commit_tree(&ancestor_tree, ancestor_commit)) < 0)
-        goto done;
-
-    if ((error = git_commit_tree(&our_tree, our_commit)) < 0 ||
-        (error = git_commit_tree(&their_tree, their_commit)) < 0 ||
-        (error = git_merge_trees(out, repo, ancestor_tree, our_tree, their_tree, opts)) < 0)
-        goto done;
-
-done:
-    git_commit_free(ancestor_commit);
-    git_tree_free(our_tree);
-    git_tree_free(their_tree);
-    git_tree_free(ancestor_tree);
+WP::err PackManager::mergeTrees(const QString &path, const git_tree *base, const git_tree *ours,
+                                const git_tree *theirs, git_oid *out)
+{
+    // the result is ours plus the changes from theirs
+    git_treebuilder *builder = NULL;
+    if (git_treebuilder_create(&builder, ours) != 0)
+        return WP::kError;
 
+    WP::err error = WP::kOk;
+    bool changed = false;
+    for (unsigned int i = 0; i < git_tree_entrycount(ours) && error == WP::kOk; i++) {
+        const git_tree_entry *ourEntry = git_tree_entry_byindex(ours, i);
+        const char *name = git_tree_entry_name(ourEntry);
+        const git_tree_entry *baseEntry = (base != NULL) ? git_tree_entry_byname(base, name) : NULL;
+        const git_tree_entry *theirEntry = git_tree_entry_byname(theirs, name);
+        error = mergeTreeEntry(builder, path, name, baseEntry, ourEntry, theirEntry, changed);
+    }
+    // entries that are only in theirs
+    for (unsigned int i = 0; i < git_tree_entrycount(theirs) && error == WP::kOk; i++) {
+        const git_tree_entry *theirEntry = git_tree_entry_byindex(theirs, i);
+        const char *name = git_tree_entry_name(theirEntry);
+        if (git_tree_entry_byname(ours, name) != NULL)
+            continue;
+        const git_tree_entry *baseEntry = (base != NULL) ? git_tree_entry_byname(base, name) : NULL;
+        error = mergeTreeEntry(builder, path, name, baseEntry, NULL, theirEntry, changed);
+    }
+
+    if (error == WP::kOk) {
+        if (!changed)
+            git_oid_cpy(out, git_tree_id(ours));
+        else if (git_treebuilder_write(out, repository, builder) != 0)
+            error = WP::kError;
+        else
+            database->freshenObject(out);
+    }
+    git_treebuilder_free(builder);
     return error;
 }
 
-static git_index_entry *index_entry_dup(const git_index_entry *source_entry)
+WP::err PackManager::mergeTreeEntry(git_treebuilder *builder, const QString &path, const char *name,
+                                    const git_tree_entry *baseEntry, const git_tree_entry *ourEntry,
+                                    const git_tree_entry *theirEntry, bool &changed)
 {
-    git_index_entry *entry;
+    if (sameTreeEntry(ourEntry, theirEntry))
+        return WP::kOk;
 
-    entry = (git_index_entry*)malloc(sizeof(git_index_entry));
-    if (!entry)
-        return NULL;
+    QString entryPath = path + name;
+    MergePolicy::Strategy strategy = database->getMergePolicy().strategyFor(entryPath);
+    if (strategy == MergePolicy::kKeepAll) {
+        // a merge never deletes, no matter on which side the entry has been removed
+        if (theirEntry == NULL)
+            return WP::kOk;
+        if (ourEntry == NULL) {
+            changed = true;
+            return setTreeEntry(builder, name, theirEntry);
+        }
+    }
 
-    memcpy(entry, source_entry, sizeof(git_index_entry));
+    // only ours changed the entry
+    if (sameTreeEntry(baseEntry, theirEntry))
+        return WP::kOk;
+    // only theirs changed the entry
+    if (sameTreeEntry(baseEntry, ourEntry)) {
+        changed = true;
+        return setTreeEntry(builder, name, theirEntry);
+    }
 
-    /* duplicate the path string so we own it */
-    entry->path = strdup(source_entry->path);
-    if (!entry->path)
-        return NULL;
+    // both changed a directory, merge it
+    if (ourEntry != NULL && theirEntry != NULL && git_tree_entry_type(ourEntry) == GIT_OBJ_TREE
+            && git_tree_entry_type(theirEntry) == GIT_OBJ_TREE) {
+        git_tree *baseTree = NULL;
+        git_tree *ourTree = NULL;
+        git_tree *theirTree = NULL;
+        WP::err error = WP::kError;
+        if ((baseEntry == NULL || git_tree_entry_type(baseEntry) != GIT_OBJ_TREE
+                || git_tree_lookup(&baseTree, repository, git_tree_entry_id(baseEntry)) == 0)
+                && git_tree_lookup(&ourTree, repository, git_tree_entry_id(ourEntry)) == 0
+                && git_tree_lookup(&theirTree, repository, git_tree_entry_id(theirEntry)) == 0) {
+            git_oid mergedTree;
+            error = mergeTrees(entryPath + "/", baseTree, ourTree, theirTree, &mergedTree);
+            if (error == WP::kOk && !git_oid_equal(&mergedTree, git_tree_entry_id(ourEntry))) {
+                changed = true;
+                if (git_treebuilder_insert(NULL, builder, name, &mergedTree, GIT_FILEMODE_TREE) != 0)
+                    error = WP::kError;
+            }
+        }
+        git_tree_free(baseTree);
+        git_tree_free(ourTree);
+        git_tree_free(theirTree);
+        return error;
+    }
 
-    return entry;
+    // conflict
+    const git_tree_entry *selected;
+    if (strategy != MergePolicy::kLastWriterWins && (ourEntry == NULL || theirEntry == NULL))
+        selected = (ourEntry != NULL) ? ourEntry : theirEntry;
+    else
+        selected = selectNewerEntry(entryPath, ourEntry, theirEntry);
+    if (selected == ourEntry)
+        return WP::kOk;
+    changed = true;
+    return setTreeEntry(builder, name, selected);
+}
+
+const git_tree_entry *PackManager::selectNewerEntry(const QString &path,
+                                                    const git_tree_entry *ourEntry,
+                                                    const git_tree_entry *theirEntry) const
+{
+    // the tip times are not enough, a side might have committed something else later
+    git_time_t ourChange = lastChangeTime(&oursOid, oursTime, path);
+    git_time_t theirChange = lastChangeTime(&theirsOid, theirsTime, path);
+    if (ourChange != theirChange)
+        return (ourChange > theirChange) ? ourEntry : theirEntry;
+    // same time: prefer the entry that still exists, then the bigger oid
+    if (ourEntry == NULL || theirEntry == NULL)
+        return (ourEntry != NULL) ? ourEntry : theirEntry;
+    if (git_oid_cmp(git_tree_entry_id(ourEntry), git_tree_entry_id(theirEntry)) >= 0)
+        return ourEntry;
+    return theirEntry;
+}
+
+//! Looks up the entry at path in the tree of commit; returns false if there is none.
+static bool commitEntryAt(git_commit *commit, const QByteArray &path, git_oid *oid)
+{
+    git_tree *tree;
+    if (git_commit_tree(&tree, commit) != 0)
+        return false;
+    git_tree_entry *entry;
+    bool found = (git_tree_entry_bypath(&entry, tree, path.data()) == 0);
+    if (found) {
+        git_oid_cpy(oid, git_tree_entry_id(entry));
+        git_tree_entry_free(entry);
+    } else
+        giterr_clear();
+    git_tree_free(tree);
+    return found;
+}
+
+git_time_t PackManager::lastChangeTime(const git_oid *tip, git_time_t tipTime,
+                                       const QString &path) const
+{
+    git_revwalk *walker;
+    if (git_revwalk_new(&walker, repository) != 0)
+        return tipTime;
+    // newest first, so the first change found is the last one
+    git_revwalk_sorting(walker, GIT_SORT_TIME);
+    if (git_revwalk_push(walker, tip) != 0
+            || (hasMergeBase && git_revwalk_hide(walker, &mergeBaseOid) != 0)) {
+        git_revwalk_free(walker);
+        return tipTime;
+    }
+
+    QByteArray pathData = path.toUtf8();
+    bool found = false;
+    git_time_t changeTime = tipTime;
+    git_oid commitOid;
+    while (!found && git_revwalk_next(&commitOid, walker) == 0) {
+        git_commit *commit;
+        if (git_commit_lookup(&commit, repository, &commitOid) != 0)
+            continue;
+        git_oid entryOid;
+        bool exists = commitEntryAt(commit, pathData, &entryOid);
+        // a commit without parents changed the path if it has it
+        unsigned int parentCount = git_commit_parentcount(commit);
+        bool changed = (parentCount > 0) || exists;
+        for (unsigned int i = 0; i < parentCount && changed; i++) {
+            git_commit *parent;
+            if (git_commit_parent(&parent, commit, i) != 0)
+                continue;
+            git_oid parentEntryOid;
+            bool parentExists = commitEntryAt(parent, pathData, &parentEntryOid);
+            git_commit_free(parent);
+            if (parentExists == exists && (!exists || git_oid_equal(&parentEntryOid, &entryOid)))
+                changed = false;
+        }
+        if (changed) {
+            found = true;
+            changeTime = git_commit_time(commit);
+        }
+        git_commit_free(commit);
+    }
+    git_revwalk_free(walker);
+    giterr_clear();
+    return changeTime;
 }
 
 WP::err PackManager::mergeBranches(const QString &baseCommit, const QString &ours, const QString &theirs, QString &merge)
 {
-    git_oid oursOid;
-    git_oid theirsOid;
     int error = git_oid_fromstr(&oursOid, ours.toLatin1());
     if (error != 0)
         return WP::kBadValue;
@@ -419,106 +775,74 @@ WP::err PackManager::mergeBranches(const QString &baseCommit, const QString &our
         return WP::kEntryNotFound;
     }
 
-    // TODO: check if we could optimize since we know the base commit, i.e., use git_merge_trees
-    git_index *mergeIndex;
-    error = git_merge_commits(&mergeIndex, repository, oursCommit, theirsCommit, NULL);
-    if (error != 0)
-        return WP::kError;
-
-    // fix conflicts
-    git_index_conflict_iterator *iterator;
-    error = git_index_conflict_iterator_new(&iterator, mergeIndex);
-    if (error != 0) {
-        git_commit_free(oursCommit);
-        git_commit_free(theirsCommit);
-        git_index_free(mergeIndex);
-        return WP::kError;
-    }
-    QList<git_index_entry*> resolvedEntries;
-    while (true) {
-        const git_index_entry *ancestorOut;
-        const git_index_entry *ourOut;
-        const git_index_entry *theirOut;
-        error = git_index_conflict_next(&ancestorOut, &ourOut, &theirOut, iterator);
-        if (error == GIT_ITEROVER)
-            break;
-        if (error != 0) {
-            git_commit_free(oursCommit);
-            git_commit_free(theirsCommit);
-            git_index_conflict_iterator_free(iterator);
-            git_index_free(mergeIndex);
-            return WP::kError;
-        }
-        // solve conflict
-        const git_index_entry *selected = (ourOut != NULL) ? ourOut : theirOut;
-        if (ourOut != NULL && theirOut != NULL
-                && ourOut->mtime.nanoseconds > theirOut->mtime.nanoseconds)
-            selected = theirOut;
-
-        // duplicate the entry and remove the stage flag
-        git_index_entry *editEntry = index_entry_dup(selected);
-        editEntry->flags = (editEntry->flags & ~GIT_IDXENTRY_STAGEMASK) |
-            ((0) << GIT_IDXENTRY_STAGESHIFT);
-
-        resolvedEntries.append(editEntry);
-    }
-    git_index_conflict_iterator_free(iterator);
-
-    git_index_conflict_cleanup(mergeIndex);
-
-    // resolve index
-    foreach (git_index_entry *entry, resolvedEntries) {
-        error = git_index_add(mergeIndex, entry);
-        if (error != 0) {
-            git_commit_free(oursCommit);
-            git_commit_free(theirsCommit);
-            git_index_free(mergeIndex);
-            return WP::kError;
-        }
-
-        free(entry->path);
-        free(entry);
+    // the base is known from the sync, only search it if it is missing
+    git_oid baseOid;
+    git_commit *ancestorCommit = NULL;
+    if (baseCommit == "" || git_oid_fromstr(&baseOid, baseCommit.toLatin1()) != 0
+            || git_commit_lookup(&ancestorCommit, repository, &baseOid) != 0) {
+        ancestorCommit = NULL;
+        if (git_merge_base(&baseOid, repository, &oursOid, &theirsOid) == 0)
+            git_commit_lookup(&ancestorCommit, repository, &baseOid);
+        else
+            giterr_clear();
     }
 
-    // write new root tree
+    // without a common ancestor both sides added everything
+    git_tree *ancestorTree = NULL;
+    git_tree *oursTree = NULL;
+    git_tree *theirsTree = NULL;
     git_oid newRootTree;
-    error = git_index_write_tree_to(&newRootTree, mergeIndex, repository);
-    git_index_free(mergeIndex);
-    if (error != 0) {
-        git_commit_free(oursCommit);
-        git_commit_free(theirsCommit);
-        return WP::kError;
-    }
+    oursTime = git_commit_time(oursCommit);
+    theirsTime = git_commit_time(theirsCommit);
+    hasMergeBase = (ancestorCommit != NULL);
+    if (hasMergeBase)
+        git_oid_cpy(&mergeBaseOid, git_commit_id(ancestorCommit));
+    WP::err wpError = WP::kError;
+    if ((ancestorCommit == NULL || git_commit_tree(&ancestorTree, ancestorCommit) == 0)
+            && git_commit_tree(&oursTree, oursCommit) == 0
+            && git_commit_tree(&theirsTree, theirsCommit) == 0)
+        wpError = mergeTrees("", ancestorTree, oursTree, theirsTree, &newRootTree);
+    git_tree_free(ancestorTree);
+    git_tree_free(oursTree);
+    git_tree_free(theirsTree);
+    git_commit_free(ancestorCommit);
+
     // commit
-    WP::err wpError = mergeCommit(&newRootTree, oursCommit, theirsCommit);
+    if (wpError == WP::kOk)
+        wpError = mergeCommit(&newRootTree, oursCommit, theirsCommit, merge);
     git_commit_free(oursCommit);
     git_commit_free(theirsCommit);
-    if (wpError != WP::kOk)
-        return wpError;
-    merge = database->getTip();
-    return WP::kOk;
+    return wpError;
 }
 
-WP::err PackManager::mergeCommit(const git_oid *treeOid, git_commit *parent1, git_commit *parent2)
+WP::err PackManager::mergeCommit(const git_oid *treeOid, git_commit *parent1, git_commit *parent2,
+                                 QString &merge)
 {
     git_tree *tree;
     int error = git_tree_lookup(&tree, repository, treeOid);
     if (error != 0)
         return WP::kError;
 
-    QString refName = "refs/heads/";
-    refName += database->branch();
-
+    /* Two devices merging the same commits must end up with the same merge commit. Otherwise they
+    would merge each others merges forever. For that reason the parents are ordered by oid and the
+    commit time is taken from the parents. */
+    git_time_t commitTime = qMax(git_commit_time(parent1), git_commit_time(parent2));
     git_signature* signature;
-    git_signature_new(&signature, "PackManager", "no mail", time(NULL), 0);
+    git_signature_new(&signature, "PackManager", "no mail", commitTime, 0);
 
     git_commit *parents[2];
-    parents[0] = parent1;
-    parents[1] = parent2;
+    if (git_oid_cmp(git_commit_id(parent1), git_commit_id(parent2)) < 0) {
+        parents[0] = parent1;
+        parents[1] = parent2;
+    } else {
+        parents[0] = parent2;
+        parents[1] = parent1;
+    }
     const int nParents = 2;
 
+    // the tip is updated by the caller
     git_oid id;
-    error = git_commit_create(&id, repository, refName.toLatin1().data(), signature, signature,
+    error = git_commit_create(&id, repository, NULL, signature, signature,
                               NULL, "merge", tree, nParents, (const git_commit**)parents);
 
     git_signature_free(signature);
@@ -526,6 +850,7 @@ WP::err PackManager::mergeCommit(const git_oid *treeOid, git_commit *parent1, gi
     if (error != 0)
         return (WP::err)error;
 
+    merge = oidToQString(&id);
     return WP::kOk;
 }
 
@@ -536,7 +861,10 @@ GitInterface::GitInterface()
     :
     repository(NULL),
     objectDatabase(NULL),
-    currentBranch("master")
+    currentBranch("master"),
+    syncPolicy(kSyncPerPack),
+    unsyncedObjects(false),
+    pathIndexEnabled(true)
 {
     newRootTreeOid.id[0] = '\0';
     if (!sGitThreadsHaveBeeInit) {
@@ -569,8 +897,12 @@ WP::err GitInterface::setTo(const QString &path, bool create)
 
 void GitInterface::unSet()
 {
+    if (pathIndex.isDirty())
+        pathIndex.save(pathIndexFileName());
+    pathIndex.clear();
     git_repository_free(repository);
     git_odb_free(objectDatabase);
+    existingObjectDirs.clear();
 }
 
 QString GitInterface::path()
@@ -582,10 +914,40 @@ WP::err GitInterface::setBranch(const QString &branch, bool /*createBranch*/)
 {
     if (repository == NULL)
         return WP::kNotInit;
+    if (pathIndex.isDirty())
+        pathIndex.save(pathIndexFileName());
     currentBranch = branch;
+    // an outdated index is updated on the first read
+    if (pathIndexEnabled)
+        pathIndex.load(pathIndexFileName());
     return WP::kOk;
 }
 
+void GitInterface::setPathIndexEnabled(bool enabled)
+{
+    pathIndexEnabled = enabled;
+    if (!enabled)
+        pathIndex.clear();
+}
+
+QString GitInterface::pathIndexFileName() const
+{
+    return repositoryPath + "/fejoa_path_index_" + currentBranch;
+}
+
+const PathIndex *GitInterface::getPathIndex() const
+{
+    if (!pathIndexEnabled)
+        return NULL;
+    git_oid tipOid;
+    QString refName = "refs/heads/" + currentBranch;
+    if (git_reference_name_to_id(&tipOid, repository, refName.toLatin1().data()) != 0)
+        return NULL;
+    if (pathIndex.update(repository, oidToQString(&tipOid)) != WP::kOk)
+        return NULL;
+    return &pathIndex;
+}
+
 QString GitInterface::branch() const
 {
     return currentBranch;
@@ -600,6 +962,8 @@ WP::err GitInterface::write(const QString& path, const QByteArray &data)
     int error = git_odb_write(&oid, objectDatabase, data.data(), data.count(), GIT_OBJ_BLOB);
     if (error != WP::kOk)
         return (WP::err)error;
+    // git_odb_write skips existing objects
+    freshenObject(&oid);
     git_filemode_t fileMode = GIT_FILEMODE_BLOB;
 
     git_tree *rootTree = NULL;
@@ -645,6 +1009,7 @@ WP::err GitInterface::write(const QString& path, const QByteArray &data)
             git_tree_free(rootTree);
             return (WP::err)error;
         }
+        freshenObject(&oid);
 
         // in the folloing we write trees
         fileMode = GIT_FILEMODE_TREE;
@@ -699,6 +1064,7 @@ WP::err GitInterface::commit()
 
     newRootTreeOid.id[0] = '\0';
 
+    RepositoryMaintenance::get()->objectsWritten(repositoryPath);
     emit newCommits(oldCommit, getTip());
     return WP::kOk;
 }
@@ -709,25 +1075,39 @@ WP::err GitInterface::read(const QString &path, QByteArray &data) const
     while (!pathCopy.isEmpty() && pathCopy.at(0) == '/')
         pathCopy.remove(0, 1);
 
-    git_tree *rootTree = NULL;
-    if (newRootTreeOid.id[0] != '\0') {
-        int error = git_tree_lookup(&rootTree, repository, &newRootTreeOid);
+    git_oid blobOid;
+    // uncommitted changes are not in the path index
+    const PathIndex *index = NULL;
+    if (newRootTreeOid.id[0] == '\0')
+        index = getPathIndex();
+    if (index != NULL) {
+        const git_oid *oid = index->find(pathCopy);
+        if (oid == NULL)
+            return WP::kError;
+        git_oid_cpy(&blobOid, oid);
+    } else {
+        git_tree *rootTree = NULL;
+        if (newRootTreeOid.id[0] != '\0') {
+            int error = git_tree_lookup(&rootTree, repository, &newRootTreeOid);
+            if (error != 0)
+                return WP::kError;
+        } else
+            rootTree = getTipTree();
+
+        if (rootTree == NULL)
+            return WP::kNotInit;
+
+        git_tree_entry *treeEntry;
+        int error = git_tree_entry_bypath(&treeEntry, rootTree, pathCopy.toLatin1().data());
+        git_tree_free(rootTree);
         if (error != 0)
             return WP::kError;
-    } else
-        rootTree = getTipTree();
-
-    if (rootTree == NULL)
-        return WP::kNotInit;
-
-    git_tree_entry *treeEntry;
-    int error = git_tree_entry_bypath(&treeEntry, rootTree, pathCopy.toLatin1().data());
-    if (error != 0)
-        return WP::kError;
+        git_oid_cpy(&blobOid, git_tree_entry_id(treeEntry));
+        git_tree_entry_free(treeEntry);
+    }
 
     git_blob *blob;
-    error = git_blob_lookup(&blob, repository, git_tree_entry_id(treeEntry));
-    git_tree_entry_free(treeEntry);
+    int error = git_blob_lookup(&blob, repository, &blobOid);
     if (error != 0)
         return WP::kEntryNotFound;
 
@@ -738,6 +1118,127 @@ WP::err GitInterface::read(const QString &path, QByteArray &data) const
     return WP::kOk;
 }
 
+//! a blob that has to be read for a path
+class BlobRef {
+public:
+    git_oid oid;
+    QString path;
+};
+
+static bool blobRefLessThan(const BlobRef &ref1, const BlobRef &ref2)
+{
+    return git_oid_cmp(&ref1.oid, &ref2.oid) < 0;
+}
+
+static WP::err readBlobs(git_repository *repository, QList<BlobRef> &blobs,
+                         QMap<QString, QByteArray> &data)
+{
+    qSort(blobs.begin(), blobs.end(), blobRefLessThan);
+    foreach (const BlobRef &ref, blobs) {
+        git_blob *blob;
+        if (git_blob_lookup(&blob, repository, &ref.oid) != 0)
+            return WP::kEntryNotFound;
+        data[ref.path] = QByteArray((const char*)git_blob_rawcontent(blob), git_blob_rawsize(blob));
+        git_blob_free(blob);
+    }
+    return WP::kOk;
+}
+
+static int collectBlobsCallback(const char *root, const git_tree_entry *entry, void *payload)
+{
+    if (git_tree_entry_type(entry) != GIT_OBJ_BLOB)
+        return 0;
+    QList<BlobRef> *blobs = (QList<BlobRef>*)payload;
+    BlobRef ref;
+    git_oid_cpy(&ref.oid, git_tree_entry_id(entry));
+    ref.path = QString(root) + git_tree_entry_name(entry);
+    blobs->append(ref);
+    return 0;
+}
+
+static QString stripSlashes(const QString &path)
+{
+    QString stripped = path;
+    while (!stripped.isEmpty() && stripped.at(0) == '/')
+        stripped.remove(0, 1);
+    while (!stripped.isEmpty() && stripped.at(stripped.count() - 1) == '/')
+        stripped.remove(stripped.count() - 1, 1);
+    return stripped;
+}
+
+WP::err GitInterface::readMany(const QStringList &paths, QMap<QString, QByteArray> &data) const
+{
+    QList<BlobRef> blobs;
+    // uncommitted changes are not in the path index
+    const PathIndex *index = NULL;
+    if (newRootTreeOid.id[0] == '\0')
+        index = getPathIndex();
+    if (index != NULL) {
+        foreach (const QString &path, paths) {
+            const git_oid *oid = index->find(stripSlashes(path));
+            if (oid == NULL)
+                continue;
+            BlobRef ref;
+            git_oid_cpy(&ref.oid, oid);
+            ref.path = path;
+            blobs.append(ref);
+        }
+    } else {
+        // resolve each directory only once, files often share their parent directories
+        QHash<QString, git_tree*> trees;
+        foreach (const QString &path, paths) {
+            QString dirPath = stripSlashes(path);
+            QString filename = removeFilename(dirPath);
+            git_tree *tree = getCachedTree(trees, dirPath);
+            if (tree == NULL)
+                continue;
+            const git_tree_entry *entry = git_tree_entry_byname(tree, filename.toLatin1().data());
+            if (entry == NULL || git_tree_entry_type(entry) != GIT_OBJ_BLOB)
+                continue;
+            BlobRef ref;
+            git_oid_cpy(&ref.oid, git_tree_entry_id(entry));
+            ref.path = path;
+            blobs.append(ref);
+        }
+        foreach (git_tree *tree, trees)
+            git_tree_free(tree);
+    }
+
+    return readBlobs(repository, blobs, data);
+}
+
+WP::err GitInterface::readTree(const QString &prefix, QMap<QString, QByteArray> &data) const
+{
+    git_tree *rootTree = getCurrentTree();
+    if (rootTree == NULL)
+        return WP::kNotInit;
+
+    QString dirPath = stripSlashes(prefix);
+    git_tree *tree = rootTree;
+    if (!dirPath.isEmpty()) {
+        git_tree_entry *treeEntry;
+        int error = git_tree_entry_bypath(&treeEntry, rootTree, dirPath.toLatin1().data());
+        if (error == 0) {
+            if (git_tree_entry_type(treeEntry) == GIT_OBJ_TREE)
+                error = git_tree_lookup(&tree, repository, git_tree_entry_id(treeEntry));
+            else
+                error = -1;
+            git_tree_entry_free(treeEntry);
+        }
+        git_tree_free(rootTree);
+        if (error != 0)
+            return WP::kEntryNotFound;
+    }
+
+    QList<BlobRef> blobs;
+    int error = git_tree_walk(tree, GIT_TREEWALK_PRE, collectBlobsCallback, &blobs);
+    git_tree_free(tree);
+    if (error != 0)
+        return WP::kError;
+
+    return readBlobs(repository, blobs, data);
+}
+
 WP::err GitInterface::writeObject(const char *data, int size)
 {
     QCryptographicHash hash(QCryptographicHash::Sha1);
@@ -745,31 +1246,108 @@ WP::err GitInterface::writeObject(const char *data, int size)
     QByteArray hashBin =  hash.result();
     QString hashHex =  hashBin.toHex();
 
-    QByteArray arrayData;
-    arrayData = QByteArray::fromRawData(data, size);
-    QByteArray compressedData = qCompress(arrayData);
+    // plain zlib, qCompress would prepend a length header that git doesn't understand
+    uLongf compressedSize = compressBound(size);
+    QByteArray compressedData(compressedSize, Qt::Uninitialized);
+    if (compress2((Bytef*)compressedData.data(), &compressedSize, (const Bytef*)data, size,
+                  Z_DEFAULT_COMPRESSION) != Z_OK)
+        return WP::kError;
+
+    return writeFile(hashHex, compressedData.data(), compressedSize);
+}
 
-    return writeFile(hashHex, compressedData.data(), compressedData.size());
+static bool syncFile(QFile &file)
+{
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return fsync(file.handle()) == 0;
+#endif
 }
 
 WP::err GitInterface::writeFile(const QString &hash, const char *data, int size)
 {
-    std::string hashHex = hash.toStdString();
-    QString path;
-    path.sprintf("%s/objects", repositoryPath.toStdString().c_str());
-    QDir dir(path);
-    dir.mkdir(hashHex.substr(0, 2).c_str());
-    path += "/";
-    path += hashHex.substr(0, 2).c_str();
-    path += "/";
-    path += hashHex.substr(2).c_str();
-    QFile file(path);
-    if (file.exists())
+    if (hash.length() != GIT_OID_HEXSZ)
+        return WP::kBadValue;
+
+    QString fanOut = hash.left(2);
+    QString dirPath = repositoryPath + "/objects/" + fanOut;
+    // only create each fan out directory once
+    if (!existingObjectDirs.contains(fanOut)) {
+        if (!QDir().mkpath(dirPath))
+            return WP::kError;
+        existingObjectDirs.insert(fanOut);
+    }
+    QString path = dirPath + "/" + hash.mid(2);
+
+    // write to a temp file and rename it; a crash never leaves a truncated object behind
+    QFile file(dirPath + "/tmp_obj_" + hash.mid(2));
+    const QIODevice::OpenMode mode = QIODevice::WriteOnly | QIODevice::Truncate
+            | QIODevice::Unbuffered;
+    if (!file.open(mode)) {
+        // the directory might have been pruned in the meantime
+        if (!QDir().mkpath(dirPath) || !file.open(mode))
+            return WP::kError;
+    }
+    bool ok = (file.write(data, size) == size);
+#ifdef Q_OS_UNIX
+    if (ok && syncPolicy == kSyncPerObject)
+        ok = syncFile(file);
+#else
+    // no cheap way to sync a whole pack
+    if (ok && syncPolicy != kSyncNever)
+        ok = syncFile(file);
+#endif
+    file.close();
+    if (!ok) {
+        file.remove();
+        return WP::kError;
+    }
+    if (!file.rename(path)) {
+        // rename doesn't replace an existing object
+        file.remove();
+        if (!QFile::exists(path))
+            return WP::kError;
+        RepositoryMaintenance::freshenLooseObject(repositoryPath, hash);
         return WP::kOk;
+    }
+    unsyncedObjects = true;
+    return WP::kOk;
+}
+
+void GitInterface::freshenObject(const git_oid *oid)
+{
+    char hash[GIT_OID_HEXSZ + 1];
+    git_oid_tostr(hash, GIT_OID_HEXSZ + 1, oid);
+    RepositoryMaintenance::freshenLooseObject(repositoryPath, hash);
+}
 
-    file.open(QIODevice::WriteOnly | QIODevice::Truncate);
-    if (file.write(data, size) < 0)
+void GitInterface::setSyncPolicy(SyncPolicy policy)
+{
+    syncPolicy = policy;
+}
+
+GitInterface::SyncPolicy GitInterface::getSyncPolicy() const
+{
+    return syncPolicy;
+}
+
+WP::err GitInterface::syncObjects()
+{
+    if (syncPolicy != kSyncPerPack || !unsyncedObjects)
+        return WP::kOk;
+    unsyncedObjects = false;
+#ifdef Q_OS_LINUX
+    int fd = ::open((repositoryPath + "/objects").toLatin1().data(), O_RDONLY);
+    if (fd < 0)
         return WP::kError;
+    int error = syncfs(fd);
+    ::close(fd);
+    if (error != 0)
+        return WP::kError;
+#elif defined(Q_OS_UNIX)
+    sync();
+#endif
     return WP::kOk;
 }
 
@@ -804,6 +1382,27 @@ QString GitInterface::getTip() const
 }
 
 
+QStringList GitInterface::getRecentCommits(int count) const
+{
+    QStringList commits;
+    QString tip = getTip();
+    if (tip == "")
+        return commits;
+
+    git_revwalk *walker;
+    if (git_revwalk_new(&walker, repository) != 0)
+        return commits;
+    git_revwalk_sorting(walker, GIT_SORT_TIME);
+    git_oid oid;
+    oidFromQString(&oid, tip);
+    if (git_revwalk_push(walker, &oid) == 0) {
+        while (commits.count() < count && git_revwalk_next(&oid, walker) == 0)
+            commits.append(oidToQString(&oid));
+    }
+    git_revwalk_free(walker);
+    return commits;
+}
+
 WP::err GitInterface::updateTip(const QString &commit)
 {
     QString refPath = "refs/heads/";
@@ -876,8 +1475,10 @@ WP::err GitInterface::importPack(const QByteArray &pack, const QString &baseComm
 {
     PackManager packManager(this, repository, objectDatabase);
     WP::err error = packManager.importPack(pack, baseCommit, endCommit);
-    if (error == WP::kOk)
+    if (error == WP::kOk) {
+        RepositoryMaintenance::get()->objectsWritten(repositoryPath);
         emit newCommits(baseCommit, getTip());
+    }
     return error;
 }
 
@@ -1028,6 +1629,42 @@ git_tree *GitInterface::getTipTree() const
     return rootTree;
 }
 
+git_tree *GitInterface::getCurrentTree() const
+{
+    if (newRootTreeOid.id[0] == '\0')
+        return getTipTree();
+    git_tree *rootTree = NULL;
+    if (git_tree_lookup(&rootTree, repository, &newRootTreeOid) != 0)
+        return NULL;
+    return rootTree;
+}
+
+git_tree *GitInterface::getCachedTree(QHash<QString, git_tree*> &trees, const QString &dirPath) const
+{
+    QHash<QString, git_tree*>::const_iterator it = trees.find(dirPath);
+    if (it != trees.end())
+        return it.value();
+
+    git_tree *tree = NULL;
+    if (dirPath.isEmpty())
+        tree = getCurrentTree();
+    else {
+        QString parentPath = dirPath;
+        QString dirName = removeFilename(parentPath);
+        git_tree *parent = getCachedTree(trees, parentPath);
+        if (parent != NULL) {
+            const git_tree_entry *entry = git_tree_entry_byname(parent, dirName.toLatin1().data());
+            if (entry != NULL && git_tree_entry_type(entry) == GIT_OBJ_TREE) {
+                if (git_tree_lookup(&tree, repository, git_tree_entry_id(entry)) != 0)
+                    tree = NULL;
+            }
+        }
+    }
+    // also remember missing directories
+    trees[dirPath] = tree;
+    return tree;
+}
+
 git_tree *GitInterface::getDirectoryTree(const QString &dirPath) const
 {
     git_tree *tree = getTipTree();
@@ -2,10 +2,13 @@
 #define GITINTERFACE_H
 
 
+#include <QHash>
+#include <QSet>
 #include <QString>
 #include <git2.h>
 
 #include "databaseinterface.h"
+#include "pathindex.h"
 
 
 class RemoteConnection;
@@ -13,6 +16,14 @@ class RemoteConnection;
 class GitInterface : public DatabaseInterface
 {
 public:
+    //! when objects written by writeFile are flushed to disk
+    enum SyncPolicy {
+        kSyncNever,
+        kSyncPerObject,
+        //! syncObjects() flushes all objects at once, e.g., after a pack has been written
+        kSyncPerPack
+    };
+
     GitInterface();
     ~GitInterface();
 
@@ -27,12 +38,26 @@ public:
     WP::err remove(const QString& path);
     WP::err commit();
     WP::err read(const QString &path, QByteArray &data) const;
+    //! blobs are read in oid order to keep the object database access local
+    WP::err readMany(const QStringList &paths, QMap<QString, QByteArray> &data) const;
+    WP::err readTree(const QString &prefix, QMap<QString, QByteArray> &data) const;
 
     WP::err writeObject(const char *data, int size);
+    //! writes a compressed loose object; existing objects are only freshened
     WP::err writeFile(const QString& hash, const char *data, int size);
+    /*! Sets the modification time of a loose object to now. An object that is written again might
+    be unreachable and old; a concurrent maintenance run must not prune it (same as git). */
+    void freshenObject(const git_oid *oid);
+    void setSyncPolicy(SyncPolicy policy);
+    SyncPolicy getSyncPolicy() const;
+    WP::err syncObjects();
+
+    //! use a path index for reading files from the tip (enabled by default)
+    void setPathIndexEnabled(bool enabled);
 
     QString getTip() const;
     WP::err updateTip(const QString &commit);
+    QStringList getRecentCommits(int count) const;
 
     QStringList listFiles(const QString &path) const;
     QStringList listDirectories(const QString &path) const;
@@ -49,6 +74,10 @@ private:
 
     git_commit *getTipCommit() const;
     git_tree *getTipTree() const;
+    //! the tree with the uncommitted changes or the tip tree
+    git_tree *getCurrentTree() const;
+    //! looks up a directory tree and its parents once; the trees are freed by the caller
+    git_tree *getCachedTree(QHash<QString, git_tree*> &trees, const QString &dirPath) const;
     //! returns the tree for the given directory
     git_tree *getDirectoryTree(const QString &dirPath) const;
 
@@ -56,6 +85,10 @@ private:
 
     git_tree *getCommitTree(const QString &commitHash) const;
 
+    QString pathIndexFileName() const;
+    //! returns NULL if the index can't be used
+    const PathIndex *getPathIndex() const;
+
 private:
     static bool sGitThreadsHaveBeeInit;
 
@@ -65,6 +98,15 @@ private:
     QString currentBranch;
 
     git_oid newRootTreeOid;
+
+    SyncPolicy syncPolicy;
+    bool unsyncedObjects;
+    //! fan out directories that are known to exist
+    QSet<QString> existingObjectDirs;
+
+    bool pathIndexEnabled;
+    // updated lazily when reading
+    mutable PathIndex pathIndex;
 };
 
 #endif // GITINTERFACE_H
@@ -0,0 +1,135 @@
+#include "notificationchannel.h"
+
+#include <QtNetwork/QNetworkRequest>
+
+#include "remoteconnection.h"
+
+
+RemoteNotificationChannel::RemoteNotificationChannel(QObject *parent) :
+    QObject(parent),
+    channelOpen(false)
+{
+}
+
+bool RemoteNotificationChannel::isOpen() const
+{
+    return channelOpen;
+}
+
+void RemoteNotificationChannel::setOpen(bool open)
+{
+    channelOpen = open;
+}
+
+
+SSENotificationChannel::SSENotificationChannel(const QUrl &url, QObject *parent) :
+    RemoteNotificationChannel(parent),
+    url(url),
+    reply(NULL)
+{
+}
+
+SSENotificationChannel::~SSENotificationChannel()
+{
+    close();
+}
+
+WP::err SSENotificationChannel::open()
+{
+    if (isOpen())
+        return WP::kIsConnected;
+
+    QNetworkRequest request(url);
+    request.setRawHeader("Accept", "text/event-stream");
+    request.setRawHeader("Cache-Control", "no-cache");
+
+    QNetworkAccessManager *manager = NetworkAccessManagerSingelton::getNetworkManager();
+    reply = manager->get(request);
+    if (reply == NULL)
+        return WP::kError;
+
+    buffer.clear();
+    connect(reply, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+    connect(reply, SIGNAL(finished()), this, SLOT(onFinished()));
+
+    setOpen(true);
+    return WP::kOk;
+}
+
+void SSENotificationChannel::close()
+{
+    if (reply == NULL)
+        return;
+
+    reply->disconnect(this);
+    reply->abort();
+    reply->deleteLater();
+    reply = NULL;
+    setOpen(false);
+}
+
+void SSENotificationChannel::onReadyRead()
+{
+    buffer.append(reply->readAll());
+    parseEvents();
+}
+
+void SSENotificationChannel::onFinished()
+{
+    WP::err error = WP::kOk;
+    if (reply->error() != QNetworkReply::NoError)
+        error = WP::kError;
+
+    reply->deleteLater();
+    reply = NULL;
+    setOpen(false);
+
+    emit closed(error);
+}
+
+void SSENotificationChannel::parseEvents()
+{
+    // events are separated by an empty line
+    while (true) {
+        int end = buffer.indexOf("\n\n");
+        if (end < 0)
+            return;
+        QByteArray block = buffer.left(end);
+        buffer.remove(0, end + 2);
+
+        QByteArray event = "message";
+        QByteArray data;
+        foreach (const QByteArray &rawLine, block.split('\n')) {
+            QByteArray line = rawLine;
+            if (line.endsWith('\r'))
+                line.chop(1);
+            // comments are used as keep alive
+            if (line.isEmpty() || line.startsWith(':'))
+                continue;
+            int colon = line.indexOf(':');
+            QByteArray field = line.left(colon);
+            QByteArray value;
+            if (colon >= 0)
+                value = line.mid(colon + 1).trimmed();
+            if (field == "event")
+                event = value;
+            else if (field == "data") {
+                if (!data.isEmpty())
+                    data.append('\n');
+                data.append(value);
+            }
+        }
+        handleEvent(event, data);
+    }
+}
+
+void SSENotificationChannel::handleEvent(const QByteArray &event, const QByteArray &data)
+{
+    if (event != "tip")
+        return;
+
+    QList<QByteArray> parts = data.split(' ');
+    if (parts.count() != 2)
+        return;
+    emit branchTipChanged(QString::fromUtf8(parts.at(0)), QString::fromLatin1(parts.at(1)));
+}
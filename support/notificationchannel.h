@@ -0,0 +1,66 @@
+#ifndef NOTIFICATIONCHANNEL_H
+#define NOTIFICATIONCHANNEL_H
+
+#include <QObject>
+#include <QUrl>
+#include <QtNetwork/QNetworkReply>
+
+#include "error_codes.h"
+
+
+/*! Persistent channel over which the server pushes branch tip changes. After opening, the server
+reports the current tips of all branches and from then on every tip change. */
+class RemoteNotificationChannel : public QObject
+{
+Q_OBJECT
+public:
+    RemoteNotificationChannel(QObject *parent = NULL);
+    virtual ~RemoteNotificationChannel() {}
+
+    virtual WP::err open() = 0;
+    virtual void close() = 0;
+
+    //! true from open() till the channel is closed
+    bool isOpen() const;
+
+signals:
+    void branchTipChanged(const QString &branch, const QString &tip);
+    //! error is WP::kOk if the server closed the channel regularly
+    void closed(WP::err error);
+
+protected:
+    void setOpen(bool open);
+
+private:
+    bool channelOpen;
+};
+
+
+/*! Notification channel using server-sent events (text/event-stream). A tip change is sent as:
+event: tip
+data: branch tip
+*/
+class SSENotificationChannel : public RemoteNotificationChannel
+{
+Q_OBJECT
+public:
+    SSENotificationChannel(const QUrl &url, QObject *parent = NULL);
+    virtual ~SSENotificationChannel();
+
+    virtual WP::err open();
+    virtual void close();
+
+private slots:
+    void onReadyRead();
+    void onFinished();
+
+private:
+    void parseEvents();
+    void handleEvent(const QByteArray &event, const QByteArray &data);
+
+    QUrl url;
+    QNetworkReply *reply;
+    QByteArray buffer;
+};
+
+#endif // NOTIFICATIONCHANNEL_H
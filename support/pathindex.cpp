@@ -0,0 +1,310 @@
+#include "pathindex.h"
+
+#include <QMap>
+#include <QtEndian>
+
+#include "databaseutil.h"
+
+
+const char *kPathIndexMagic = "FPI2";
+const int kMagicSize = 4;
+const int kHeaderSize = kMagicSize + GIT_OID_HEXSZ + 4;
+
+
+PathIndex::PathIndex() :
+    mapped(NULL),
+    mappedSize(0),
+    mappedCount(0),
+    dirty(false)
+{
+}
+
+PathIndex::~PathIndex()
+{
+    unmap();
+}
+
+void PathIndex::clear()
+{
+    unmap();
+    commit = "";
+    changed.clear();
+    removed.clear();
+    dirty = false;
+}
+
+void PathIndex::unmap()
+{
+    if (mapped != NULL)
+        file.unmap((uchar*)mapped);
+    file.close();
+    mapped = NULL;
+    mappedSize = 0;
+    mappedCount = 0;
+}
+
+const QString &PathIndex::getCommit() const
+{
+    return commit;
+}
+
+const git_oid *PathIndex::find(const QString &path) const
+{
+    QByteArray key = path.toUtf8();
+    QHash<QByteArray, git_oid>::const_iterator it = changed.find(key);
+    if (it != changed.end())
+        return &it.value();
+    if (removed.contains(key))
+        return NULL;
+    return findMapped(key);
+}
+
+bool PathIndex::readEntry(quint32 index, const char *&path, quint32 &pathLength,
+                          const git_oid *&oid) const
+{
+    quint32 offset = qFromBigEndian<quint32>(mapped + kHeaderSize + index * 4);
+    if ((qint64)offset + 4 > mappedSize)
+        return false;
+    pathLength = qFromBigEndian<quint32>(mapped + offset);
+    if ((qint64)offset + 4 + pathLength + GIT_OID_RAWSZ > mappedSize)
+        return false;
+    path = (const char*)mapped + offset + 4;
+    oid = (const git_oid*)(mapped + offset + 4 + pathLength);
+    return true;
+}
+
+//! same order as QByteArray::operator<
+static int comparePaths(const char *path1, quint32 length1, const char *path2, quint32 length2)
+{
+    int result = memcmp(path1, path2, qMin(length1, length2));
+    if (result != 0)
+        return result;
+    if (length1 == length2)
+        return 0;
+    return length1 < length2 ? -1 : 1;
+}
+
+const git_oid *PathIndex::findMapped(const QByteArray &path) const
+{
+    // binary search in the sorted table
+    qint64 low = 0;
+    qint64 high = (qint64)mappedCount - 1;
+    while (low <= high) {
+        qint64 middle = (low + high) / 2;
+        const char *entryPath;
+        quint32 entryPathLength;
+        const git_oid *oid;
+        if (!readEntry(middle, entryPath, entryPathLength, oid))
+            return NULL;
+        int result = comparePaths(path.constData(), path.size(), entryPath, entryPathLength);
+        if (result == 0)
+            return oid;
+        if (result < 0)
+            high = middle - 1;
+        else
+            low = middle + 1;
+    }
+    return NULL;
+}
+
+static git_tree *lookupCommitTree(git_repository *repository, const QString &commitHex)
+{
+    git_oid commitOid;
+    if (git_oid_fromstr(&commitOid, commitHex.toLatin1().data()) != 0)
+        return NULL;
+    git_commit *commit;
+    if (git_commit_lookup(&commit, repository, &commitOid) != 0)
+        return NULL;
+    git_tree *tree = NULL;
+    if (git_commit_tree(&tree, commit) != 0)
+        tree = NULL;
+    git_commit_free(commit);
+    return tree;
+}
+
+WP::err PathIndex::update(git_repository *repository, const QString &newCommit)
+{
+    if (newCommit == commit)
+        return WP::kOk;
+
+    git_tree *newTree = lookupCommitTree(repository, newCommit);
+    if (newTree == NULL)
+        return WP::kEntryNotFound;
+
+    git_tree *oldTree = NULL;
+    if (commit != "")
+        oldTree = lookupCommitTree(repository, commit);
+
+    WP::err error;
+    if (oldTree != NULL)
+        error = applyDiff(repository, oldTree, newTree);
+    else
+        error = build(repository, newTree);
+    git_tree_free(oldTree);
+    git_tree_free(newTree);
+    if (error != WP::kOk) {
+        clear();
+        return error;
+    }
+
+    commit = newCommit;
+    dirty = true;
+    return WP::kOk;
+}
+
+static int addBlobEntry(const char *root, const git_tree_entry *entry, void *payload)
+{
+    QHash<QByteArray, git_oid> *entries = (QHash<QByteArray, git_oid>*)payload;
+    if (git_tree_entry_type(entry) == GIT_OBJ_BLOB)
+        entries->insert(QByteArray(root) + git_tree_entry_name(entry), *git_tree_entry_id(entry));
+    return 0;
+}
+
+WP::err PathIndex::build(git_repository */*repository*/, git_tree *tree)
+{
+    // the table is replaced as a whole
+    unmap();
+    changed.clear();
+    removed.clear();
+    if (git_tree_walk(tree, GIT_TREEWALK_PRE, addBlobEntry, &changed) != 0)
+        return WP::kError;
+    return WP::kOk;
+}
+
+class PathIndexChanges {
+public:
+    QHash<QByteArray, git_oid> *changed;
+    QSet<QByteArray> *removed;
+};
+
+static int applyDelta(const git_diff_delta *delta, float /*progress*/, void *payload)
+{
+    PathIndexChanges *changes = (PathIndexChanges*)payload;
+    switch (delta->status) {
+    case GIT_DELTA_ADDED:
+    case GIT_DELTA_MODIFIED:
+        changes->changed->insert(delta->new_file.path, delta->new_file.oid);
+        changes->removed->remove(delta->new_file.path);
+        break;
+    case GIT_DELTA_DELETED:
+        changes->changed->remove(delta->old_file.path);
+        changes->removed->insert(delta->old_file.path);
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+WP::err PathIndex::applyDiff(git_repository *repository, git_tree *oldTree, git_tree *newTree)
+{
+    // the diff only descends into sub trees that differ
+    git_diff *diff;
+    if (git_diff_tree_to_tree(&diff, repository, oldTree, newTree, NULL) != 0)
+        return WP::kError;
+    PathIndexChanges changes;
+    changes.changed = &changed;
+    changes.removed = &removed;
+    int error = git_diff_foreach(diff, applyDelta, NULL, NULL, &changes);
+    git_diff_free(diff);
+    if (error != 0)
+        return build(repository, newTree);
+    return WP::kOk;
+}
+
+/* File format: magic, commit (hex), number of entries, the offsets of the entries sorted by path
+ * and the entries, each as path length, path and the raw oid. Numbers are 32 bit big endian.
+ */
+WP::err PathIndex::load(const QString &fileName)
+{
+    clear();
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return WP::kEntryNotFound;
+    qint64 size = file.size();
+    uchar *data = NULL;
+    if (size >= kHeaderSize)
+        data = file.map(0, size);
+    if (data == NULL || memcmp(data, kPathIndexMagic, kMagicSize) != 0) {
+        if (data != NULL)
+            file.unmap(data);
+        file.close();
+        return WP::kBadValue;
+    }
+    quint32 count = qFromBigEndian<quint32>(data + kMagicSize + GIT_OID_HEXSZ);
+    if ((quint64)size < kHeaderSize + (quint64)count * 4) {
+        file.unmap(data);
+        file.close();
+        return WP::kBadValue;
+    }
+
+    mapped = data;
+    mappedSize = size;
+    mappedCount = count;
+    commit = QString::fromLatin1((const char*)data + kMagicSize, GIT_OID_HEXSZ);
+    return WP::kOk;
+}
+
+static void appendUInt32(QByteArray &data, quint32 value)
+{
+    uchar buffer[4];
+    qToBigEndian(value, buffer);
+    data.append((const char*)buffer, 4);
+}
+
+WP::err PathIndex::save(const QString &fileName)
+{
+    // merge the changes into the table
+    QMap<QByteArray, git_oid> entries;
+    for (quint32 i = 0; i < mappedCount; i++) {
+        const char *path;
+        quint32 pathLength;
+        const git_oid *oid;
+        if (!readEntry(i, path, pathLength, oid))
+            return WP::kBadValue;
+        QByteArray key(path, pathLength);
+        if (!removed.contains(key))
+            entries.insert(key, *oid);
+    }
+    QHash<QByteArray, git_oid>::const_iterator changedIt;
+    for (changedIt = changed.constBegin(); changedIt != changed.constEnd(); ++changedIt)
+        entries.insert(changedIt.key(), changedIt.value());
+
+    QByteArray data(kPathIndexMagic, kMagicSize);
+    data.append(commit.toLatin1().leftJustified(GIT_OID_HEXSZ, '\0', true));
+    appendUInt32(data, entries.count());
+    QByteArray table;
+    quint32 offset = kHeaderSize + entries.count() * 4;
+    QMap<QByteArray, git_oid>::const_iterator it;
+    for (it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        appendUInt32(data, offset);
+        appendUInt32(table, it.key().size());
+        table.append(it.key());
+        table.append((const char*)it.value().id, GIT_OID_RAWSZ);
+        offset += 4 + it.key().size() + GIT_OID_RAWSZ;
+    }
+    data.append(table);
+
+    // the old file can't be replaced while it is mapped on some systems
+    unmap();
+    WP::err error = writeFileAtomically(fileName, data);
+    changed.clear();
+    removed.clear();
+    if (error != WP::kOk) {
+        // the entries are not available anymore; the index is rebuilt on the next update
+        commit = "";
+        return error;
+    }
+    QString savedCommit = commit;
+    error = load(fileName);
+    if (error != WP::kOk || commit != savedCommit) {
+        clear();
+        return WP::kError;
+    }
+    return WP::kOk;
+}
+
+bool PathIndex::isDirty() const
+{
+    return dirty;
+}
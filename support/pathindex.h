@@ -0,0 +1,62 @@
+#ifndef PATHINDEX_H
+#define PATHINDEX_H
+
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <git2.h>
+
+#include "error_codes.h"
+
+
+/*! Maps the full path of every blob in a commit to the blob oid. This saves the tree lookups for
+each path component when reading a file. When the branch moves, the index is updated from the
+tree diff between the indexed commit and the new commit. The index can be stored on disk and is
+still usable if it is outdated.
+
+The stored index is a table sorted by path. It is mapped and probed in place, so loading doesn't
+depend on the size of the tree. Changes since the load are kept in memory and merged into the
+table when saving.
+*/
+class PathIndex {
+public:
+    PathIndex();
+    ~PathIndex();
+
+    void clear();
+    //! the commit the index is for
+    const QString &getCommit() const;
+    //! returns NULL if there is no blob at path; valid till the index changes
+    const git_oid *find(const QString &path) const;
+
+    //! brings the index to commit, incrementally if possible
+    WP::err update(git_repository *repository, const QString &commit);
+
+    WP::err load(const QString &fileName);
+    WP::err save(const QString &fileName);
+    //! true if the index changed since it was loaded or saved
+    bool isDirty() const;
+
+private:
+    WP::err build(git_repository *repository, git_tree *tree);
+    WP::err applyDiff(git_repository *repository, git_tree *oldTree, git_tree *newTree);
+
+    void unmap();
+    //! reads the entry at index of the sorted table
+    bool readEntry(quint32 index, const char *&path, quint32 &pathLength, const git_oid *&oid) const;
+    const git_oid *findMapped(const QByteArray &path) const;
+
+    QString commit;
+    QFile file;
+    const uchar *mapped;
+    qint64 mappedSize;
+    quint32 mappedCount;
+    //! entries that have been added or changed since the table has been mapped
+    QHash<QByteArray, git_oid> changed;
+    //! entries of the table that have been removed
+    QSet<QByteArray> removed;
+    bool dirty;
+};
+
+#endif // PATHINDEX_H
@@ -0,0 +1,163 @@
+#include "protocolcompression.h"
+
+
+#define CHUNK 16384
+
+const char *kCompressionName = "zlib_dict1";
+
+// The most common strings should be at the end of the dictionary.
+const char kCompressionDictionary[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<iq type=\"error\" details=\""
+    "<auth type=\"signature\" loginUser=\""
+    "\" serverUser=\""
+    "\"/><auth_signed signature=\""
+    "\"/><auth_signed status=\"ok\"><role>account</role></auth_signed>"
+    "<logout/>"
+    "<contact_request>"
+    "<put_message server_user=\""
+    "\" channel=\""
+    "\"><channel uid=\""
+    "\"/><channel_info uid=\""
+    "\"/><message uid=\""
+    "\"/></put_message>"
+    "<watch_branches status=\"server_timeout\"/>"
+    "<watch_branches status=\"update\">"
+    "<sync_push branch=\""
+    "\" start_commit=\""
+    "\" last_commit=\""
+    "\"><pack>"
+    "<sync_push_batch><branch branch=\""
+    "\" status=\"ok\" tip=\""
+    "<sync_pull_batch><branch branch=\""
+    "<sync_pull branch=\""
+    "\" base=\""
+    "\" tip=\""
+    "\"><pack></pack></sync_pull>"
+    "</pack></branch>"
+    "<iq type=\"get\">"
+    "<iq type=\"set\">"
+    "<iq type=\"result\">"
+    "</iq>";
+
+
+const char *ProtocolCompression::name()
+{
+    return kCompressionName;
+}
+
+WP::err ProtocolCompression::compress(const QByteArray &in, QByteArray &out)
+{
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+        return WP::kError;
+    if (deflateSetDictionary(&stream, (const Bytef*)kCompressionDictionary,
+                             sizeof(kCompressionDictionary) - 1) != Z_OK) {
+        deflateEnd(&stream);
+        return WP::kError;
+    }
+
+    // the bound is large enough to deflate everything in one call
+    out.resize(deflateBound(&stream, in.size()));
+    stream.next_in = (Bytef*)in.data();
+    stream.avail_in = in.size();
+    stream.next_out = (Bytef*)out.data();
+    stream.avail_out = out.size();
+    int status = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    if (status != Z_STREAM_END)
+        return WP::kError;
+    return WP::kOk;
+}
+
+WP::err ProtocolCompression::decompress(const QByteArray &in, QByteArray &out)
+{
+    ProtocolInflater inflater;
+    out.clear();
+    WP::err error = inflater.update(in, out);
+    if (error != WP::kOk)
+        return error;
+    return inflater.finish();
+}
+
+QByteArray ProtocolCompression::dictionary()
+{
+    return QByteArray(kCompressionDictionary, sizeof(kCompressionDictionary) - 1);
+}
+
+
+ProtocolInflater::ProtocolInflater() :
+    streamEnd(false)
+{
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    stream.next_in = Z_NULL;
+    stream.avail_in = 0;
+    inflateInit(&stream);
+}
+
+ProtocolInflater::~ProtocolInflater()
+{
+    inflateEnd(&stream);
+}
+
+void ProtocolInflater::restart()
+{
+    inflateReset(&stream);
+    streamEnd = false;
+}
+
+WP::err ProtocolInflater::update(const QByteArray &in, QByteArray &out)
+{
+    if (in.size() == 0)
+        return WP::kOk;
+    if (streamEnd)
+        return WP::kBadValue;
+
+    stream.next_in = (Bytef*)in.data();
+    stream.avail_in = in.size();
+
+    unsigned char buffer[CHUNK];
+    while (stream.avail_in > 0 && !streamEnd) {
+        stream.next_out = buffer;
+        stream.avail_out = CHUNK;
+        int status = inflate(&stream, Z_NO_FLUSH);
+        if (status == Z_NEED_DICT) {
+            status = inflateSetDictionary(&stream, (const Bytef*)kCompressionDictionary,
+                                          sizeof(kCompressionDictionary) - 1);
+            if (status != Z_OK)
+                return WP::kBadValue;
+            continue;
+        }
+        if (status == Z_STREAM_END)
+            streamEnd = true;
+        else if (status != Z_OK && status != Z_BUF_ERROR)
+            return WP::kBadValue;
+        out.append((const char*)buffer, CHUNK - stream.avail_out);
+    }
+    // flush the remaining output
+    while (!streamEnd && stream.avail_out == 0) {
+        stream.next_out = buffer;
+        stream.avail_out = CHUNK;
+        int status = inflate(&stream, Z_NO_FLUSH);
+        if (status == Z_STREAM_END)
+            streamEnd = true;
+        else if (status != Z_OK && status != Z_BUF_ERROR)
+            return WP::kBadValue;
+        out.append((const char*)buffer, CHUNK - stream.avail_out);
+    }
+    return WP::kOk;
+}
+
+WP::err ProtocolInflater::finish()
+{
+    if (!streamEnd)
+        return WP::kBadValue;
+    return WP::kOk;
+}
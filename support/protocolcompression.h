@@ -0,0 +1,41 @@
+#ifndef PROTOCOLCOMPRESSION_H
+#define PROTOCOLCOMPRESSION_H
+
+#include <QByteArray>
+
+#include "error_codes.h"
+#include "zlib.h"
+
+
+/*! Compression of whole protocol messages. zlib is primed with a preset dictionary that contains the
+stanza vocabulary, the dictionary must match the one in php_server/Compression.php. */
+class ProtocolCompression {
+public:
+    //! name that is used to negotiate the compression with the server
+    static const char *name();
+
+    static WP::err compress(const QByteArray &in, QByteArray &out);
+    static WP::err decompress(const QByteArray &in, QByteArray &out);
+
+    static QByteArray dictionary();
+};
+
+
+//! Decompresses a message that arrives in chunks.
+class ProtocolInflater {
+public:
+    ProtocolInflater();
+    ~ProtocolInflater();
+
+    void restart();
+    //! Appends the decompressed data of the next chunk to out.
+    WP::err update(const QByteArray &in, QByteArray &out);
+    //! Fails if the message was incomplete.
+    WP::err finish();
+
+private:
+    z_stream stream;
+    bool streamEnd;
+};
+
+#endif // PROTOCOLCOMPRESSION_H
@@ -141,6 +141,52 @@ WP::err QCACryptoInterface::decryptSymmetric(const QByteArray &input, SecureArra
     return WP::kOk;
 }
 
+class QCACipherContext : public SymmetricCipherContext
+{
+public:
+    QCACipherContext(const QString &algo, QCA::Direction direction, const SecureArray &key,
+                     const QByteArray &iv) :
+        key(key),
+        cipher(algo, QCA::Cipher::CBC, QCA::Cipher::DefaultPadding, direction, key, iv)
+    {
+    }
+
+    void restart(const QByteArray &iv)
+    {
+        cipher.setup(cipher.direction(), key, iv);
+    }
+
+    WP::err update(const QByteArray &input, QByteArray &output)
+    {
+        output.append(cipher.update(input).toByteArray());
+        if (!cipher.ok())
+            return WP::kError;
+        return WP::kOk;
+    }
+
+    WP::err finish(QByteArray &output)
+    {
+        output.append(cipher.final().toByteArray());
+        if (!cipher.ok())
+            return WP::kBadKey;
+        return WP::kOk;
+    }
+
+private:
+    QCA::SymmetricKey key;
+    QCA::Cipher cipher;
+};
+
+SymmetricCipherContext *QCACryptoInterface::createSymmetricCipher(
+        const SecureArray &key, const QByteArray &iv, SymmetricCipherContext::Direction direction,
+        const char *algo)
+{
+    QCA::Direction qcaDirection = QCA::Decode;
+    if (direction == SymmetricCipherContext::kEncrypt)
+        qcaDirection = QCA::Encode;
+    return new QCACipherContext(algo, qcaDirection, key, iv);
+}
+
 WP::err QCACryptoInterface::encyrptAsymmetric(const QByteArray &input, QByteArray &encrypted,
                                  const QString &certificate)
 {
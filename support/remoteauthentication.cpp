@@ -1,5 +1,8 @@
 #include "remoteauthentication.h"
 
+#include <QDateTime>
+#include <QMap>
+
 #include "databaseutil.h"
 #include "protocolparser.h"
 
@@ -74,6 +77,19 @@ void RemoteAuthentication::setAuthenticationSucceeded()
 
 const char *kAuthStanza = "auth";
 const char *kAuthSignedStanza = "auth_signed";
+const char *kAuthTicketStanza = "auth_ticket";
+// don't use tickets that expire in the next seconds
+const int kTicketExpiryMargin = 60;
+
+
+class SessionTicket {
+public:
+    QString ticket;
+    QDateTime expires;
+};
+
+//! tickets are shared by all authentications of the process, e.g., also after a reconnect
+static QMap<QString, SessionTicket> sSessionTickets;
 
 SignatureAuthentication::SignatureAuthentication(RemoteConnection *connection,
                                                  KeyStoreFinder *keyStoreFinder,
@@ -178,15 +194,25 @@ WP::err SignatureAuthentication::getLoginData(QByteArray &data, const QByteArray
 
 class UserAuthResultHandler : public InStanzaHandler {
 public:
-    UserAuthResultHandler() :
-        InStanzaHandler(kAuthSignedStanza)
+    UserAuthResultHandler(const QString &stanza) :
+        InStanzaHandler(stanza)
     {
     }
 
     bool handleStanza(const QXmlStreamAttributes &attributes)
     {
+        status = attributes.value("status").toString();
+        if (attributes.hasAttribute("ticket"))
+            ticket = attributes.value("ticket").toString();
+        if (attributes.hasAttribute("ticket_expires"))
+            ticketExpires = QDateTime::fromTime_t(attributes.value("ticket_expires").toString().toUInt());
         return true;
     }
+
+public:
+    QString status;
+    QString ticket;
+    QDateTime ticketExpires;
 };
 
 class AuthResultRoleHandler : public InStanzaHandler {
@@ -210,10 +236,10 @@ public:
     QStringList roles;
 };
 
-WP::err SignatureAuthentication::wasLoginSuccessful(QByteArray &data)
+WP::err SignatureAuthentication::wasLoginSuccessful(QByteArray &data, const QString &resultStanza)
 {
     IqInStanzaHandler iqHandler(kResult);
-    UserAuthResultHandler *userAuthResutlHandler = new UserAuthResultHandler();
+    UserAuthResultHandler *userAuthResutlHandler = new UserAuthResultHandler(resultStanza);
     AuthResultRoleHandler *roleHander = new AuthResultRoleHandler();
     userAuthResutlHandler->addChildHandler(roleHander);
     iqHandler.addChildHandler(userAuthResutlHandler);
@@ -225,10 +251,18 @@ WP::err SignatureAuthentication::wasLoginSuccessful(QByteArray &data)
     if (!userAuthResutlHandler->hasBeenHandled())
         return WP::kError;
 
+    if (userAuthResutlHandler->status == "denied")
+        return WP::kContactRefused;
     roles = roleHander->roles;
     if (roles.count() == 0)
         return WP::kError;
 
+    if (userAuthResutlHandler->ticket != "" && userAuthResutlHandler->ticketExpires.isValid()) {
+        SessionTicket ticket;
+        ticket.ticket = userAuthResutlHandler->ticket;
+        ticket.expires = userAuthResutlHandler->ticketExpires;
+        sSessionTickets[ticketKey()] = ticket;
+    }
     return WP::kOk;
 }
 
@@ -238,17 +272,64 @@ void SignatureAuthentication::getLogoutData(QByteArray &data)
     IqOutStanza *iqStanza = new IqOutStanza(kSet);
     outStream.pushStanza(iqStanza);
     OutStanza *authStanza =  new OutStanza("logout");
+    // an explicit logout ends the session, also the resumable part
+    QMap<QString, SessionTicket>::iterator it = sSessionTickets.find(ticketKey());
+    if (it != sSessionTickets.end()) {
+        authStanza->addAttribute("serverUser", authenticationInfo.getServerUser());
+        authStanza->addAttribute("ticket", it.value().ticket);
+        sSessionTickets.erase(it);
+    }
+    outStream.pushChildStanza(authStanza);
+    outStream.flush();
+}
+
+void SignatureAuthentication::getTicketLoginData(QByteArray &data, const QString &ticket)
+{
+    ProtocolOutStream outStream(&data);
+    IqOutStanza *iqStanza = new IqOutStanza(kSet);
+    outStream.pushStanza(iqStanza);
+    OutStanza *authStanza =  new OutStanza(kAuthTicketStanza);
+    authStanza->addAttribute("ticket", ticket);
+    authStanza->addAttribute("serverUser", authenticationInfo.getServerUser());
+    authStanza->addAttribute("loginUser", authenticationInfo.getUserName());
     outStream.pushChildStanza(authStanza);
     outStream.flush();
 }
 
+QString SignatureAuthentication::ticketKey() const
+{
+    return authenticationInfo.getServerUser() + ":" + authenticationInfo.getUserName() + ":"
+            + authenticationInfo.getKeyId();
+}
+
 
 void SignatureAuthentication::handleConnectionAttempt(WP::err code)
 {
+    connection->disconnect(this);
     if (code != WP::kOk) {
         setAuthenticationCanceled(code);
         return;
     }
+
+    // try to resume the session first, this saves the signing
+    QMap<QString, SessionTicket>::iterator it = sSessionTickets.find(ticketKey());
+    if (it != sSessionTickets.end()) {
+        if (it.value().expires > QDateTime::currentDateTime().addSecs(kTicketExpiryMargin)) {
+            QByteArray data;
+            getTicketLoginData(data, it.value().ticket);
+            authenticationReply = connection->send(data);
+            connect(authenticationReply, SIGNAL(finished(WP::err)), this,
+                    SLOT(handleTicketAttempt(WP::err)));
+            return;
+        }
+        sSessionTickets.erase(it);
+    }
+
+    startSignatureLogin();
+}
+
+void SignatureAuthentication::startSignatureLogin()
+{
     QByteArray data;
     getLoginRequestData(data);
     authenticationReply = connection->send(data);
@@ -279,7 +360,7 @@ void SignatureAuthentication::handleAuthenticationAttempt(WP::err code)
     WP::err error = code;
     if (error == WP::kOk) {
         QByteArray data = authenticationReply->readAll();
-        error = wasLoginSuccessful(data);
+        error = wasLoginSuccessful(data, kAuthSignedStanza);
     }
     if (error != WP::kOk) {
         setAuthenticationCanceled(error);
@@ -288,6 +369,22 @@ void SignatureAuthentication::handleAuthenticationAttempt(WP::err code)
     setAuthenticationSucceeded();
 }
 
+void SignatureAuthentication::handleTicketAttempt(WP::err code)
+{
+    WP::err error = code;
+    if (error == WP::kOk) {
+        QByteArray data = authenticationReply->readAll();
+        error = wasLoginSuccessful(data, kAuthTicketStanza);
+    }
+    if (error != WP::kOk) {
+        // ticket expired or unknown to the server, login with a signature
+        sSessionTickets.remove(ticketKey());
+        startSignatureLogin();
+        return;
+    }
+    setAuthenticationSucceeded();
+}
+
 QString RemoteAuthenticationInfo::getUserName() const
 {
     return userName;
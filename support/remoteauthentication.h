@@ -91,14 +91,22 @@ protected slots:
     void handleConnectionAttempt(WP::err code);
     void handleAuthenticationRequest(WP::err code);
     void handleAuthenticationAttempt(WP::err code);
+    void handleTicketAttempt(WP::err code);
 
 protected:
+    void startSignatureLogin();
     void getLoginRequestData(QByteArray &data);
     WP::err getLoginData(QByteArray &data, const QByteArray &serverRequest);
-    WP::err wasLoginSuccessful(QByteArray &data);
+    WP::err wasLoginSuccessful(QByteArray &data, const QString &resultStanza);
     void getLogoutData(QByteArray &data);
 
+    /*! After a signature login the server issues a session ticket. As long as it is valid, it is
+    used to login again without a signature. */
+    void getTicketLoginData(QByteArray &data, const QString &ticket);
+
 private:
+    QString ticketKey() const;
+
     KeyStoreFinder *keyStoreFinder;
     RemoteAuthenticationInfo authenticationInfo;
 
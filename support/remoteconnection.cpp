@@ -2,26 +2,66 @@
 
 #include <QCoreApplication>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
 #include <QHttpPart>
 #include <QtNetwork/QNetworkCookieJar>
 #include <QXmlStreamAttributes>
 #include <QXmlStreamReader>
 
+#include "notificationchannel.h"
+#include "protocolcompression.h"
 
+
+/*! Encryption of the PHP portal. The cipher contexts are keyed once per session and only
+resynchronized with the IV for each message. */
 class PHPEncryptionFilter {
 public:
     PHPEncryptionFilter(CryptoInterface *crypto, const SecureArray &cipherKey,
                         const QByteArray &iv);
+    virtual ~PHPEncryptionFilter();
+
     //! called before send data
     virtual void sendFilter(const QByteArray &in, QByteArray &out);
     //! called when receive data
     virtual void receiveFilter(const QByteArray &in, QByteArray &out);
+
+    //! Returns a decryption context that is restarted for a new message.
+    SymmetricCipherContext *acquireDecryptor();
+    void releaseDecryptor(SymmetricCipherContext *decryptor);
+
+    //! messages are compressed before encryption, see ProtocolCompression
+    void setCompressed(bool compressed);
+    bool isCompressed() const;
+
 private:
     CryptoInterface *fCrypto;
     SecureArray fCipherKey;
     QByteArray fIV;
+    bool compressed;
+
+    SymmetricCipherContext *encryptor;
+    //! replies are decrypted in parallel, keep a context for each
+    QList<SymmetricCipherContext*> freeDecryptors;
 };
 
+/*! If the environment variable FEJOA_RECORD_TRAFFIC points to a directory, the plain protocol
+messages are written into it, e.g., to benchmark the compression. */
+static void recordTraffic(const char *type, const QByteArray &data)
+{
+    static int messageCounter = 0;
+    static QString recordDir = QString::fromLocal8Bit(qgetenv("FEJOA_RECORD_TRAFFIC"));
+    if (recordDir == "")
+        return;
+
+    QString fileName = QString("%1_%2.xml").arg(messageCounter, 6, 10, QChar('0')).arg(type);
+    messageCounter++;
+    QFile file(QDir(recordDir).filePath(fileName));
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+    file.write(data);
+}
+
 RemoteConnectionReply::RemoteConnectionReply(QIODevice *device, QObject *parent) :
     QObject(parent),
     device(device)
@@ -37,6 +77,7 @@ QByteArray RemoteConnectionReply::readAll()
 {
     QByteArray data = device->readAll();
     qDebug() << data;
+    recordTraffic("reply", data);
     return data;
     //return fDevice->readAll();
 }
@@ -52,6 +93,11 @@ RemoteConnection::~RemoteConnection()
 {
 }
 
+RemoteNotificationChannel *RemoteConnection::createNotificationChannel()
+{
+    return NULL;
+}
+
 bool RemoteConnection::isConnected()
 {
     return connected;
@@ -142,6 +188,12 @@ WP::err HTTPConnection::disconnectFromServer()
 }
 
 RemoteConnectionReply *HTTPConnection::send(const QByteArray &data)
+{
+    recordTraffic("request", data);
+    return post(data);
+}
+
+RemoteConnectionReply *HTTPConnection::post(const QByteArray &data)
 {
      QHttpMultiPart *multiPart = new QHttpMultiPart(QHttpMultiPart::FormDataType);
 
@@ -161,6 +213,8 @@ RemoteConnectionReply *HTTPConnection::send(const QByteArray &data)
      multiPart->append(previewFilePart);
 
      QNetworkRequest request(url);
+     // jobs of a RemoteConnectionJobQueue run in parallel, let them share the kept alive connections
+     request.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, true);
 /*
     QNetworkRequest request;
     request.setUrl(fUrl);
@@ -186,6 +240,12 @@ RemoteConnectionReply *HTTPConnection::send(const QByteArray &data)
     return remoteConnectionReply;
 }
 
+RemoteNotificationChannel *HTTPConnection::createNotificationChannel()
+{
+    // the channel shares the session cookie with the portal
+    return new SSENotificationChannel(url.resolved(QUrl("notify.php")));
+}
+
 void HTTPConnection::replyFinished(QNetworkReply *reply)
 {
     QMap<QNetworkReply*, RemoteConnectionReply*>::iterator it = networkReplyMap.find(reply);
@@ -231,7 +291,8 @@ WP::err EncryptedPHPConnection::connectToServer()
     content += "dh_prime=" + prime + "&";
     content += "dh_base=" + base + "&";
     content += "dh_public_key=" + pub + "&";
-    content += "encrypt_iv=" + initVector.toBase64();
+    content += "encrypt_iv=" + initVector.toBase64() + "&";
+    content += QString("compression=") + ProtocolCompression::name();
 
     networkReply = manager->post(request, content);
     connect(networkReply, SIGNAL(finished()), this, SLOT(handleConnectionAttemptReply()));
@@ -254,9 +315,16 @@ RemoteConnectionReply *EncryptedPHPConnection::send(const QByteArray &data)
     if (encryption == NULL)
         return NULL;
 
+    recordTraffic("request", data);
     QByteArray outgoing;
     encryption->sendFilter(data, outgoing);
-    return HTTPConnection::send(outgoing);
+    return post(outgoing);
+}
+
+RemoteNotificationChannel *EncryptedPHPConnection::createNotificationChannel()
+{
+    // the event stream is not encrypted, don't leak the branch tips
+    return NULL;
 }
 
 void EncryptedPHPConnection::handleConnectionAttemptReply()
@@ -266,6 +334,7 @@ void EncryptedPHPConnection::handleConnectionAttemptReply()
     QString prime;
     QString base;
     QString publicKey;
+    QString compression;
 
     QXmlStreamReader readerXML(data);
     while (!readerXML.atEnd()) {
@@ -281,6 +350,8 @@ void EncryptedPHPConnection::handleConnectionAttemptReply()
                     base = attributes.value("dh_base").toString();;
                 if (attributes.hasAttribute("dh_public_key"))
                     publicKey = attributes.value("dh_public_key").toString();;
+                if (attributes.hasAttribute("compression"))
+                    compression = attributes.value("compression").toString();
 
             }
             break;
@@ -296,6 +367,8 @@ void EncryptedPHPConnection::handleConnectionAttemptReply()
         key.append('\0');
 
     encryption = new PHPEncryptionFilter(crypto, key, initVector);
+    // the server only confirms the compression if it supports it
+    encryption->setCompressed(compression == ProtocolCompression::name());
 
     networkReply->deleteLater();
     setConnected();
@@ -314,44 +387,197 @@ RemoteConnectionReply *EncryptedPHPConnection::createRemoteConnectionReply(QNetw
     return new EncryptedPHPConnectionReply(encryption, reply, this);
 }
 
+// the PHP portal uses AES-128, i.e., only the first 16 bytes of the negotiated key
+const int kPHPPortalKeySize = 16;
+
 PHPEncryptionFilter::PHPEncryptionFilter(CryptoInterface *crypto,
                                          const SecureArray &cipherKey,
                                          const QByteArray &iv) :
     fCrypto(crypto),
-    fCipherKey(cipherKey),
-    fIV(iv)
+    fCipherKey(cipherKey.left(kPHPPortalKeySize)),
+    fIV(iv),
+    compressed(false)
 {
+    encryptor = fCrypto->createSymmetricCipher(fCipherKey, fIV, SymmetricCipherContext::kEncrypt,
+                                               "aes128");
+}
+
+PHPEncryptionFilter::~PHPEncryptionFilter()
+{
+    delete encryptor;
+    foreach (SymmetricCipherContext *decryptor, freeDecryptors)
+        delete decryptor;
 }
 
 void PHPEncryptionFilter::sendFilter(const QByteArray &in, QByteArray &out)
 {
-    fCrypto->encryptSymmetric(in, out, fCipherKey, fIV, "aes128");
+    out.clear();
+    if (encryptor == NULL)
+        return;
+    encryptor->restart(fIV);
+    if (compressed) {
+        QByteArray compressedData;
+        ProtocolCompression::compress(in, compressedData);
+        encryptor->update(compressedData, out);
+    } else
+        encryptor->update(in, out);
+    encryptor->finish(out);
     out = out.toBase64();
 }
 
 void PHPEncryptionFilter::receiveFilter(const QByteArray &in, QByteArray &out)
 {
-    fCrypto->decryptSymmetric(in, out, fCipherKey, fIV, "aes128");
+    out.clear();
+    SymmetricCipherContext *decryptor = acquireDecryptor();
+    if (decryptor == NULL)
+        return;
+    QByteArray decrypted;
+    decryptor->update(in, decrypted);
+    decryptor->finish(decrypted);
+    releaseDecryptor(decryptor);
+
+    if (compressed)
+        ProtocolCompression::decompress(decrypted, out);
+    else
+        out = decrypted;
+}
+
+SymmetricCipherContext *PHPEncryptionFilter::acquireDecryptor()
+{
+    SymmetricCipherContext *decryptor = NULL;
+    if (!freeDecryptors.isEmpty())
+        decryptor = freeDecryptors.takeLast();
+    else {
+        decryptor = fCrypto->createSymmetricCipher(fCipherKey, fIV, SymmetricCipherContext::kDecrypt,
+                                                   "aes128");
+        if (decryptor == NULL)
+            return NULL;
+    }
+    decryptor->restart(fIV);
+    return decryptor;
+}
+
+void PHPEncryptionFilter::releaseDecryptor(SymmetricCipherContext *decryptor)
+{
+    if (decryptor != NULL)
+        freeDecryptors.append(decryptor);
+}
+
+void PHPEncryptionFilter::setCompressed(bool compressed)
+{
+    this->compressed = compressed;
+}
+
+bool PHPEncryptionFilter::isCompressed() const
+{
+    return compressed;
 }
 
 PHPEncryptedDevice::PHPEncryptedDevice(PHPEncryptionFilter *encryption, QNetworkReply *source) :
     encryption(encryption),
+    decryptor(encryption->acquireDecryptor()),
+    inflater(NULL),
     source(source),
-    hasBeenDecrypted(false)
+    readPosition(0),
+    sourceFinished(false)
+{
+    connect(source, SIGNAL(readyRead()), this, SLOT(onSourceReadyRead()));
+    connect(source, SIGNAL(finished()), this, SLOT(onSourceFinished()));
+
+    if (encryption->isCompressed())
+        inflater = new ProtocolInflater();
+}
+
+PHPEncryptedDevice::~PHPEncryptedDevice()
 {
+    encryption->releaseDecryptor(decryptor);
+    delete inflater;
+}
+
+bool PHPEncryptedDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 PHPEncryptedDevice::bytesAvailable() const
+{
+    return plain.size() - readPosition + QIODevice::bytesAvailable();
+}
+
+bool PHPEncryptedDevice::atEnd() const
+{
+    return sourceFinished && bytesAvailable() == 0;
 }
 
 qint64 PHPEncryptedDevice::readData(char *data, qint64 maxSize)
 {
-    if (!source->isFinished())
+    if (readPosition == plain.size())
+        decryptAvailable();
+
+    qint64 size = qMin(maxSize, qint64(plain.size() - readPosition));
+    if (size <= 0)
         return 0;
-    if (!hasBeenDecrypted) {
-        const QByteArray &encryptedData = source->readAll();
-        encryption->receiveFilter(encryptedData, buffer());
-        hasBeenDecrypted = true;
+    memcpy(data, plain.constData() + readPosition, size);
+    readPosition += size;
+    if (readPosition == plain.size()) {
+        plain.clear();
+        readPosition = 0;
+    }
+    return size;
+}
+
+qint64 PHPEncryptedDevice::writeData(const char */*data*/, qint64 /*maxSize*/)
+{
+    return -1;
+}
+
+void PHPEncryptedDevice::onSourceReadyRead()
+{
+    int oldSize = plain.size();
+    decryptAvailable();
+    if (plain.size() != oldSize)
         emit readyRead();
+}
+
+void PHPEncryptedDevice::onSourceFinished()
+{
+    if (sourceFinished)
+        return;
+    decryptAvailable();
+    if (decryptor != NULL) {
+        QByteArray decrypted;
+        if (decryptor->finish(decrypted) != WP::kOk)
+            setErrorString("decryption failed");
+        appendPlain(decrypted);
+        if (inflater != NULL && inflater->finish() != WP::kOk)
+            setErrorString("decompression failed");
+    }
+    sourceFinished = true;
+
+    emit readyRead();
+    emit readChannelFinished();
+}
+
+void PHPEncryptedDevice::decryptAvailable()
+{
+    if (sourceFinished || decryptor == NULL)
+        return;
+    const QByteArray encryptedData = source->readAll();
+    if (encryptedData.size() == 0)
+        return;
+    QByteArray decrypted;
+    decryptor->update(encryptedData, decrypted);
+    appendPlain(decrypted);
+}
+
+void PHPEncryptedDevice::appendPlain(const QByteArray &decrypted)
+{
+    if (inflater == NULL) {
+        plain.append(decrypted);
+        return;
     }
-    return QBuffer::readData(data, maxSize);
+    if (inflater->update(decrypted, plain) != WP::kOk)
+        setErrorString("decompression failed");
 }
 
 
@@ -8,6 +8,7 @@
 
 #include <cryptointerface.h>
 
+class RemoteNotificationChannel;
 
 class RemoteConnectionReply : public QObject
 {
@@ -40,6 +41,10 @@ public:
     virtual WP::err disconnectFromServer() = 0;
     virtual RemoteConnectionReply *send(const QByteArray& data) = 0;
 
+    /*! Creates a channel over which the server pushes branch tip changes. Returns NULL if the
+    connection does not support it. The caller takes ownership. */
+    virtual RemoteNotificationChannel *createNotificationChannel();
+
     bool isConnected();
     bool isConnecting();
 
@@ -95,11 +100,15 @@ public:
     WP::err disconnectFromServer();
     virtual RemoteConnectionReply *send(const QByteArray& data);
 
+    virtual RemoteNotificationChannel *createNotificationChannel();
+
 protected slots:
     void replyFinished(QNetworkReply *reply);
 
 protected:
     virtual RemoteConnectionReply* createRemoteConnectionReply(QNetworkReply *reply);
+    //! posts the data as it is
+    RemoteConnectionReply *post(const QByteArray& data);
 
 protected:
     QUrl url;
@@ -108,19 +117,40 @@ protected:
 
 
 class PHPEncryptionFilter;
+class ProtocolInflater;
 
-class PHPEncryptedDevice : public QBuffer {
+/*! Decrypts the reply while it arrives and exposes the plain text progressively. */
+class PHPEncryptedDevice : public QIODevice {
 Q_OBJECT
 public:
     PHPEncryptedDevice(PHPEncryptionFilter *encryption, QNetworkReply *source);
+    virtual ~PHPEncryptedDevice();
+
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+    bool atEnd() const;
 
 protected:
     qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+
+private slots:
+    void onSourceReadyRead();
+    void onSourceFinished();
 
 private:
+    //! decrypt everything that is buffered in the source
+    void decryptAvailable();
+    void appendPlain(const QByteArray &decrypted);
+
     PHPEncryptionFilter *encryption;
+    SymmetricCipherContext *decryptor;
+    //! only set if the connection is compressed
+    ProtocolInflater *inflater;
     QNetworkReply *source;
-    bool hasBeenDecrypted;
+    QByteArray plain;
+    int readPosition;
+    bool sourceFinished;
 };
 
 
@@ -142,6 +172,8 @@ public:
 
     virtual RemoteConnectionReply *send(const QByteArray& data);
 
+    virtual RemoteNotificationChannel *createNotificationChannel();
+
 private slots:
     void handleConnectionAttemptReply();
     void networkRequestError(QNetworkReply::NetworkError code);
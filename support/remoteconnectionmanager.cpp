@@ -1,6 +1,9 @@
 #include "remoteconnectionmanager.h"
 
 
+// QNetworkAccessManager opens at most six connections per host, stay below that
+const int kDefaultMaxRunningJobs = 4;
+
 RemoteConnectionJob::RemoteConnectionJob(QObject *parent) :
     QObject(parent)
 {
@@ -10,7 +13,8 @@ RemoteConnectionJob::RemoteConnectionJob(QObject *parent) :
 RemoteConnectionJobQueue::RemoteConnectionJobQueue(RemoteConnection *connection) :
     remoteConnection(connection),
     idleJob(NULL),
-    runningJob(NULL)
+    idleJobRunning(false),
+    maxRunningJobs(kDefaultMaxRunningJobs)
 {
 
 }
@@ -26,9 +30,15 @@ void RemoteConnectionJobQueue::start()
     reschedule();
 }
 
-void RemoteConnectionJobQueue::queue(RemoteConnectionJobRef job)
+void RemoteConnectionJobQueue::queue(RemoteConnectionJobRef job, RemoteConnectionJobRef waitFor)
 {
-    jobQueue.append(job);
+    if (isPending(job.data()))
+        return;
+
+    QueueEntry entry;
+    entry.job = job;
+    entry.waitFor = waitFor;
+    jobQueue.append(entry);
     reschedule();
 }
 
@@ -38,23 +48,59 @@ void RemoteConnectionJobQueue::setIdleJob(RemoteConnectionJobRef job)
     reschedule();
 }
 
+int RemoteConnectionJobQueue::getMaxRunningJobs() const
+{
+    return maxRunningJobs;
+}
+
+void RemoteConnectionJobQueue::setMaxRunningJobs(int max)
+{
+    if (max < 1)
+        max = 1;
+    maxRunningJobs = max;
+    reschedule();
+}
+
 void RemoteConnectionJobQueue::reschedule()
 {
-    // try to run a job from the queue
-    if (jobQueue.size() != 0) {
-        if (runningJob == idleJob) {
+    // start as many jobs from the queue as allowed, jobs waiting for a pending job are skipped
+    int i = 0;
+    while (i < jobQueue.size() && runningJobs.size() < maxRunningJobs) {
+        const QueueEntry &entry = jobQueue.at(i);
+        if (entry.waitFor != NULL && isPending(entry.waitFor.data())) {
+            i++;
+            continue;
+        }
+        if (idleJobRunning) {
+            idleJobRunning = false;
             idleJob->abort();
         }
-        startJob(jobQueue.takeFirst());
-        return;
+        startJob(jobQueue.takeAt(i).job);
     }
-    // if no jobs in the queue start the idle job
-    if (runningJob == NULL && idleJob != NULL) {
-        startJob(idleJob);
+    if (runningJobs.size() != 0 || jobQueue.size() != 0)
         return;
+
+    // if no jobs are left start the idle job
+    if (!idleJobRunning && idleJob != NULL) {
+        idleJobRunning = true;
+        connect(idleJob.data(), SIGNAL(jobDone(WP::err)), this, SLOT(onJobDone(WP::err)));
+        idleJob->run(this);
     }
 }
 
+bool RemoteConnectionJobQueue::isPending(RemoteConnectionJob *job) const
+{
+    foreach (const RemoteConnectionJobRef &running, runningJobs) {
+        if (running.data() == job)
+            return true;
+    }
+    foreach (const QueueEntry &entry, jobQueue) {
+        if (entry.job.data() == job)
+            return true;
+    }
+    return false;
+}
+
 RemoteConnection *RemoteConnectionJobQueue::getRemoteConnection() const
 {
     return remoteConnection;
@@ -78,17 +124,39 @@ RemoteAuthenticationRef RemoteConnectionJobQueue::getRemoteAuthentication(
     return entry->remoteAuthentication;
 }
 
+void RemoteConnectionJobQueue::setRemoteAuthentication(const RemoteAuthenticationInfo &info,
+                                                       RemoteAuthenticationRef authentication)
+{
+    getRemoteAuthentication(info, NULL);
+    foreach (AuthenticationEntry *entry, authenticationList) {
+        if (entry->authenticationInfo == info)
+            entry->remoteAuthentication = authentication;
+    }
+}
+
 void RemoteConnectionJobQueue::onJobDone(WP::err error)
 {
-    runningJob = RemoteConnectionJobRef(NULL);
+    RemoteConnectionJob *job = qobject_cast<RemoteConnectionJob*>(sender());
+    if (job == NULL)
+        return;
+    disconnect(job, SIGNAL(jobDone(WP::err)), this, SLOT(onJobDone(WP::err)));
+
+    if (job == idleJob.data())
+        idleJobRunning = false;
+    for (int i = 0; i < runningJobs.size(); i++) {
+        if (runningJobs.at(i).data() == job) {
+            runningJobs.removeAt(i);
+            break;
+        }
+    }
     reschedule();
 }
 
 void RemoteConnectionJobQueue::startJob(RemoteConnectionJobRef job)
 {
-    runningJob = job;
-    runningJob->run(this);
-    connect(runningJob.data(), SIGNAL(jobDone(WP::err)), this, SLOT(onJobDone(WP::err)));
+    runningJobs.append(job);
+    connect(job.data(), SIGNAL(jobDone(WP::err)), this, SLOT(onJobDone(WP::err)));
+    job->run(this);
 }
 
 
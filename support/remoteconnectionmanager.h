@@ -33,13 +33,22 @@ public:
 
     void start();
 
-    void queue(RemoteConnectionJobRef job);
+    /*! Queue a job. If waitFor is set, the job is not started before waitFor has left the queue
+    and is not running anymore. Queuing a job that is already queued or running has no effect. */
+    void queue(RemoteConnectionJobRef job, RemoteConnectionJobRef waitFor = RemoteConnectionJobRef());
     void setIdleJob(RemoteConnectionJobRef job);
 
+    //! Number of jobs that may be in flight on the connection at the same time.
+    int getMaxRunningJobs() const;
+    void setMaxRunningJobs(int max);
+
     RemoteConnection *getRemoteConnection() const;
     void setRemoteConnection(RemoteConnection *value);
 
     RemoteAuthenticationRef getRemoteAuthentication(const RemoteAuthenticationInfo &info, KeyStoreFinder *keyStoreFinder);
+    //! uses authentication for info instead of creating one from the info type
+    void setRemoteAuthentication(const RemoteAuthenticationInfo &info,
+                                 RemoteAuthenticationRef authentication);
 
 private slots:
     void onJobDone(WP::err error);
@@ -47,13 +56,22 @@ private slots:
 private:
     void startJob(RemoteConnectionJobRef job);
     void reschedule();
+    bool isPending(RemoteConnectionJob *job) const;
 
     RemoteConnection *remoteConnection;
 
     RemoteConnectionJobRef idleJob;
+    bool idleJobRunning;
+
+    class QueueEntry {
+    public:
+        RemoteConnectionJobRef job;
+        RemoteConnectionJobRef waitFor;
+    };
 
-    RemoteConnectionJobRef runningJob;
-    QList<RemoteConnectionJobRef> jobQueue;
+    int maxRunningJobs;
+    QList<RemoteConnectionJobRef> runningJobs;
+    QList<QueueEntry> jobQueue;
 
     class AuthenticationEntry {
     public:
@@ -47,10 +47,23 @@ DatabaseInterface *RemoteSync::getDatabase()
     return database;
 }
 
+// number of recent commits we tell the server we have
+const int kMaxHaves = 8;
+
+/*! Recent commits of the branch. If the last sync commit is stale or lost, the server uses these
+to avoid sending objects we already have. */
+static QString getHaveList(DatabaseInterface *database)
+{
+    return database->getRecentCommits(kMaxHaves).join(" ");
+}
+
 void RemoteSync::syncConnected(WP::err code)
 {
-    if (code != WP::kOk)
+    authentication->disconnect(this);
+    if (code != WP::kOk) {
+        emit jobDone(code);
         return;
+    }
 
     QString branch = database->branch();
     QString lastSyncCommit = database->getLastSyncCommit(remoteStorage->getUid(), branch);
@@ -64,6 +77,7 @@ void RemoteSync::syncConnected(WP::err code)
     OutStanza *syncStanza = new OutStanza("sync_pull");
     syncStanza->addAttribute("branch", branch);
     syncStanza->addAttribute("base", lastSyncCommit);
+    syncStanza->addAttribute("have", getHaveList(database));
 
     outStream.pushChildStanza(syncStanza);
 
@@ -77,11 +91,60 @@ void RemoteSync::syncConnected(WP::err code)
 class SyncPullData {
 public:
     QString branch;
+    //! the commit the server sent the pack for
+    QString base;
     QString tip;
     QByteArray pack;
 };
 
 
+/*! Imports the pulled data into the database. If the local branch is ahead of the server
+afterwards, pushNeeded is set and pushData contains what has to be pushed. */
+static WP::err processSyncPull(DatabaseInterface *database, const QString &remoteUid,
+                               const SyncPullData &pullData, QString &syncUid, bool &pushNeeded,
+                               SyncPushData &pushData)
+{
+    pushNeeded = false;
+
+    QString localBranch = database->branch();
+    QString localTipCommit = database->getTip();
+    QString lastSyncCommit = database->getLastSyncCommit(remoteUid, localBranch);
+
+    if (pullData.tip == localTipCommit)
+        return WP::kOk;
+
+    // the server might have picked one of our haves if it didn't know the last sync commit
+    QString base = lastSyncCommit;
+    if (pullData.base != "")
+        base = pullData.base;
+
+    // see if the server is ahead by checking if we got packages
+    if (pullData.pack.size() != 0) {
+        syncUid = pullData.tip;
+        WP::err error = database->importPack(pullData.pack, base, pullData.tip);
+        if (error != WP::kOk)
+            return error;
+
+        localTipCommit = database->getTip();
+        // done? otherwise it was a merge and we have to push our merge
+        if (localTipCommit == lastSyncCommit)
+            return WP::kOk;
+    }
+
+    // we are ahead of the server: push changes to the server
+    WP::err error = database->exportPack(pushData.pack, base, localTipCommit, syncUid);
+    if (error != WP::kOk)
+        return error;
+    syncUid = localTipCommit;
+
+    pushData.branch = localBranch;
+    pushData.startCommit = pullData.tip;
+    pushData.lastCommit = localTipCommit;
+    pushNeeded = true;
+    return WP::kOk;
+}
+
+
 class SyncPullPackHandler : public InStanzaHandler {
 public:
     SyncPullPackHandler(SyncPullData *d) :
@@ -124,6 +187,7 @@ public:
             return false;
 
         data->branch = attributes.value("branch").toString();
+        data->base = attributes.value("base").toString();
         data->tip = attributes.value("tip").toString();
         return true;
     }
@@ -136,8 +200,11 @@ public:
 
 void RemoteSync::syncReply(WP::err code)
 {
-    if (code != WP::kOk)
+    if (code != WP::kOk) {
+        serverReply = NULL;
+        emit jobDone(code);
         return;
+    }
 
     QByteArray data = serverReply->readAll();
     serverReply = NULL;
@@ -152,47 +219,21 @@ void RemoteSync::syncReply(WP::err code)
 
     inStream.parse();
 
-    QString localBranch = database->branch();
-    QString localTipCommit = database->getTip();
-    QString lastSyncCommit = database->getLastSyncCommit(remoteStorage->getUid(), localBranch);
-
-    if (!syncPullHandler->hasBeenHandled() || syncPullData.branch != localBranch) {
+    if (!syncPullHandler->hasBeenHandled() || syncPullData.branch != database->branch()) {
         // error occured, the server should at least send back the branch name
         // TODO better error message
         emit jobDone(WP::kBadValue);
         return;
     }
-    if (syncPullData.tip == localTipCommit) {
-        // done
-        emit jobDone(WP::kOk);
-        return;
-    }
-    // see if the server is ahead by checking if we got packages
-    if (syncPullData.pack.size() != 0) {
-        syncUid = syncPullData.tip;
-        WP::err error = database->importPack(syncPullData.pack, lastSyncCommit,
-                                              syncPullData.tip);
-        if (error != WP::kOk) {
-            emit jobDone(error);
-            return;
-        }
 
-        localTipCommit = database->getTip();
-        // done? otherwise it was a merge and we have to push our merge
-        if (localTipCommit == lastSyncCommit) {
-            emit jobDone(WP::kOk);
-            return;
-        }
-    }
-
-    // we are ahead of the server: push changes to the server
-    QByteArray pack;
-    WP::err error = database->exportPack(pack, lastSyncCommit, localTipCommit, syncUid);
-    if (error != WP::kOk) {
+    bool pushNeeded = false;
+    SyncPushData pushData;
+    WP::err error = processSyncPull(database, remoteStorage->getUid(), syncPullData, syncUid,
+                                    pushNeeded, pushData);
+    if (error != WP::kOk || !pushNeeded) {
         emit jobDone(error);
         return;
     }
-    syncUid = localTipCommit;
 
     QByteArray outData;
     ProtocolOutStream outStream(&outData);
@@ -200,12 +241,12 @@ void RemoteSync::syncReply(WP::err code)
     IqOutStanza *iqStanza = new IqOutStanza(kSet);
     outStream.pushStanza(iqStanza);
     OutStanza *pushStanza = new OutStanza("sync_push");
-    pushStanza->addAttribute("branch", localBranch);
-    pushStanza->addAttribute("start_commit", syncPullData.tip);
-    pushStanza->addAttribute("last_commit", localTipCommit);
+    pushStanza->addAttribute("branch", pushData.branch);
+    pushStanza->addAttribute("start_commit", pushData.startCommit);
+    pushStanza->addAttribute("last_commit", pushData.lastCommit);
     outStream.pushChildStanza(pushStanza);
     OutStanza *pushPackStanza = new OutStanza("pack");
-    pushPackStanza->setText(pack.toBase64());
+    pushPackStanza->setText(pushData.pack.toBase64());
     outStream.pushChildStanza(pushPackStanza);
 
     outStream.flush();
@@ -216,11 +257,329 @@ void RemoteSync::syncReply(WP::err code)
 
 void RemoteSync::syncPushReply(WP::err code)
 {
-    if (code != WP::kOk)
+    if (code != WP::kOk) {
+        serverReply = NULL;
+        emit jobDone(code);
         return;
+    }
 
     QByteArray data = serverReply->readAll();
+    serverReply = NULL;
 
     database->updateLastSyncCommit(remoteStorage->getUid(), database->branch(), syncUid);
     emit jobDone(WP::kOk);
 }
+
+
+const char *kSyncPullBatchStanza = "sync_pull_batch";
+const char *kSyncPushBatchStanza = "sync_push_batch";
+
+
+//! Container stanza of the batched sync, the branch data is in the children.
+class SyncBatchHandler : public InStanzaHandler {
+public:
+    SyncBatchHandler(const QString &stanza) :
+        InStanzaHandler(stanza)
+    {
+    }
+
+    bool handleStanza(const QXmlStreamAttributes &attributes)
+    {
+        return true;
+    }
+};
+
+
+RemoteBatchSync::RemoteBatchSync(const QList<DatabaseInterface *> &databases,
+                                 RemoteDataStorage *remoteStorage, QObject *parent) :
+    RemoteConnectionJob(parent),
+    databases(databases),
+    remoteStorage(remoteStorage),
+    authentication(NULL),
+    remoteConnection(NULL),
+    serverReply(NULL),
+    batchSupported(true)
+{
+}
+
+RemoteBatchSync::~RemoteBatchSync()
+{
+}
+
+void RemoteBatchSync::run(RemoteConnectionJobQueue *jobQueue)
+{
+    remoteConnection = jobQueue->getRemoteConnection();
+    authentication = jobQueue->getRemoteAuthentication(remoteStorage->getRemoteAuthenticationInfo(),
+                                                       remoteStorage->getKeyStoreFinder());
+
+    if (authentication->isVerified())
+        syncConnected(WP::kOk);
+    else {
+        connect(authentication.data(), SIGNAL(authenticationAttemptFinished(WP::err)),
+                this, SLOT(syncConnected(WP::err)));
+        authentication->login();
+    }
+}
+
+void RemoteBatchSync::abort()
+{
+    if (serverReply != NULL) {
+        serverReply->abort();
+        serverReply = NULL;
+    }
+}
+
+const QList<DatabaseInterface *> &RemoteBatchSync::getDatabases() const
+{
+    return databases;
+}
+
+bool RemoteBatchSync::isSupportedByServer() const
+{
+    return batchSupported;
+}
+
+void RemoteBatchSync::syncConnected(WP::err code)
+{
+    authentication->disconnect(this);
+    if (code != WP::kOk) {
+        emit jobDone(code);
+        return;
+    }
+
+    QByteArray outData;
+    ProtocolOutStream outStream(&outData);
+
+    IqOutStanza *iqStanza = new IqOutStanza(kGet);
+    outStream.pushStanza(iqStanza);
+
+    OutStanza *syncStanza = new OutStanza(kSyncPullBatchStanza);
+    outStream.pushChildStanza(syncStanza);
+
+    foreach (DatabaseInterface *database, databases) {
+        QString branch = database->branch();
+        OutStanza *branchStanza = new OutStanza("branch");
+        branchStanza->addAttribute("branch", branch);
+        branchStanza->addAttribute("base", database->getLastSyncCommit(remoteStorage->getUid(),
+                                                                       branch));
+        branchStanza->addAttribute("have", getHaveList(database));
+        outStream.pushChildStanza(branchStanza);
+        outStream.cdDotDot();
+    }
+
+    outStream.flush();
+
+    serverReply = remoteConnection->send(outData);
+    connect(serverReply, SIGNAL(finished(WP::err)), this, SLOT(syncReply(WP::err)));
+}
+
+
+class SyncPullBatchPackHandler : public InStanzaHandler {
+public:
+    SyncPullBatchPackHandler(QList<SyncPullData> *d) :
+        InStanzaHandler("pack", true),
+        data(d)
+    {
+    }
+
+    bool handleStanza(const QXmlStreamAttributes &attributes)
+    {
+        return true;
+    }
+
+    bool handleText(const QStringRef &text)
+    {
+        if (data->isEmpty())
+            return false;
+        data->last().pack = QByteArray::fromBase64(text.toLatin1());
+        return true;
+    }
+
+public:
+    QList<SyncPullData> *data;
+};
+
+
+class SyncPullBatchBranchHandler : public InStanzaHandler {
+public:
+    SyncPullBatchBranchHandler(QList<SyncPullData> *d) :
+        InStanzaHandler("branch", true),
+        data(d)
+    {
+        addChildHandler(new SyncPullBatchPackHandler(data));
+    }
+
+    bool handleStanza(const QXmlStreamAttributes &attributes)
+    {
+        if (!attributes.hasAttribute("branch"))
+            return false;
+        if (!attributes.hasAttribute("tip"))
+            return false;
+
+        SyncPullData branchData;
+        branchData.branch = attributes.value("branch").toString();
+        branchData.base = attributes.value("base").toString();
+        branchData.tip = attributes.value("tip").toString();
+        data->append(branchData);
+        return true;
+    }
+
+public:
+    QList<SyncPullData> *data;
+};
+
+
+void RemoteBatchSync::syncReply(WP::err code)
+{
+    if (code != WP::kOk) {
+        serverReply = NULL;
+        emit jobDone(code);
+        return;
+    }
+
+    QByteArray data = serverReply->readAll();
+    serverReply = NULL;
+
+    QList<SyncPullData> pullDataList;
+    IqInStanzaHandler iqHandler(kResult);
+    SyncBatchHandler *syncPullHandler = new SyncBatchHandler(kSyncPullBatchStanza);
+    syncPullHandler->addChildHandler(new SyncPullBatchBranchHandler(&pullDataList));
+    iqHandler.addChildHandler(syncPullHandler);
+
+    ProtocolInStream inStream(data);
+    inStream.addHandler(&iqHandler);
+
+    inStream.parse();
+
+    if (!syncPullHandler->hasBeenHandled()) {
+        batchSupported = false;
+        emit jobDone(WP::kBadValue);
+        return;
+    }
+
+    // process the branches in the order they have been requested, e.g., identities first
+    pushList.clear();
+    WP::err result = WP::kOk;
+    foreach (DatabaseInterface *database, databases) {
+        const QString branch = database->branch();
+        int index = -1;
+        for (int i = 0; i < pullDataList.count(); i++) {
+            if (pullDataList.at(i).branch == branch) {
+                index = i;
+                break;
+            }
+        }
+        if (index < 0) {
+            result = WP::kBadValue;
+            continue;
+        }
+
+        QString syncUid;
+        bool pushNeeded = false;
+        SyncPushData pushData;
+        WP::err error = processSyncPull(database, remoteStorage->getUid(), pullDataList.at(index),
+                                        syncUid, pushNeeded, pushData);
+        if (error != WP::kOk) {
+            result = error;
+            continue;
+        }
+        if (pushNeeded)
+            pushList.append(pushData);
+    }
+
+    if (pushList.isEmpty()) {
+        emit jobDone(result);
+        return;
+    }
+
+    QByteArray outData;
+    ProtocolOutStream outStream(&outData);
+
+    IqOutStanza *iqStanza = new IqOutStanza(kSet);
+    outStream.pushStanza(iqStanza);
+    OutStanza *pushStanza = new OutStanza(kSyncPushBatchStanza);
+    outStream.pushChildStanza(pushStanza);
+
+    foreach (const SyncPushData &pushData, pushList) {
+        OutStanza *branchStanza = new OutStanza("branch");
+        branchStanza->addAttribute("branch", pushData.branch);
+        branchStanza->addAttribute("start_commit", pushData.startCommit);
+        branchStanza->addAttribute("last_commit", pushData.lastCommit);
+        outStream.pushChildStanza(branchStanza);
+        OutStanza *packStanza = new OutStanza("pack");
+        packStanza->setText(pushData.pack.toBase64());
+        outStream.pushChildStanza(packStanza);
+        outStream.cdDotDot();
+        outStream.cdDotDot();
+    }
+
+    outStream.flush();
+
+    serverReply = remoteConnection->send(outData);
+    connect(serverReply, SIGNAL(finished(WP::err)), this, SLOT(syncPushReply(WP::err)));
+}
+
+
+class SyncPushBatchBranchHandler : public InStanzaHandler {
+public:
+    SyncPushBatchBranchHandler() :
+        InStanzaHandler("branch", true)
+    {
+    }
+
+    bool handleStanza(const QXmlStreamAttributes &attributes)
+    {
+        if (!attributes.hasAttribute("branch"))
+            return false;
+        if (attributes.value("status").toString() != "ok")
+            return true;
+
+        pushedBranches.append(attributes.value("branch").toString());
+        return true;
+    }
+
+public:
+    QStringList pushedBranches;
+};
+
+
+void RemoteBatchSync::syncPushReply(WP::err code)
+{
+    if (code != WP::kOk) {
+        serverReply = NULL;
+        emit jobDone(code);
+        return;
+    }
+
+    QByteArray data = serverReply->readAll();
+    serverReply = NULL;
+
+    IqInStanzaHandler iqHandler(kResult);
+    SyncBatchHandler *syncPushHandler = new SyncBatchHandler(kSyncPushBatchStanza);
+    SyncPushBatchBranchHandler *branchHandler = new SyncPushBatchBranchHandler();
+    syncPushHandler->addChildHandler(branchHandler);
+    iqHandler.addChildHandler(syncPushHandler);
+
+    ProtocolInStream inStream(data);
+    inStream.addHandler(&iqHandler);
+
+    inStream.parse();
+
+    WP::err result = WP::kOk;
+    foreach (const SyncPushData &pushData, pushList) {
+        if (!branchHandler->pushedBranches.contains(pushData.branch)) {
+            result = WP::kError;
+            continue;
+        }
+        foreach (DatabaseInterface *database, databases) {
+            if (database->branch() != pushData.branch)
+                continue;
+            database->updateLastSyncCommit(remoteStorage->getUid(), pushData.branch,
+                                           pushData.lastCommit);
+            break;
+        }
+    }
+    pushList.clear();
+
+    emit jobDone(result);
+}
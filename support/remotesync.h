@@ -39,4 +39,49 @@ private:
 
 typedef QSharedPointer<RemoteSync> RemoteSyncRef;
 
+
+//! Data of one branch that is pushed to the server.
+class SyncPushData {
+public:
+    QString branch;
+    QString startCommit;
+    QString lastCommit;
+    QByteArray pack;
+};
+
+/*! Syncs many branches with one sync_pull_batch and at most one sync_push_batch request. The
+branches are processed in the order of the database list. */
+class RemoteBatchSync : public RemoteConnectionJob
+{
+Q_OBJECT
+public:
+    explicit RemoteBatchSync(const QList<DatabaseInterface*> &databases,
+                             RemoteDataStorage* remoteStorage, QObject *parent = 0);
+    ~RemoteBatchSync();
+
+    virtual void run(RemoteConnectionJobQueue *jobQueue);
+    virtual void abort();
+
+    const QList<DatabaseInterface*> &getDatabases() const;
+    //! False if the server did not understand the batch request.
+    bool isSupportedByServer() const;
+
+private slots:
+    void syncConnected(WP::err code);
+    void syncReply(WP::err code);
+    void syncPushReply(WP::err code);
+
+private:
+    QList<DatabaseInterface*> databases;
+    RemoteDataStorage* remoteStorage;
+    RemoteAuthenticationRef authentication;
+    RemoteConnection *remoteConnection;
+    RemoteConnectionReply *serverReply;
+
+    QList<SyncPushData> pushList;
+    bool batchSupported;
+};
+
+typedef QSharedPointer<RemoteBatchSync> RemoteBatchSyncRef;
+
 #endif // REMOTESYNC_H
@@ -0,0 +1,362 @@
+#include "repositorymaintenance.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QtEndian>
+#include <git2.h>
+#include <git2/sys/odb_backend.h>
+
+#ifdef Q_OS_WIN
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#include "logger.h"
+
+
+// same as git gc --auto
+const int kLooseObjectThreshold = 6700;
+// wait till nothing has been written for a while
+const int kIdleDelay = 30 * 1000;
+// unreachable objects could belong to a commit that is just being written
+const int kPruneExpiryDays = 14;
+
+
+class MaintenanceRunnable : public QRunnable {
+public:
+    MaintenanceRunnable(RepositoryMaintenance *receiver, const QString &repositoryPath) :
+        receiver(receiver),
+        repositoryPath(repositoryPath)
+    {
+    }
+
+    void run()
+    {
+        QDateTime expiry = QDateTime::currentDateTime().addDays(-kPruneExpiryDays);
+        WP::err error = RepositoryMaintenance::maintain(repositoryPath, expiry);
+        QMetaObject::invokeMethod(receiver, "onMaintenanceDone", Qt::QueuedConnection,
+                                  Q_ARG(QString, repositoryPath), Q_ARG(int, error));
+    }
+
+private:
+    RepositoryMaintenance *receiver;
+    QString repositoryPath;
+};
+
+
+RepositoryMaintenance *RepositoryMaintenance::sMaintenance = NULL;
+
+RepositoryMaintenance *RepositoryMaintenance::get()
+{
+    if (sMaintenance == NULL)
+        sMaintenance = new RepositoryMaintenance();
+    return sMaintenance;
+}
+
+RepositoryMaintenance::RepositoryMaintenance(QObject *parent) :
+    QObject(parent)
+{
+    idleTimer.setSingleShot(true);
+    idleTimer.setInterval(kIdleDelay);
+    connect(&idleTimer, SIGNAL(timeout()), this, SLOT(checkPending()));
+}
+
+void RepositoryMaintenance::objectsWritten(const QString &repositoryPath)
+{
+    pending.insert(repositoryPath);
+    idleTimer.start();
+}
+
+bool RepositoryMaintenance::isRunning(const QString &repositoryPath) const
+{
+    return running.contains(repositoryPath);
+}
+
+void RepositoryMaintenance::checkPending()
+{
+    foreach (const QString &repositoryPath, pending) {
+        // check again when the current run is done
+        if (running.contains(repositoryPath))
+            continue;
+        pending.remove(repositoryPath);
+        if (estimateLooseObjects(repositoryPath) < kLooseObjectThreshold)
+            continue;
+
+        running.insert(repositoryPath);
+        QThreadPool::globalInstance()->start(new MaintenanceRunnable(this, repositoryPath));
+    }
+}
+
+void RepositoryMaintenance::onMaintenanceDone(const QString &repositoryPath, int error)
+{
+    running.remove(repositoryPath);
+    if (error != WP::kOk)
+        Log::warning("repository maintenance failed: " + repositoryPath);
+    emit maintenanceFinished(repositoryPath, (WP::err)error);
+
+    if (pending.contains(repositoryPath))
+        idleTimer.start();
+}
+
+int RepositoryMaintenance::estimateLooseObjects(const QString &repositoryPath)
+{
+    // objects are evenly distributed over the 256 fan out directories
+    QDir sampleDir(repositoryPath + "/objects/17");
+    return sampleDir.entryList(QDir::Files).count() * 256;
+}
+
+static QString oidToString(const git_oid *oid)
+{
+    char buffer[GIT_OID_HEXSZ + 1];
+    git_oid_tostr(buffer, GIT_OID_HEXSZ + 1, oid);
+    return QString(buffer);
+}
+
+//! adds the tree and all objects below it to the pack builder
+static WP::err insertTree(git_repository *repository, git_packbuilder *packBuilder,
+                          const git_oid *treeId, QSet<QString> &objects)
+{
+    QList<git_oid> treesQueue;
+    treesQueue.append(*treeId);
+    while (!treesQueue.isEmpty()) {
+        git_oid currentTreeId = treesQueue.takeFirst();
+        QString treeString = oidToString(&currentTreeId);
+        if (objects.contains(treeString))
+            continue;
+        objects.insert(treeString);
+        if (git_packbuilder_insert(packBuilder, &currentTreeId, NULL) != 0)
+            return WP::kError;
+
+        git_tree *tree;
+        if (git_tree_lookup(&tree, repository, &currentTreeId) != 0)
+            return WP::kError;
+        for (unsigned int i = 0; i < git_tree_entrycount(tree); i++) {
+            const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+            if (git_tree_entry_type(entry) == GIT_OBJ_TREE) {
+                treesQueue.append(*git_tree_entry_id(entry));
+                continue;
+            }
+            QString objectString = oidToString(git_tree_entry_id(entry));
+            if (objects.contains(objectString))
+                continue;
+            objects.insert(objectString);
+            if (git_packbuilder_insert(packBuilder, git_tree_entry_id(entry), NULL) != 0) {
+                git_tree_free(tree);
+                return WP::kError;
+            }
+        }
+        git_tree_free(tree);
+    }
+    return WP::kOk;
+}
+
+//! adds all objects reachable from a ref to the pack builder
+static WP::err insertReachableObjects(git_repository *repository, git_packbuilder *packBuilder,
+                                      QSet<QString> &objects)
+{
+    git_revwalk *walker;
+    if (git_revwalk_new(&walker, repository) != 0)
+        return WP::kError;
+
+    git_strarray refList;
+    if (git_reference_list(&refList, repository) != 0) {
+        git_revwalk_free(walker);
+        return WP::kError;
+    }
+    for (unsigned int i = 0; i < refList.count; i++) {
+        git_oid refTarget;
+        if (git_reference_name_to_id(&refTarget, repository, refList.strings[i]) != 0)
+            continue;
+        git_revwalk_push(walker, &refTarget);
+    }
+    git_strarray_free(&refList);
+
+    WP::err error = WP::kOk;
+    git_oid commitId;
+    while (error == WP::kOk && git_revwalk_next(&commitId, walker) == 0) {
+        objects.insert(oidToString(&commitId));
+        if (git_packbuilder_insert(packBuilder, &commitId, NULL) != 0) {
+            error = WP::kError;
+            break;
+        }
+        git_commit *commit;
+        if (git_commit_lookup(&commit, repository, &commitId) != 0) {
+            error = WP::kError;
+            break;
+        }
+        error = insertTree(repository, packBuilder, git_commit_tree_id(commit), objects);
+        git_commit_free(commit);
+    }
+    git_revwalk_free(walker);
+    return error;
+}
+
+//! reads the object ids of a version 2 pack index
+static bool readPackIndex(const QString &indexPath, QList<git_oid> &objects)
+{
+    const int kHeaderSize = 8;
+    const int kFanOutSize = 256 * 4;
+
+    QFile file(indexPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray data = file.readAll();
+    if (data.size() < kHeaderSize + kFanOutSize || !data.startsWith("\377tOc"))
+        return false;
+    const uchar *raw = (const uchar*)data.constData();
+    if (qFromBigEndian<quint32>(raw + 4) != 2)
+        return false;
+    // the last fan out entry is the number of objects
+    quint32 count = qFromBigEndian<quint32>(raw + kHeaderSize + kFanOutSize - 4);
+    if ((quint64)data.size() < kHeaderSize + kFanOutSize + (quint64)count * GIT_OID_RAWSZ)
+        return false;
+
+    const uchar *ids = raw + kHeaderSize + kFanOutSize;
+    for (quint32 i = 0; i < count; i++) {
+        git_oid oid;
+        git_oid_fromraw(&oid, ids + i * GIT_OID_RAWSZ);
+        objects.append(oid);
+    }
+    return true;
+}
+
+//! object database that writes loose objects, also if the object is already in a pack
+static WP::err openLooseDatabase(git_odb **looseDatabase, const QString &repositoryPath)
+{
+    git_odb_backend *backend;
+    if (git_odb_backend_loose(&backend, (repositoryPath + "/objects").toLatin1().data(), -1, 0) != 0)
+        return WP::kError;
+    if (git_odb_new(looseDatabase) != 0) {
+        backend->free(backend);
+        return WP::kError;
+    }
+    if (git_odb_add_backend(*looseDatabase, backend, 1) != 0) {
+        backend->free(backend);
+        git_odb_free(*looseDatabase);
+        *looseDatabase = NULL;
+        return WP::kError;
+    }
+    return WP::kOk;
+}
+
+//! writes the objects of an old pack that are not in the new pack as fresh loose objects
+static WP::err unpackUnreachableObjects(const QString &repositoryPath, git_odb *objectDatabase,
+                                        git_odb *looseDatabase, const QString &indexPath,
+                                        const QSet<QString> &packed)
+{
+    QList<git_oid> objects;
+    if (!readPackIndex(indexPath, objects))
+        return WP::kError;
+
+    foreach (const git_oid &oid, objects) {
+        QString hash = oidToString(&oid);
+        if (packed.contains(hash))
+            continue;
+        // an existing loose copy might be old
+        if (RepositoryMaintenance::freshenLooseObject(repositoryPath, hash))
+            continue;
+        git_odb_object *object;
+        if (git_odb_read(&object, objectDatabase, &oid) != 0)
+            return WP::kError;
+        git_oid written;
+        int error = git_odb_write(&written, looseDatabase, git_odb_object_data(object),
+                                  git_odb_object_size(object), git_odb_object_type(object));
+        git_odb_object_free(object);
+        if (error != 0)
+            return WP::kError;
+    }
+    return WP::kOk;
+}
+
+WP::err RepositoryMaintenance::maintain(const QString &repositoryPath, const QDateTime &expiry)
+{
+    git_repository *repository;
+    if (git_repository_open(&repository, repositoryPath.toLatin1().data()) != 0)
+        return WP::kError;
+
+    QDir packDir(repositoryPath + "/objects/pack");
+    if (!packDir.exists())
+        packDir.mkpath(".");
+    QStringList packFilter;
+    packFilter << "pack-*.pack";
+    QStringList oldPacks = packDir.entryList(packFilter, QDir::Files);
+
+    // the pack builder finds the deltas
+    QSet<QString> packed;
+    git_packbuilder *packBuilder = NULL;
+    WP::err error = WP::kError;
+    if (git_packbuilder_new(&packBuilder, repository) == 0
+            && insertReachableObjects(repository, packBuilder, packed) == WP::kOk) {
+        error = WP::kOk;
+        if (!packed.isEmpty() && git_packbuilder_write(packBuilder, packDir.path().toLatin1().data(),
+                                                       NULL, NULL) != 0)
+            error = WP::kError;
+    }
+    git_packbuilder_free(packBuilder);
+    if (error != WP::kOk) {
+        git_repository_free(repository);
+        return error;
+    }
+
+    // the new pack contains everything reachable, old packs are obsolete now; if the new pack has
+    // the same name as an old one nothing changed
+    QStringList newPacks = packDir.entryList(packFilter, QDir::Files);
+    bool packChanged = false;
+    foreach (const QString &pack, newPacks) {
+        if (!oldPacks.contains(pack))
+            packChanged = true;
+    }
+    if (packChanged && !oldPacks.isEmpty()) {
+        // Objects only in old packs might be used by a commit that is made right now; they get
+        // the same grace period as loose objects.
+        git_odb *objectDatabase = NULL;
+        git_odb *looseDatabase = NULL;
+        bool databasesOk = git_repository_odb(&objectDatabase, repository) == 0
+            && openLooseDatabase(&looseDatabase, repositoryPath) == WP::kOk;
+
+        foreach (const QString &pack, oldPacks) {
+            QString baseName = pack.left(pack.length() - QString(".pack").length());
+            // keep the pack if its objects can't be saved
+            if (!databasesOk || unpackUnreachableObjects(repositoryPath, objectDatabase,
+                    looseDatabase, packDir.filePath(baseName + ".idx"), packed) != WP::kOk)
+                continue;
+            packDir.remove(baseName + ".idx");
+            packDir.remove(pack);
+        }
+        git_odb_free(looseDatabase);
+        git_odb_free(objectDatabase);
+    }
+    git_repository_free(repository);
+
+    pruneLooseObjects(repositoryPath, packed, expiry);
+    return WP::kOk;
+}
+
+bool RepositoryMaintenance::freshenLooseObject(const QString &repositoryPath, const QString &hash)
+{
+    QString path = repositoryPath + "/objects/" + hash.left(2) + "/" + hash.mid(2);
+    // NULL sets the times to now
+    return utime(QFile::encodeName(path).constData(), NULL) == 0;
+}
+
+void RepositoryMaintenance::pruneLooseObjects(const QString &repositoryPath,
+                                              const QSet<QString> &packed, const QDateTime &expiry)
+{
+    QDir objectsDir(repositoryPath + "/objects");
+    foreach (const QString &fanOut, objectsDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        if (fanOut.length() != 2)
+            continue;
+        QDir dir(objectsDir.filePath(fanOut));
+        foreach (const QFileInfo &file, dir.entryInfoList(QDir::Files)) {
+            // keep new unreachable objects, they might not be referenced yet
+            if (!packed.contains(fanOut + file.fileName()) && file.lastModified() > expiry)
+                continue;
+            dir.remove(file.fileName());
+        }
+        objectsDir.rmdir(fanOut);
+    }
+}
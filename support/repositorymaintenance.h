@@ -0,0 +1,62 @@
+#ifndef REPOSITORYMAINTENANCE_H
+#define REPOSITORYMAINTENANCE_H
+
+#include <QDateTime>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+
+#include "error_codes.h"
+
+
+/*! Keeps the object stores of the repositories small. Databases report when they wrote new objects.
+Once things are idle and a repository has enough loose objects, all reachable objects are packed
+and the loose objects are pruned. The work is done in the thread pool and uses its own repository
+handle.
+
+Commits can be made while maintenance runs, so unreachable objects are never removed right away:
+unreachable objects of old packs are written out as loose objects and loose objects are only pruned
+once they are older than the expiry. Databases freshen the loose objects they write again (see
+freshenLooseObject), an old unreachable object that is used again is kept.
+*/
+class RepositoryMaintenance : public QObject
+{
+Q_OBJECT
+public:
+    static RepositoryMaintenance *get();
+
+    //! called after objects have been written to the repository
+    void objectsWritten(const QString &repositoryPath);
+    bool isRunning(const QString &repositoryPath) const;
+
+    //! estimates the number of loose objects from a single fan out directory
+    static int estimateLooseObjects(const QString &repositoryPath);
+    /*! Packs all objects reachable from a ref and removes loose objects that are packed now or
+    are unreachable and older than expiry. Old packs are replaced, their unreachable objects become
+    loose objects. Blocks till done. */
+    static WP::err maintain(const QString &repositoryPath, const QDateTime &expiry);
+    //! sets the modification time of a loose object to now; false if there is no such object
+    static bool freshenLooseObject(const QString &repositoryPath, const QString &hash);
+
+signals:
+    void maintenanceFinished(const QString &repositoryPath, WP::err error);
+
+private slots:
+    void checkPending();
+    void onMaintenanceDone(const QString &repositoryPath, int error);
+
+private:
+    RepositoryMaintenance(QObject *parent = NULL);
+
+    static void pruneLooseObjects(const QString &repositoryPath, const QSet<QString> &packed,
+                                  const QDateTime &expiry);
+
+    static RepositoryMaintenance *sMaintenance;
+
+    QSet<QString> pending;
+    QSet<QString> running;
+    QTimer idleTimer;
+};
+
+#endif // REPOSITORYMAINTENANCE_H
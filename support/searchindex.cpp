@@ -0,0 +1,276 @@
+#include "searchindex.h"
+
+#include <QDataStream>
+#include <QtAlgorithms>
+
+#include "databaseutil.h"
+
+
+const char *kSearchIndexMagic = "FSI1";
+
+
+SearchIndex::PostingList::PostingList() :
+    lastDocument(0),
+    count(0)
+{
+}
+
+SearchIndex::SearchIndex() :
+    dirty(false)
+{
+}
+
+void SearchIndex::clear()
+{
+    commit = "";
+    documents.clear();
+    documentPaths.clear();
+    postings.clear();
+    dirty = false;
+}
+
+const QString &SearchIndex::getCommit() const
+{
+    return commit;
+}
+
+void SearchIndex::setCommit(const QString &_commit)
+{
+    if (commit == _commit)
+        return;
+    commit = _commit;
+    dirty = true;
+}
+
+void SearchIndex::addDocument(const QString &path, qint64 timestamp, const QString &text)
+{
+    if (documentPaths.contains(path))
+        return;
+
+    quint32 id = documents.count();
+    Document document;
+    document.path = path;
+    document.timestamp = timestamp;
+    documents.append(document);
+    documentPaths.insert(path);
+
+    QSet<QString> words = tokenize(text).toSet();
+    foreach (const QString &word, words) {
+        PostingList &list = postings[word];
+        // ids only grow; the first entry is the id itself
+        appendVarInt(list.data, list.count == 0 ? id : id - list.lastDocument);
+        list.lastDocument = id;
+        list.count++;
+    }
+    dirty = true;
+}
+
+int SearchIndex::getDocumentCount() const
+{
+    return documents.count();
+}
+
+QStringList SearchIndex::search(const QString &query, int maxResults) const
+{
+    QStringList words = tokenize(query);
+    if (words.isEmpty())
+        return QStringList();
+
+    QList<const PostingList*> lists;
+    foreach (const QString &word, words) {
+        QHash<QString, PostingList>::const_iterator it = postings.find(word);
+        if (it == postings.end())
+            return QStringList();
+        lists.append(&it.value());
+    }
+    // start with the shortest list, the intersection can only get smaller
+    qSort(lists.begin(), lists.end(), postingListLessThan);
+
+    QVector<quint32> matches;
+    if (!decodePostings(*lists.at(0), matches))
+        return QStringList();
+    for (int i = 1; i < lists.count() && !matches.isEmpty(); i++) {
+        QVector<quint32> ids;
+        if (!decodePostings(*lists.at(i), ids))
+            return QStringList();
+        QVector<quint32> intersection;
+        int a = 0;
+        int b = 0;
+        while (a < matches.count() && b < ids.count()) {
+            if (matches.at(a) < ids.at(b))
+                a++;
+            else if (ids.at(b) < matches.at(a))
+                b++;
+            else {
+                intersection.append(matches.at(a));
+                a++;
+                b++;
+            }
+        }
+        matches = intersection;
+    }
+
+    QVector<const Document*> results;
+    results.reserve(matches.count());
+    foreach (quint32 id, matches) {
+        if (id < (quint32)documents.count())
+            results.append(&documents.at(id));
+    }
+    qStableSort(results.begin(), results.end(), newerThan);
+
+    QStringList paths;
+    for (int i = 0; i < results.count(); i++) {
+        if (maxResults >= 0 && i >= maxResults)
+            break;
+        paths.append(results.at(i)->path);
+    }
+    return paths;
+}
+
+QStringList SearchIndex::tokenize(const QString &text)
+{
+    QStringList words;
+    QString word;
+    for (int i = 0; i < text.size(); i++) {
+        QChar character = text.at(i);
+        if (character.isLetterOrNumber()) {
+            word += character.toLower();
+            continue;
+        }
+        if (word.size() >= kMinWordLength)
+            words.append(word);
+        word.clear();
+    }
+    if (word.size() >= kMinWordLength)
+        words.append(word);
+    return words;
+}
+
+void SearchIndex::appendVarInt(QByteArray &data, quint32 value)
+{
+    // 7 bits per byte, the high bit is set if more bytes follow
+    while (value >= 0x80) {
+        data.append((char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    data.append((char)value);
+}
+
+bool SearchIndex::readVarInt(const QByteArray &data, int &position, quint32 &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (position >= data.size())
+            return false;
+        quint8 byte = (quint8)data.at(position);
+        position++;
+        value |= (quint32)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool SearchIndex::decodePostings(const PostingList &postings, QVector<quint32> &documentIds)
+{
+    // each id takes at least one byte; the count may come from a corrupt file
+    if (postings.count > (quint32)postings.data.size())
+        return false;
+    documentIds.reserve(postings.count);
+    int position = 0;
+    quint32 id = 0;
+    for (quint32 i = 0; i < postings.count; i++) {
+        quint32 delta;
+        if (!readVarInt(postings.data, position, delta))
+            return false;
+        id += delta;
+        documentIds.append(id);
+    }
+    return true;
+}
+
+bool SearchIndex::postingListLessThan(const PostingList *list1, const PostingList *list2)
+{
+    return list1->count < list2->count;
+}
+
+bool SearchIndex::newerThan(const Document *document1, const Document *document2)
+{
+    return document1->timestamp > document2->timestamp;
+}
+
+/* Format: magic, commit, number of documents and the documents as path and timestamp, number of
+ * words and the posting lists as word, number of entries, last document id and the encoded ids.
+ */
+void SearchIndex::toData(QByteArray &data) const
+{
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << QByteArray(kSearchIndexMagic) << commit << (quint32)documents.count();
+    foreach (const Document &document, documents)
+        stream << document.path << document.timestamp;
+    stream << (quint32)postings.count();
+    QHash<QString, PostingList>::const_iterator it;
+    for (it = postings.constBegin(); it != postings.constEnd(); ++it) {
+        const PostingList &list = it.value();
+        stream << it.key() << list.count << list.lastDocument << list.data;
+    }
+}
+
+WP::err SearchIndex::fromData(const QByteArray &data)
+{
+    clear();
+    QDataStream stream(data);
+    QByteArray magic;
+    quint32 count = 0;
+    stream >> magic >> commit >> count;
+    if (magic != kSearchIndexMagic) {
+        commit = "";
+        return WP::kBadValue;
+    }
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        Document document;
+        stream >> document.path >> document.timestamp;
+        documents.append(document);
+        documentPaths.insert(document.path);
+    }
+    quint32 wordCount = 0;
+    stream >> wordCount;
+    for (quint32 i = 0; i < wordCount && stream.status() == QDataStream::Ok; i++) {
+        QString word;
+        PostingList list;
+        stream >> word >> list.count >> list.lastDocument >> list.data;
+        postings.insert(word, list);
+    }
+    if (stream.status() != QDataStream::Ok || (quint32)documents.count() != count
+        || (quint32)postings.count() != wordCount) {
+        clear();
+        return WP::kBadValue;
+    }
+    return WP::kOk;
+}
+
+WP::err SearchIndex::load(const QString &fileName, const EncryptedUserData *cipher)
+{
+    clear();
+    QByteArray data;
+    WP::err error = cipher->readSafeFile(fileName, data);
+    if (error != WP::kOk)
+        return error;
+    return fromData(data);
+}
+
+WP::err SearchIndex::save(const QString &fileName, const EncryptedUserData *cipher)
+{
+    QByteArray data;
+    toData(data);
+    WP::err error = cipher->writeSafeFile(fileName, data);
+    if (error != WP::kOk)
+        return error;
+    dirty = false;
+    return WP::kOk;
+}
+
+bool SearchIndex::isDirty() const
+{
+    return dirty;
+}
@@ -0,0 +1,83 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "error_codes.h"
+
+
+class EncryptedUserData;
+
+/*! Inverted full-text index. Each document is identified by a path and has a timestamp; search
+results are the paths of the documents that contain all query words, newest first. Document ids
+are handed out in insertion order, so a posting list is stored as the deltas between its ids,
+each encoded as a varint.
+
+Like the path index, the index belongs to a commit and is stored outside of the database;
+the stored index is encrypted.
+*/
+class SearchIndex {
+public:
+    SearchIndex();
+
+    void clear();
+    //! the commit the index is for
+    const QString &getCommit() const;
+    void setCommit(const QString &commit);
+
+    //! documents that are already in the index are ignored
+    void addDocument(const QString &path, qint64 timestamp, const QString &text);
+    int getDocumentCount() const;
+    //! maxResults < 0 returns all matches
+    QStringList search(const QString &query, int maxResults = -1) const;
+
+    //! lower case words of at least kMinWordLength characters
+    static QStringList tokenize(const QString &text);
+
+    void toData(QByteArray &data) const;
+    WP::err fromData(const QByteArray &data);
+
+    //! the index is encrypted with the default key of cipher
+    WP::err load(const QString &fileName, const EncryptedUserData *cipher);
+    WP::err save(const QString &fileName, const EncryptedUserData *cipher);
+    //! true if the index changed since it was loaded or saved
+    bool isDirty() const;
+
+    static const int kMinWordLength = 2;
+
+private:
+    class Document {
+    public:
+        QString path;
+        qint64 timestamp;
+    };
+
+    class PostingList {
+    public:
+        PostingList();
+
+        QByteArray data;
+        quint32 lastDocument;
+        quint32 count;
+    };
+
+    static void appendVarInt(QByteArray &data, quint32 value);
+    static bool readVarInt(const QByteArray &data, int &position, quint32 &value);
+    static bool decodePostings(const PostingList &postings, QVector<quint32> &documentIds);
+    static bool postingListLessThan(const PostingList *list1, const PostingList *list2);
+    static bool newerThan(const Document *document1, const Document *document2);
+
+    QString commit;
+    //! the document id is the position
+    QVector<Document> documents;
+    QSet<QString> documentPaths;
+    QHash<QString, PostingList> postings;
+    bool dirty;
+};
+
+#endif // SEARCHINDEX_H
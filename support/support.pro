@@ -16,12 +16,17 @@ SOURCES += \
     diffmonitor.cpp \
     gitinterface.cpp \
     logger.cpp \
+    notificationchannel.cpp \
+    pathindex.cpp \
+    protocolcompression.cpp \
     protocolparser.cpp \
     remoteauthentication.cpp \
     remoteconnection.cpp \
     remoteconnectionmanager.cpp \
     remotestorage.cpp \
     remotesync.cpp \
+    repositorymaintenance.cpp \
+    searchindex.cpp \
     syncmanager.cpp \
 
 HEADERS += \
@@ -38,6 +43,9 @@ HEADERS += \
     error_codes.h \
     gitinterface.h \
     logger.h \
+    notificationchannel.h \
+    pathindex.h \
+    protocolcompression.h \
     protocolparser.h \
     diffmonitor.h \
     remoteauthentication.h \
@@ -45,4 +53,6 @@ HEADERS += \
     remoteconnectionmanager.h \
     remotestorage.h \
     remotesync.h \
+    repositorymaintenance.h \
+    searchindex.h \
     syncmanager.h \
@@ -1,10 +1,15 @@
 #include "syncmanager.h"
 
+#include <QTimer>
+
+#include "notificationchannel.h"
 #include "protocolparser.h"
 #include "remoteauthentication.h"
 
 
 const char *kWatchBranchesStanza = "watch_branches";
+const int kNotificationChannelReopenDelay = 5000;
+const int kMaxNotificationChannelFailures = 3;
 
 
 class WatchBranchesStanza : public OutStanza {
@@ -29,6 +34,11 @@ SyncManager::SyncManager(RemoteDataStorage *remoteDataStorage, QObject *parent)
     remoteConnection(NULL),
     serverReply(NULL),
     jobQueue(NULL),
+    batchSyncRunning(false),
+    batchSyncSupported(true),
+    notificationChannel(NULL),
+    useNotificationChannel(true),
+    notificationChannelFailures(0),
     watching(false)
 {
 }
@@ -36,6 +46,7 @@ SyncManager::SyncManager(RemoteDataStorage *remoteDataStorage, QObject *parent)
 SyncManager::~SyncManager()
 {
     abort();
+    delete notificationChannel;
 }
 
 WP::err SyncManager::keepSynced(DatabaseInterface *branch)
@@ -53,7 +64,15 @@ WP::err SyncManager::keepSynced(DatabaseInterface *branch)
         syncEntries.prepend(entry);
     else
         syncEntries.append(entry);
-
+    connect(entry.data(), SIGNAL(jobDone(WP::err)), this, SLOT(branchSyncDone(WP::err)));
+    // local commits are not reported by the notification channel
+    connect(branch, SIGNAL(newCommits(QString,QString)), this, SLOT(onLocalCommits()));
+
+    // the notification channel reports all branches, only sync the new branch once
+    if (notificationChannel != NULL && notificationChannel->isOpen()) {
+        syncBranches(QStringList(branch->branch()));
+        return WP::kOk;
+    }
     if (watching)
         restartWatching();
     return WP::kOk;
@@ -104,11 +123,154 @@ void SyncManager::restartWatching()
 
 void SyncManager::syncBranches(const QStringList &branches)
 {
+    if (!batchSyncSupported) {
+        syncBranchesSeparately(branches);
+        return;
+    }
+    // sync the branches once the running batch is done, see batchSyncDone
+    if (batchSyncRunning) {
+        foreach (const QString &branch, branches) {
+            if (!pendingBranches.contains(branch))
+                pendingBranches.append(branch);
+        }
+        return;
+    }
+
+    // syncEntries has the identities first so they are also processed first in the batch
+    QList<DatabaseInterface*> databases;
+    foreach (const RemoteSyncRef &entry, syncEntries) {
+        if (branches.contains(entry->getDatabase()->branch()))
+            databases.append(entry->getDatabase());
+    }
+    if (databases.isEmpty())
+        return;
+
+    batchSync = RemoteBatchSyncRef(new RemoteBatchSync(databases, remoteDataStorage));
+    connect(batchSync.data(), SIGNAL(jobDone(WP::err)), this, SLOT(batchSyncDone(WP::err)));
+    batchSyncRunning = true;
+    jobQueue->queue(batchSync);
+}
+
+void SyncManager::syncBranchesSeparately(const QStringList &branches)
+{
+    // The identities entry is always the first in the list (see keepSynced), all other branches
+    // may be synced in parallel once the identities are up to date.
+    RemoteConnectionJobRef identitiesSync;
     foreach (const RemoteSyncRef &entry, syncEntries) {
         if (!branches.contains(entry->getDatabase()->branch()))
             continue;
-        jobQueue->queue(entry);
+        jobQueue->queue(entry, identitiesSync);
+        if (entry->getDatabase()->branch() == "identities")
+            identitiesSync = entry;
+    }
+}
+
+bool SyncManager::startNotificationChannel()
+{
+    if (!useNotificationChannel)
+        return false;
+
+    if (notificationChannel == NULL) {
+        notificationChannel = remoteConnection->createNotificationChannel();
+        if (notificationChannel == NULL) {
+            useNotificationChannel = false;
+            return false;
+        }
+        connect(notificationChannel, SIGNAL(branchTipChanged(QString,QString)),
+                this, SLOT(onBranchTipChanged(QString,QString)));
+        connect(notificationChannel, SIGNAL(closed(WP::err)),
+                this, SLOT(onNotificationChannelClosed(WP::err)));
+    }
+    // the channel stays open while other jobs are running, nothing to do if it is still open
+    if (!notificationChannel->isOpen())
+        notificationChannel->open();
+    return true;
+}
+
+void SyncManager::addPendingBranch(const QString &branch)
+{
+    if (pendingBranches.contains(branch))
+        return;
+    // collect the branches that change together, e.g., the tips after opening the channel
+    if (pendingBranches.isEmpty())
+        QTimer::singleShot(0, this, SLOT(syncPendingBranches()));
+    pendingBranches.append(branch);
+}
+
+void SyncManager::syncLocalChanges()
+{
+    foreach (const RemoteSyncRef &entry, syncEntries) {
+        DatabaseInterface *database = entry->getDatabase();
+        QString branch = database->branch();
+        QString tip = database->getTip();
+        // a failed sync is not retried before the tip changes, otherwise it would be retried on
+        // every restart
+        if (tip == remoteTips.value(branch) || tip == syncedTips.value(branch))
+            continue;
+        addPendingBranch(branch);
+    }
+}
+
+void SyncManager::onBranchTipChanged(const QString &branch, const QString &tip)
+{
+    notificationChannelFailures = 0;
+    remoteTips[branch] = tip;
+
+    foreach (const RemoteSyncRef &entry, syncEntries) {
+        DatabaseInterface *database = entry->getDatabase();
+        if (database->branch() != branch)
+            continue;
+        if (database->getTip() != tip)
+            addPendingBranch(branch);
+        return;
+    }
+}
+
+void SyncManager::onLocalCommits()
+{
+    DatabaseInterface *database = qobject_cast<DatabaseInterface*>(sender());
+    if (database == NULL)
+        return;
+    // e.g., the commits of a pull
+    if (database->getTip() == remoteTips.value(database->branch()))
+        return;
+    addPendingBranch(database->branch());
+}
+
+void SyncManager::syncPendingBranches()
+{
+    QStringList branches = pendingBranches;
+    pendingBranches.clear();
+    syncBranches(branches);
+}
+
+void SyncManager::onNotificationChannelClosed(WP::err error)
+{
+    if (error == WP::kOk) {
+        // closed by the server, e.g., because of a time limit
+        reopenNotificationChannel();
+        return;
+    }
+
+    notificationChannelFailures++;
+    if (notificationChannelFailures < kMaxNotificationChannelFailures) {
+        QTimer::singleShot(kNotificationChannelReopenDelay, this, SLOT(reopenNotificationChannel()));
+        return;
     }
+
+    // server does not support the channel, fall back to watch_branches
+    useNotificationChannel = false;
+    notificationChannel->deleteLater();
+    notificationChannel = NULL;
+    if (watching)
+        remoteAuthenticated(WP::kOk);
+}
+
+void SyncManager::reopenNotificationChannel()
+{
+    if (notificationChannel == NULL || notificationChannel->isOpen())
+        return;
+    notificationChannel->open();
 }
 
 void SyncManager::handleConnectionError(WP::err error)
@@ -127,6 +289,15 @@ void SyncManager::remoteAuthenticated(WP::err error)
         return;
     }
 
+    // prefer pushed notifications over polling
+    bool channelOpen = (notificationChannel != NULL && notificationChannel->isOpen());
+    if (startNotificationChannel()) {
+        // restarted after another job, catch up on commits the channel doesn't report
+        if (channelOpen)
+            syncLocalChanges();
+        return;
+    }
+
     QByteArray outData;
     ProtocolOutStream outStream(&outData);
 
@@ -235,3 +406,41 @@ void SyncManager::watchReply(WP::err error)
     } else // try again
         restartWatching();
 }
+
+void SyncManager::batchSyncDone(WP::err error)
+{
+    batchSyncRunning = false;
+
+    RemoteBatchSync *sync = qobject_cast<RemoteBatchSync*>(sender());
+    if (sync != NULL && sync->isSupportedByServer()) {
+        foreach (DatabaseInterface *database, sync->getDatabases())
+            syncedTips[database->branch()] = database->getTip();
+    }
+    if (sync != NULL && !sync->isSupportedByServer()) {
+        // old server, fall back to one sync job per branch
+        batchSyncSupported = false;
+        QStringList branches;
+        foreach (DatabaseInterface *database, sync->getDatabases())
+            branches.append(database->branch());
+        foreach (const QString &branch, pendingBranches) {
+            if (!branches.contains(branch))
+                branches.append(branch);
+        }
+        pendingBranches.clear();
+        syncBranchesSeparately(branches);
+        return;
+    }
+
+    // branches that changed while the batch was running
+    if (!pendingBranches.isEmpty())
+        syncPendingBranches();
+}
+
+void SyncManager::branchSyncDone(WP::err error)
+{
+    RemoteSync *sync = qobject_cast<RemoteSync*>(sender());
+    if (sync == NULL)
+        return;
+    DatabaseInterface *database = sync->getDatabase();
+    syncedTips[database->branch()] = database->getTip();
+}
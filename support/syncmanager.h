@@ -1,11 +1,13 @@
 #ifndef SYNCMANAGER_H
 #define SYNCMANAGER_H
 
+#include <QMap>
 #include <QObject>
 
 #include "remotestorage.h"
 #include "remotesync.h"
 
+class RemoteNotificationChannel;
 
 class SyncManager : public RemoteConnectionJob
 {
@@ -23,8 +25,14 @@ public:
 private:
     void startWatching();
     void restartWatching();
+    bool startNotificationChannel();
 
     void syncBranches(const QStringList &branches);
+    void syncBranchesSeparately(const QStringList &branches);
+    //! syncs the branch with the next batch of pending branches
+    void addPendingBranch(const QString &branch);
+    //! the server doesn't report local commits, sync the branches that are ahead of it
+    void syncLocalChanges();
     void handleConnectionError(WP::err error);
 
 signals:
@@ -35,6 +43,13 @@ signals:
 private slots:
     void remoteAuthenticated(WP::err error);
     void watchReply(WP::err error);
+    void batchSyncDone(WP::err error);
+    void branchSyncDone(WP::err error);
+    void onBranchTipChanged(const QString &branch, const QString &tip);
+    void onLocalCommits();
+    void syncPendingBranches();
+    void onNotificationChannelClosed(WP::err error);
+    void reopenNotificationChannel();
 
 private:
     friend class SyncEntry;
@@ -48,6 +63,19 @@ private:
     RemoteConnectionReply *serverReply;
 
     RemoteConnectionJobQueue *jobQueue;
+    RemoteBatchSyncRef batchSync;
+    //! only one batch runs at a time, it works on the same databases as the next one
+    bool batchSyncRunning;
+    bool batchSyncSupported;
+
+    RemoteNotificationChannel *notificationChannel;
+    bool useNotificationChannel;
+    int notificationChannelFailures;
+    QStringList pendingBranches;
+    //! last tips reported by the notification channel
+    QMap<QString, QString> remoteTips;
+    //! local tips at the end of the last sync of each branch
+    QMap<QString, QString> syncedTips;
 
     bool watching;
 };
@@ -0,0 +1,109 @@
+#include "fakeconnection.h"
+
+#include <QTimer>
+
+#include "notificationchannel.h"
+
+
+FakeConnectionReply::FakeConnectionReply(const QByteArray &data, QObject *parent) :
+    RemoteConnectionReply(&buffer, parent),
+    aborted(false)
+{
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+    QTimer::singleShot(0, this, SLOT(finish()));
+}
+
+void FakeConnectionReply::abort()
+{
+    aborted = true;
+}
+
+void FakeConnectionReply::finish()
+{
+    if (!aborted)
+        emit finished(WP::kOk);
+}
+
+
+FakeConnection::FakeConnection(const QUrl &notificationUrl, QObject *parent) :
+    RemoteConnection(parent),
+    notificationUrl(notificationUrl),
+    tipEventCount(0)
+{
+}
+
+WP::err FakeConnection::connectToServer()
+{
+    setConnected();
+    emit connectionAttemptFinished(WP::kOk);
+    return WP::kOk;
+}
+
+WP::err FakeConnection::disconnectFromServer()
+{
+    setDisconnected();
+    return WP::kOk;
+}
+
+RemoteConnectionReply *FakeConnection::send(const QByteArray &data)
+{
+    requests.append(data);
+    QByteArray replyData;
+    QMap<QByteArray, QByteArray>::const_iterator it;
+    for (it = replies.constBegin(); it != replies.constEnd(); ++it) {
+        if (data.contains(it.key())) {
+            replyData = it.value();
+            break;
+        }
+    }
+    return new FakeConnectionReply(replyData, this);
+}
+
+RemoteNotificationChannel *FakeConnection::createNotificationChannel()
+{
+    RemoteNotificationChannel *channel = new SSENotificationChannel(notificationUrl);
+    connect(channel, SIGNAL(branchTipChanged(QString,QString)), this, SLOT(onBranchTipChanged()));
+    return channel;
+}
+
+void FakeConnection::setReply(const QByteArray &request, const QByteArray &reply)
+{
+    replies[request] = reply;
+}
+
+const QList<QByteArray> &FakeConnection::getRequests() const
+{
+    return requests;
+}
+
+int FakeConnection::getTipEventCount() const
+{
+    return tipEventCount;
+}
+
+void FakeConnection::onBranchTipChanged()
+{
+    tipEventCount++;
+}
+
+
+FakeAuthentication::FakeAuthentication(RemoteConnection *connection) :
+    RemoteAuthentication(connection)
+{
+}
+
+void FakeAuthentication::handleConnectionAttempt(WP::err code)
+{
+    connection->disconnect(this);
+    if (code != WP::kOk) {
+        setAuthenticationCanceled(code);
+        return;
+    }
+    setAuthenticationSucceeded();
+}
+
+void FakeAuthentication::getLogoutData(QByteArray &data)
+{
+    data.clear();
+}
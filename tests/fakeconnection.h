@@ -0,0 +1,75 @@
+#ifndef FAKECONNECTION_H
+#define FAKECONNECTION_H
+
+#include <QBuffer>
+#include <QList>
+#include <QMap>
+#include <QUrl>
+
+#include "remoteauthentication.h"
+#include "remoteconnection.h"
+
+
+//! Reply that finishes with the given data once the event loop runs.
+class FakeConnectionReply : public RemoteConnectionReply
+{
+Q_OBJECT
+public:
+    FakeConnectionReply(const QByteArray &data, QObject *parent = NULL);
+
+    virtual void abort();
+
+private slots:
+    void finish();
+
+private:
+    QBuffer buffer;
+    bool aborted;
+};
+
+
+/*! Records all requests instead of sending them. A request that contains one of the keys set with
+setReply() is answered with the value, all other requests get an empty reply. The notification
+channel goes to notificationUrl. */
+class FakeConnection : public RemoteConnection
+{
+Q_OBJECT
+public:
+    FakeConnection(const QUrl &notificationUrl, QObject *parent = NULL);
+
+    virtual WP::err connectToServer();
+    virtual WP::err disconnectFromServer();
+    virtual RemoteConnectionReply *send(const QByteArray &data);
+    virtual RemoteNotificationChannel *createNotificationChannel();
+
+    void setReply(const QByteArray &request, const QByteArray &reply);
+    const QList<QByteArray> &getRequests() const;
+    //! number of tips the created notification channel has reported
+    int getTipEventCount() const;
+
+private slots:
+    void onBranchTipChanged();
+
+private:
+    QUrl notificationUrl;
+    QMap<QByteArray, QByteArray> replies;
+    QList<QByteArray> requests;
+    int tipEventCount;
+};
+
+
+//! Authentication that succeeds as soon as the connection is established.
+class FakeAuthentication : public RemoteAuthentication
+{
+Q_OBJECT
+public:
+    FakeAuthentication(RemoteConnection *connection);
+
+protected slots:
+    virtual void handleConnectionAttempt(WP::err code);
+
+protected:
+    virtual void getLogoutData(QByteArray &data);
+};
+
+#endif // FAKECONNECTION_H
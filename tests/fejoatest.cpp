@@ -2,6 +2,16 @@
 #include <QtTest>
 
 #include "cryptointerface.h"
+#include "fakeconnection.h"
+#include "gitinterface.h"
+#include "localnotificationserver.h"
+#include "notificationchannel.h"
+#include "protocolcompression.h"
+#include "protocolparser.h"
+#include "remotestorage.h"
+#include "repositorymaintenance.h"
+#include "searchindex.h"
+#include "syncmanager.h"
 
 class FejoaTest : public QObject
 {
@@ -12,6 +22,17 @@ public:
 
 private Q_SLOTS:
     void testCyrptoInterface();
+    void testPathIndex();
+    void testBulkRead();
+    void testMergeLastWriterWins();
+    void testSearchIndex();
+    void testRepositoryMaintenance();
+    void testNotificationChannel();
+    void testProtocolCompression();
+    void benchmarkProtocolCompression();
+
+private:
+    QList<QByteArray> loadTraffic();
 };
 
 FejoaTest::FejoaTest()
@@ -59,6 +80,430 @@ void FejoaTest::testCyrptoInterface()
     QVERIFY2(plain == kTestString, "symmetric decrypted text == plain?");
 }
 
-QTEST_APPLESS_MAIN(FejoaTest)
+void FejoaTest::testPathIndex()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString repositoryPath = dir.path() + "/repo";
+
+    GitInterface *database = new GitInterface();
+    QVERIFY(database->setTo(repositoryPath) == WP::kOk);
+    QVERIFY(database->setBranch("test") == WP::kOk);
+    QVERIFY(database->write("a/b/file1", QByteArray("1")) == WP::kOk);
+    QVERIFY(database->write("a/file2", QByteArray("2")) == WP::kOk);
+    QVERIFY(database->commit() == WP::kOk);
+
+    QByteArray data;
+    QVERIFY(database->read("a/b/file1", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("1"));
+    QVERIFY(database->read("a/b/missing", data) != WP::kOk);
+
+    // the index is updated from the diff
+    QVERIFY(database->write("a/b/file1", QByteArray("3")) == WP::kOk);
+    QVERIFY(database->write("c/file4", QByteArray("4")) == WP::kOk);
+    QVERIFY(database->commit() == WP::kOk);
+    QVERIFY(database->read("a/b/file1", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("3"));
+    QVERIFY(database->read("c/file4", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("4"));
+    delete database;
+
+    // the stored index is used by the next instance
+    database = new GitInterface();
+    QVERIFY(database->setTo(repositoryPath) == WP::kOk);
+    QVERIFY(database->setBranch("test") == WP::kOk);
+    QVERIFY(database->read("a/file2", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("2"));
+    QVERIFY(database->read("c/file4", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("4"));
+
+    // changes on top of the stored index
+    QVERIFY(database->write("a/file2", QByteArray("5")) == WP::kOk);
+    QVERIFY(database->write("b/file6", QByteArray("6")) == WP::kOk);
+    QVERIFY(database->commit() == WP::kOk);
+    QVERIFY(database->read("a/file2", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("5"));
+    QVERIFY(database->read("b/file6", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("6"));
+    QVERIFY(database->read("a/b/file1", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("3"));
+    delete database;
+
+    // the changes have been merged into the stored index
+    database = new GitInterface();
+    QVERIFY(database->setTo(repositoryPath) == WP::kOk);
+    QVERIFY(database->setBranch("test") == WP::kOk);
+    QVERIFY(database->read("a/file2", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("5"));
+    QVERIFY(database->read("b/file6", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("6"));
+    QVERIFY(database->read("a/b/file1", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("3"));
+    delete database;
+}
+
+void FejoaTest::testBulkRead()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    GitInterface database;
+    QVERIFY(database.setTo(dir.path() + "/repo") == WP::kOk);
+    QVERIFY(database.setBranch("test") == WP::kOk);
+    QVERIFY(database.write("a/b/file1", QByteArray("1")) == WP::kOk);
+    QVERIFY(database.write("a/file2", QByteArray("2")) == WP::kOk);
+    QVERIFY(database.write("c/file3", QByteArray("3")) == WP::kOk);
+
+    // uncommitted and committed state
+    for (int i = 0; i < 2; i++) {
+        QStringList paths;
+        paths << "a/b/file1" << "c/file3" << "a/missing";
+        QMap<QString, QByteArray> data;
+        QVERIFY(database.readMany(paths, data) == WP::kOk);
+        QCOMPARE(data.count(), 2);
+        QCOMPARE(data["a/b/file1"], QByteArray("1"));
+        QCOMPARE(data["c/file3"], QByteArray("3"));
+
+        data.clear();
+        QVERIFY(database.readTree("a", data) == WP::kOk);
+        QCOMPARE(data.count(), 2);
+        QCOMPARE(data["b/file1"], QByteArray("1"));
+        QCOMPARE(data["file2"], QByteArray("2"));
+        QVERIFY(database.readTree("missing", data) != WP::kOk);
+
+        if (i == 0)
+            QVERIFY(database.commit() == WP::kOk);
+    }
+}
+
+void FejoaTest::testMergeLastWriterWins()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    GitInterface deviceA;
+    QVERIFY(deviceA.setTo(dir.path() + "/a") == WP::kOk);
+    QVERIFY(deviceA.setBranch("test") == WP::kOk);
+    GitInterface deviceB;
+    QVERIFY(deviceB.setTo(dir.path() + "/b") == WP::kOk);
+    QVERIFY(deviceB.setBranch("test") == WP::kOk);
+
+    QVERIFY(deviceA.write("config", QByteArray("0")) == WP::kOk);
+    QVERIFY(deviceA.commit() == WP::kOk);
+    QString base = deviceA.getTip();
+    QByteArray pack;
+    QVERIFY(deviceA.exportPack(pack, "", base, "") == WP::kOk);
+    QVERIFY(deviceB.importPack(pack, "", base) == WP::kOk);
+
+    // A changes the file before B does but commits something else afterwards; commit times
+    // have a resolution of one second
+    QVERIFY(deviceA.write("config", QByteArray("a")) == WP::kOk);
+    QVERIFY(deviceA.commit() == WP::kOk);
+    QTest::qSleep(1100);
+    QVERIFY(deviceB.write("config", QByteArray("b")) == WP::kOk);
+    QVERIFY(deviceB.commit() == WP::kOk);
+    QTest::qSleep(1100);
+    QVERIFY(deviceA.write("other", QByteArray("1")) == WP::kOk);
+    QVERIFY(deviceA.commit() == WP::kOk);
+
+    QString tipB = deviceB.getTip();
+    QVERIFY(deviceB.exportPack(pack, base, tipB, "") == WP::kOk);
+    QVERIFY(deviceA.importPack(pack, base, tipB) == WP::kOk);
+    QByteArray data;
+    QVERIFY(deviceA.read("config", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("b"));
+    QVERIFY(deviceA.read("other", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("1"));
+}
+
+void FejoaTest::testSearchIndex()
+{
+    QCOMPARE(SearchIndex::tokenize("Hello, World! a alice@example.org"),
+             QStringList() << "hello" << "world" << "alice" << "example" << "org");
+
+    SearchIndex index;
+    index.addDocument("m1", 10, "Lunch tomorrow?");
+    index.addDocument("m2", 30, "lunch is at noon");
+    index.addDocument("m3", 20, "Meeting at noon, then lunch");
+    // already indexed
+    index.addDocument("m1", 40, "noon");
+    // enough documents to need multi byte deltas
+    for (int i = 0; i < 300; i++)
+        index.addDocument(QString("f%1").arg(i), 0, "filler");
+    index.addDocument("m4", 5, "lunch filler");
+    QCOMPARE(index.getDocumentCount(), 304);
+
+    // newest first
+    QCOMPARE(index.search("lunch"), QStringList() << "m2" << "m3" << "m1" << "m4");
+    QCOMPARE(index.search("NOON lunch"), QStringList() << "m2" << "m3");
+    QCOMPARE(index.search("lunch", 2), QStringList() << "m2" << "m3");
+    QCOMPARE(index.search("lunch filler"), QStringList() << "m4");
+    QVERIFY(index.search("dinner").isEmpty());
+    QVERIFY(index.search("").isEmpty());
+
+    index.setCommit("abc");
+    QByteArray data;
+    index.toData(data);
+    SearchIndex loaded;
+    QVERIFY(loaded.fromData(data) == WP::kOk);
+    QCOMPARE(loaded.getCommit(), QString("abc"));
+    QCOMPARE(loaded.search("noon lunch"), QStringList() << "m2" << "m3");
+    // appending continues the loaded posting lists
+    loaded.addDocument("m5", 50, "late lunch");
+    QCOMPARE(loaded.search("lunch", 1), QStringList() << "m5");
+    QVERIFY(loaded.fromData(QByteArray("garbage")) != WP::kOk);
+    QVERIFY(loaded.fromData(data.left(data.size() / 2)) != WP::kOk);
+
+    // a corrupt count must not be trusted
+    QByteArray corrupt;
+    QDataStream stream(&corrupt, QIODevice::WriteOnly);
+    stream << QByteArray("FSI1") << QString("abc") << (quint32)0xFFFFFFFF;
+    QVERIFY(loaded.fromData(corrupt) != WP::kOk);
+    QCOMPARE(loaded.getDocumentCount(), 0);
+}
+
+static int collectObjectCallback(const git_oid *oid, void *payload)
+{
+    ((QList<git_oid>*)payload)->append(*oid);
+    return 0;
+}
+
+void FejoaTest::testRepositoryMaintenance()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString repositoryPath = dir.path() + "/repo";
+    QDateTime expiry = QDateTime::currentDateTime().addDays(-1);
+
+    GitInterface *database = new GitInterface();
+    QVERIFY(database->setTo(repositoryPath) == WP::kOk);
+    QVERIFY(database->setBranch("test") == WP::kOk);
+    QVERIFY(database->write("a/file1", QByteArray("1")) == WP::kOk);
+    QVERIFY(database->commit() == WP::kOk);
+    QString firstCommit = database->getTip();
+    QVERIFY(database->write("a/file2", QByteArray("2")) == WP::kOk);
+    QVERIFY(database->commit() == WP::kOk);
+    QVERIFY(RepositoryMaintenance::maintain(repositoryPath, expiry) == WP::kOk);
+
+    // the second commit is now unreachable and only in the pack of the first run
+    QVERIFY(database->updateTip(firstCommit) == WP::kOk);
+    QVERIFY(database->write("b/file3", QByteArray("3")) == WP::kOk);
+    QVERIFY(database->commit() == WP::kOk);
+    // unreachable loose objects
+    QVERIFY(database->write("c/file4", QByteArray("4")) == WP::kOk);
+
+    git_repository *repository;
+    git_odb *objectDatabase;
+    QList<git_oid> objects;
+    QVERIFY(git_repository_open(&repository, repositoryPath.toLatin1().data()) == 0);
+    QVERIFY(git_repository_odb(&objectDatabase, repository) == 0);
+    QVERIFY(git_odb_foreach(objectDatabase, collectObjectCallback, &objects) == 0);
+    git_odb_free(objectDatabase);
+    git_repository_free(repository);
+
+    QVERIFY(RepositoryMaintenance::maintain(repositoryPath, expiry) == WP::kOk);
+    QCOMPARE(QDir(repositoryPath + "/objects/pack").entryList(QStringList("pack-*.pack")).count(), 1);
+
+    // nothing is older than the expiry, every object is still there
+    QVERIFY(git_repository_open(&repository, repositoryPath.toLatin1().data()) == 0);
+    QVERIFY(git_repository_odb(&objectDatabase, repository) == 0);
+    foreach (const git_oid &oid, objects) {
+        git_odb_object *object;
+        QVERIFY(git_odb_read(&object, objectDatabase, &oid) == 0);
+        git_odb_object_free(object);
+    }
+    git_odb_free(objectDatabase);
+    git_repository_free(repository);
+
+    QByteArray data;
+    QVERIFY(database->read("b/file3", data) == WP::kOk);
+    QCOMPARE(data, QByteArray("3"));
+    delete database;
+}
+
+static bool hasRequest(const FakeConnection &connection, const QByteArray &stanza,
+                       const QByteArray &content)
+{
+    foreach (const QByteArray &request, connection.getRequests()) {
+        if (request.contains(stanza) && request.contains(content))
+            return true;
+    }
+    return false;
+}
+
+void FejoaTest::testNotificationChannel()
+{
+    LocalNotificationServer server;
+    QVERIFY2(server.start(), "start local notification server");
+    server.setBranchTip("identities", "1111");
+
+    SSENotificationChannel channel(server.getUrl());
+    QSignalSpy tipSpy(&channel, SIGNAL(branchTipChanged(QString,QString)));
+    QVERIFY2(channel.open() == WP::kOk, "open channel");
+
+    // current tips are sent after opening
+    QTRY_COMPARE(tipSpy.count(), 1);
+    QCOMPARE(tipSpy.at(0).at(0).toString(), QString("identities"));
+    QCOMPARE(tipSpy.at(0).at(1).toString(), QString("1111"));
+
+    // keep alive comments are no events
+    server.sendKeepAlive();
+    server.setBranchTip("mailboxes", "2222");
+    QTRY_COMPARE(tipSpy.count(), 2);
+    QCOMPARE(tipSpy.at(1).at(0).toString(), QString("mailboxes"));
+    QCOMPARE(tipSpy.at(1).at(1).toString(), QString("2222"));
+
+    server.closeClients();
+    QTRY_VERIFY(!channel.isOpen());
+
+    // local commits are pushed without an event from the server
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    GitInterface database;
+    QVERIFY(database.setTo(dir.path() + "/repo") == WP::kOk);
+    QVERIFY(database.setBranch("mailboxes") == WP::kOk);
+    QVERIFY(database.write("message1", QByteArray("1")) == WP::kOk);
+    QVERIFY(database.commit() == WP::kOk);
+    QString remoteTip = database.getTip();
+    server.setBranchTip("mailboxes", remoteTip);
+
+    RemoteDataStorage storage(NULL);
+    storage.setHTTPRemoteConnection(server.getUrl().toString());
+    storage.setSignatureAuth("user", "server_user", "key_store", "key");
+    FakeConnection connection(server.getUrl());
+    // the server stays at the first commit
+    QByteArray pullReply;
+    ProtocolOutStream outStream(&pullReply);
+    outStream.pushStanza(new IqOutStanza(kResult));
+    outStream.pushChildStanza(new OutStanza("sync_pull_batch"));
+    OutStanza *branchStanza = new OutStanza("branch");
+    branchStanza->addAttribute("branch", "mailboxes");
+    branchStanza->addAttribute("tip", remoteTip);
+    outStream.pushChildStanza(branchStanza);
+    outStream.flush();
+    connection.setReply("sync_pull_batch", pullReply);
+
+    RemoteConnectionJobQueue queue(&connection);
+    queue.setRemoteAuthentication(storage.getRemoteAuthenticationInfo(),
+                                  RemoteAuthenticationRef(new FakeAuthentication(&connection)));
+    SyncManagerRef syncManager(new SyncManager(&storage));
+    syncManager->keepSynced(&database);
+    queue.setIdleJob(syncManager);
+
+    // the tips of identities and mailboxes; mailboxes is up to date
+    QTRY_COMPARE(connection.getTipEventCount(), 2);
+    QVERIFY(connection.getRequests().isEmpty());
+
+    QVERIFY(database.write("message2", QByteArray("2")) == WP::kOk);
+    QVERIFY(database.commit() == WP::kOk);
+    QByteArray pushedTip = "last_commit=\"" + database.getTip().toLatin1() + "\"";
+    QTRY_VERIFY(hasRequest(connection, "sync_push_batch", pushedTip));
+    QCOMPARE(connection.getTipEventCount(), 2);
+}
+
+/*! Loads the messages recorded with FEJOA_RECORD_TRAFFIC from the directory in
+FEJOA_RECORDED_TRAFFIC. If not set, a sync session of a few branches is made up. */
+QList<QByteArray> FejoaTest::loadTraffic()
+{
+    QList<QByteArray> messages;
+
+    QString recordDir = QString::fromLocal8Bit(qgetenv("FEJOA_RECORDED_TRAFFIC"));
+    if (recordDir != "") {
+        QDir dir(recordDir);
+        foreach (const QString &fileName, dir.entryList(QStringList("*.xml"), QDir::Files)) {
+            QFile file(dir.filePath(fileName));
+            if (file.open(QIODevice::ReadOnly))
+                messages.append(file.readAll());
+        }
+        return messages;
+    }
+
+    CryptoInterface *crypto = CryptoInterfaceSingleton::getCryptoInterface();
+    const char *branches[] = {"identities", "mailboxes", "key_stores", "profile"};
+    for (int i = 0; i < 4; i++) {
+        QByteArray data;
+        ProtocolOutStream outStream(&data);
+        outStream.pushStanza(new IqOutStanza(kResult));
+        OutStanza *syncStanza = new OutStanza("sync_pull");
+        syncStanza->addAttribute("branch", branches[i]);
+        syncStanza->addAttribute("base", crypto->generateUid());
+        syncStanza->addAttribute("tip", crypto->generateUid());
+        outStream.pushChildStanza(syncStanza);
+        // packs consist of hex ids and already deflated objects
+        QByteArray pack;
+        for (int object = 0; object < 20; object++) {
+            pack.append(crypto->generateUid().toLatin1());
+            pack.append(" 512");
+            pack.append('\0');
+            for (int block = 0; block < 32; block++)
+                pack.append(crypto->generateInitalizationVector(16));
+        }
+        OutStanza *packStanza = new OutStanza("pack");
+        packStanza->setText(pack.toBase64());
+        outStream.pushChildStanza(packStanza);
+        outStream.flush();
+        messages.append(data);
+
+        data.clear();
+        ProtocolOutStream pushStream(&data);
+        pushStream.pushStanza(new IqOutStanza(kResult));
+        OutStanza *pushStanza = new OutStanza("sync_push");
+        pushStanza->addAttribute("branch", branches[i]);
+        pushStanza->addAttribute("tip", crypto->generateUid());
+        pushStream.pushChildStanza(pushStanza);
+        pushStream.flush();
+        messages.append(data);
+    }
+    return messages;
+}
+
+void FejoaTest::testProtocolCompression()
+{
+    QList<QByteArray> messages = loadTraffic();
+    foreach (const QByteArray &message, messages) {
+        QByteArray compressed;
+        QVERIFY2(ProtocolCompression::compress(message, compressed) == WP::kOk, "compress");
+
+        QByteArray plain;
+        QVERIFY2(ProtocolCompression::decompress(compressed, plain) == WP::kOk, "decompress");
+        QVERIFY2(plain == message, "decompressed == plain?");
+
+        // compressed data arrives in small chunks when it is streamed
+        ProtocolInflater inflater;
+        plain.clear();
+        for (int i = 0; i < compressed.size(); i += 7)
+            QVERIFY(inflater.update(compressed.mid(i, 7), plain) == WP::kOk);
+        QVERIFY(inflater.finish() == WP::kOk);
+        QVERIFY2(plain == message, "chunk wise decompressed == plain?");
+    }
+}
+
+void FejoaTest::benchmarkProtocolCompression()
+{
+    QList<QByteArray> messages = loadTraffic();
+    qint64 plainSize = 0;
+    qint64 compressedSize = 0;
+    qint64 zlibSize = 0;
+    foreach (const QByteArray &message, messages) {
+        QByteArray compressed;
+        ProtocolCompression::compress(message, compressed);
+        plainSize += message.size();
+        compressedSize += compressed.size();
+        zlibSize += qCompress(message).size() - 4;
+    }
+    qDebug() << "messages:" << messages.count() << "plain:" << plainSize
+             << "zlib:" << zlibSize << "zlib with dictionary:" << compressedSize;
+
+    QBENCHMARK {
+        foreach (const QByteArray &message, messages) {
+            QByteArray compressed;
+            ProtocolCompression::compress(message, compressed);
+            QByteArray plain;
+            ProtocolCompression::decompress(compressed, plain);
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(FejoaTest)
 
 #include "fejoatest.moc"
@@ -0,0 +1,103 @@
+#include "localnotificationserver.h"
+
+
+LocalNotificationServer::LocalNotificationServer(QObject *parent) :
+    QObject(parent)
+{
+    connect(&server, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+}
+
+LocalNotificationServer::~LocalNotificationServer()
+{
+    closeClients();
+}
+
+bool LocalNotificationServer::start()
+{
+    return server.listen(QHostAddress::LocalHost);
+}
+
+QUrl LocalNotificationServer::getUrl() const
+{
+    return QUrl(QString("http://127.0.0.1:%1/notify.php").arg(server.serverPort()));
+}
+
+void LocalNotificationServer::setBranchTip(const QString &branch, const QString &tip)
+{
+    branchTips[branch] = tip;
+    foreach (QTcpSocket *client, clients)
+        sendTip(client, branch, tip);
+}
+
+void LocalNotificationServer::sendKeepAlive()
+{
+    foreach (QTcpSocket *client, clients) {
+        client->write(": keep alive\n\n");
+        client->flush();
+    }
+}
+
+void LocalNotificationServer::closeClients()
+{
+    QList<QTcpSocket*> openClients = clients;
+    clients.clear();
+    foreach (QTcpSocket *client, openClients) {
+        client->disconnect(this);
+        client->disconnectFromHost();
+        client->deleteLater();
+    }
+}
+
+int LocalNotificationServer::clientCount() const
+{
+    return clients.count();
+}
+
+void LocalNotificationServer::onNewConnection()
+{
+    while (server.hasPendingConnections()) {
+        QTcpSocket *socket = server.nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+    }
+}
+
+void LocalNotificationServer::onReadyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (socket == NULL || clients.contains(socket))
+        return;
+    // wait for the complete request header
+    if (!socket->peek(socket->bytesAvailable()).contains("\r\n\r\n"))
+        return;
+    socket->readAll();
+
+    socket->write("HTTP/1.1 200 OK\r\n"
+                  "Content-Type: text/event-stream\r\n"
+                  "Cache-Control: no-cache\r\n"
+                  "Connection: close\r\n"
+                  "\r\n");
+    clients.append(socket);
+
+    QMap<QString, QString>::const_iterator it;
+    for (it = branchTips.begin(); it != branchTips.end(); it++)
+        sendTip(socket, it.key(), it.value());
+    socket->flush();
+}
+
+void LocalNotificationServer::onDisconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (socket == NULL)
+        return;
+    clients.removeAll(socket);
+    socket->deleteLater();
+}
+
+void LocalNotificationServer::sendTip(QTcpSocket *client, const QString &branch, const QString &tip)
+{
+    QByteArray event = "event: tip\ndata: ";
+    event += branch.toUtf8() + " " + tip.toLatin1() + "\n\n";
+    client->write(event);
+    client->flush();
+}
@@ -0,0 +1,43 @@
+#ifndef LOCALNOTIFICATIONSERVER_H
+#define LOCALNOTIFICATIONSERVER_H
+
+#include <QList>
+#include <QMap>
+#include <QUrl>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+
+
+/*! Local stand-in for php_server/notify.php. Speaks just enough HTTP to serve a server-sent events
+stream of branch tip changes. */
+class LocalNotificationServer : public QObject
+{
+Q_OBJECT
+public:
+    LocalNotificationServer(QObject *parent = NULL);
+    ~LocalNotificationServer();
+
+    bool start();
+    QUrl getUrl() const;
+
+    //! Updates the tip and pushes it to all connected clients.
+    void setBranchTip(const QString &branch, const QString &tip);
+    void sendKeepAlive();
+    void closeClients();
+    int clientCount() const;
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onDisconnected();
+
+private:
+    void sendTip(QTcpSocket *client, const QString &branch, const QString &tip);
+
+    QTcpServer server;
+    QMap<QString, QString> branchTips;
+    //! clients that have sent the request header and receive events
+    QList<QTcpSocket*> clients;
+};
+
+#endif // LOCALNOTIFICATIONSERVER_H
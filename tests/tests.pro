@@ -17,7 +17,13 @@ TEMPLATE = app
 
 
 SOURCES += \
-    fejoatest.cpp
+    fakeconnection.cpp \
+    fejoatest.cpp \
+    localnotificationserver.cpp
+
+HEADERS += \
+    fakeconnection.h \
+    localnotificationserver.h
 
 LIBS += -L$$PWD/../../build-fejoa-Desktop-Debug/support/ -lfejoa_support
 LIBS += -L/user/lib -lcryptopp -lgit2